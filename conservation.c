@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include "conservation.h"
+#include "opt.h"
+
+/*singular values and weights below this (relative) count as zero*/
+#define CONSERVATION_EPS 1.0e-10
+
+Conservation * conservationLaws(int N, int R, double * S)
+{
+   int i, j, r, k = 0;
+   if (N < 1 || R < 0 || (R > 0 && S == NULL)) return (0);
+
+   /*c^T S = 0 for a law c: the null space of S^T*/
+   double * St = malloc((R * N + 1) * sizeof(double));
+   double * ns = malloc(N * N * sizeof(double));
+   for (i=0; i < N; ++i)
+      for (j=0; j < R; ++j)
+         St[j*N + i] = S[i*R + j];
+   nullspace(R, N, St, ns, &k, CONSERVATION_EPS);
+   free(St);
+   if (k == 0)
+   {
+      free(ns);
+      return (0);
+   }
+
+   Conservation * c = malloc(sizeof(Conservation));
+   (*c).numVars = N;
+   (*c).numLaws = k;
+   (*c).laws = ns;
+   (*c).dependent = malloc(k * sizeof(int));
+   (*c).independent = malloc((N - k + 1) * sizeof(int));
+   int * used = calloc(N, sizeof(int));
+
+   /*Gauss-Jordan elimination, each law solved for its largest remaining weight*/
+   for (r=0; r < k; ++r)
+   {
+      int p = -1;
+      for (j=0; j < N; ++j)
+         if (!used[j] && (p < 0 || fabs(ns[r*N + j]) > fabs(ns[r*N + p]))) p = j;
+      used[p] = 1;
+      (*c).dependent[r] = p;
+      double pivot = ns[r*N + p];
+      for (j=0; j < N; ++j) ns[r*N + j] /= pivot;
+      for (i=0; i < k; ++i)
+      {
+         double m = ns[i*N + p];
+         if (i == r || m == 0) continue;
+         for (j=0; j < N; ++j) ns[i*N + j] -= m * ns[r*N + j];
+      }
+   }
+   for (i=0; i < k*N; ++i)   //round-off where the weights should be 0
+      if (fabs(ns[i]) < CONSERVATION_EPS) ns[i] = 0;
+
+   for (j=0, i=0; j < N; ++j)
+      if (!used[j]) (*c).independent[i++] = j;
+   free(used);
+   return (c);
+}
+
+void conservationFree(Conservation * c)
+{
+   if (c == NULL) return;
+   free((*c).laws);
+   free((*c).dependent);
+   free((*c).independent);
+   free(c);
+}
+
+void conservationTotals(Conservation * c, double * x, double * totals)
+{
+   int i, j, N = (*c).numVars;
+   for (i=0; i < (*c).numLaws; ++i)
+   {
+      totals[i] = 0;
+      for (j=0; j < N; ++j) totals[i] += (*c).laws[i*N + j] * x[j];
+   }
+}
+
+void conservationReduce(Conservation * c, double * x, double * xr)
+{
+   int i;
+   for (i=0; i < (*c).numVars - (*c).numLaws; ++i)
+      xr[i] = x[ (*c).independent[i] ];
+}
+
+void conservationExpand(Conservation * c, double * xr, double * totals, double * x)
+{
+   int i, j, N = (*c).numVars, n = N - (*c).numLaws;
+   for (j=0; j < n; ++j)
+      x[ (*c).independent[j] ] = xr[j];
+   for (i=0; i < (*c).numLaws; ++i)   //law i has weight 1 on its dependent variable and 0 on the others
+   {
+      double v = totals[i];
+      for (j=0; j < n; ++j) v -= (*c).laws[i*N + (*c).independent[j]] * xr[j];
+      x[ (*c).dependent[i] ] = v;
+   }
+}
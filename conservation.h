@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include <math.h>
+
+#ifndef GA_CONSERVATION_FILE
+#define GA_CONSERVATION_FILE
+
+/*
+ * Conservation laws of a reaction network: weighted sums of the variables that no reaction
+ * changes (the left null space of the stoichiometry matrix). Each law fixes one variable, so
+ * the ode can be integrated for the others alone and the fixed ones computed from the totals.
+ * The laws are kept in reduced row echelon form: law i has weight 1 on dependent[i] and 0
+ * on the other dependent variables
+*/
+typedef struct
+{
+   int numVars;        //variables of the full system
+   int numLaws;        //independent laws (variables removed by the reduction)
+   double * laws;      //numLaws x numVars: the weights of each conserved total
+   int * dependent;    //numLaws variables computed from the totals
+   int * independent;  //numVars - numLaws variables that are integrated
+} Conservation;
+
+/*
+ * find the conservation laws of a network
+ * @param: number of variables (species)
+ * @param: number of reactions
+ * @param: stoichiometry matrix, numVars x numReactions, row by row
+ * @ret: the laws, or 0 if there are none
+*/
+Conservation * conservationLaws(int N, int R, double * S);
+
+/*
+ * free the laws
+ * @param: laws (may be null)
+*/
+void conservationFree(Conservation *);
+
+/*
+ * conserved totals of a state
+ * @param: laws
+ * @param: full state (numVars values)
+ * @param: receives numLaws totals
+*/
+void conservationTotals(Conservation *, double * x, double * totals);
+
+/*
+ * the independent variables of a state
+ * @param: laws
+ * @param: full state (numVars values)
+ * @param: receives numVars - numLaws values
+*/
+void conservationReduce(Conservation *, double * x, double * xr);
+
+/*
+ * the full state from the independent variables and the totals
+ * @param: laws
+ * @param: independent variables (numVars - numLaws values)
+ * @param: totals (numLaws values)
+ * @param: receives the full state (numVars values)
+*/
+void conservationExpand(Conservation *, double * xr, double * totals, double * x);
+
+#endif
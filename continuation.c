@@ -0,0 +1,319 @@
+#include "continuation.h"
+#include "fold.h"
+#include "cvodesim.h"
+#include "opt.h"
+#include "metrics.h"
+
+#define CONTINUATION_CORRECTOR  8        //chord iterations per step
+#define CONTINUATION_QUICK      4        //steps corrected within this many iterations make the next one longer
+#define CONTINUATION_TOL        1.0e-9   //norm of the ode function accepted as a steady state
+#define CONTINUATION_EPSILON    1.0e-6   //relative step of the parameter derivative
+#define CONTINUATION_FOLD_STEPS 20       //Newton steps of foldPolish
+
+/*one continuation; the unknowns are u = (x, s), with p = exp(s) or p = s * scale*/
+typedef struct
+{
+   int N;
+   double * param;
+   int logScale;      //1 = s is the log of the parameter
+   double scale;
+   void (*odefnc)(double,double*,double*,void*);
+   void * params;
+   double * B;        //(N+1) x (N+1): factors of [J f_s; t] at the last point
+   int * pivot;
+   double * wr, * wi; //N: eigenvalues at the last point
+   double * f1, * f2; //N: work space
+} Tracer;
+
+static double toParam(Tracer * C, double s)
+{
+   return ((*C).logScale ? exp(s) : s * (*C).scale);
+}
+
+/*ode function at x with the parameter at s*/
+static void tracerRHS(Tracer * C, double * x, double s, double * dx)
+{
+   METRIC_INC(METRIC_RHS_EVALS);
+   *((*C).param) = toParam(C, s);
+   (*C).odefnc(1.0, x, dx, (*C).params);
+}
+
+static double norm(int n, double * a)
+{
+   int i;
+   double s = 0;
+   for (i=0; i < n; ++i) s += a[i] * a[i];
+   return (sqrt(s));
+}
+
+/*
+ * factor the bordered matrix at the point u, with last row r, and get the unit tangent there,
+ * oriented along r, and the stability of the state
+ * @param: point
+ * @param: last row of the bordered matrix (the previous tangent)
+ * @param: receives the tangent
+ * @param: receives the number of eigenvalues with positive real part (-1 if unknown)
+ * @param: receives the largest real part of a complex eigenvalue (-HUGE_VAL if there is none)
+ * @ret: 0, or 1 if the budget is exhausted or the matrix is singular
+*/
+static int tracerFactor(Tracer * C, double * u, double * r, double * t, int * unstable, double * complexRe)
+{
+   int i, j, N = (*C).N, m = N+1;
+   double s = u[N], ds = CONTINUATION_EPSILON * fmax(fabs(s), 1.0);
+   *((*C).param) = toParam(C, s);
+   double * J = jacobian(N, u, (*C).odefnc, (*C).params);
+   if (!J) return (1);
+
+   *unstable = -1;
+   *complexRe = -HUGE_VAL;
+   if (matrixeigenvalues(N, J, (*C).wr, (*C).wi) >= 0)
+   {
+      *unstable = 0;
+      for (i=0; i < N; ++i)
+      {
+         if ((*C).wr[i] > 0) ++(*unstable);
+         if ((*C).wi[i] != 0 && (*C).wr[i] > *complexRe) *complexRe = (*C).wr[i];
+      }
+   }
+
+   tracerRHS(C, u, s + ds, (*C).f1);
+   tracerRHS(C, u, s - ds, (*C).f2);
+   for (i=0; i < N; ++i)
+   {
+      for (j=0; j < N; ++j) (*C).B[i*m + j] = getValue(J,N,i,j);
+      (*C).B[i*m + N] = ((*C).f1[i] - (*C).f2[i]) / (2.0 * ds);
+   }
+   for (j=0; j < m; ++j) (*C).B[N*m + j] = r[j];
+   free(J);
+   *((*C).param) = toParam(C, s);
+   if (matrixlu(m, (*C).B, (*C).pivot) != success) return (1);
+
+   for (i=0; i < N; ++i) t[i] = 0;
+   t[N] = 1.0;
+   matrixlusolve(m, (*C).B, (*C).pivot, t);
+   double n = norm(m, t), d = 0;
+   for (i=0; i < m; ++i) d += t[i] * r[i];
+   if (!(n > 0) || !isfinite(n)) return (1);
+   for (i=0; i < m; ++i) t[i] /= (d < 0) ? -n : n;
+   return (0);
+}
+
+/*
+ * one predictor-corrector step of length h along the tangent t from u, with the factors of the
+ * last point (chord iterations)
+ * @param: receives the new point
+ * @ret: number of iterations, or -1 if the corrections did not converge
+*/
+static int tracerStep(Tracer * C, double * u, double * t, double h, double * v)
+{
+   int i, k, N = (*C).N, m = N+1;
+   double * up = METRIC_MALLOC(2 * m * sizeof(double)), * dv = up + m, last = HUGE_VAL;
+   for (i=0; i < m; ++i) v[i] = up[i] = u[i] + h * t[i];
+
+   for (k=0; k <= CONTINUATION_CORRECTOR; ++k)
+   {
+      tracerRHS(C, v, v[N], dv);
+      double r = norm(N, dv);
+      if (!isfinite(r)) break;
+      if (r < CONTINUATION_TOL)
+      {
+         for (i=0; i < m; ++i) dv[i] = v[i] - up[i];
+         r = norm(m, dv);
+         free(up);
+         return (r <= h) ? k : -1;   //farther means another branch
+      }
+      if (k == CONTINUATION_CORRECTOR || r > last) break;
+      last = r;
+      dv[N] = 0;
+      for (i=0; i < m; ++i) dv[N] += t[i] * (v[i] - up[i]);
+      for (i=0; i < m; ++i) dv[i] = -dv[i];
+      matrixlusolve(m, (*C).B, (*C).pivot, dv);
+      for (i=0; i < m; ++i) v[i] += dv[i];
+      METRIC_INC(METRIC_NEWTON_ITERATIONS);
+   }
+   free(up);
+   return (-1);
+}
+
+/*append a row to a table of one direction*/
+static void addRow(Tracer * C, double * rows, int * n, double * u, int unstable, int type)
+{
+   int i, N = (*C).N;
+   double * row = rows + (*n) * (N+3);
+   row[0] = toParam(C, u[N]);
+   for (i=0; i < N; ++i) row[1+i] = u[i];
+   row[N+1] = unstable;
+   row[N+2] = type;
+   ++(*n);
+}
+
+/*
+ * the special point between two consecutive points of the branch, if any: a fold where the
+ * parameter component of the tangent changes sign, otherwise a change of stability
+*/
+static void specialPoint(Tracer * C, double * rows, int * n, double * u0, double * t0, int n0, double re0,
+                         double * u1, double * t1, int n1, double re1)
+{
+   int i, N = (*C).N, m = N+1, type = CONTINUATION_POINT;
+   double theta = 0.5;
+   if (t0[N] * t1[N] < 0)
+   {
+      double * u = (fabs(t0[N]) < fabs(t1[N])) ? u0 : u1;
+      *((*C).param) = toParam(C, u[N]);
+      FoldPoint * fold = foldPolish(N, u, (*C).param, (*C).odefnc, (*C).params, CONTINUATION_FOLD_STEPS, CONTINUATION_TOL);
+      if (fold)
+      {
+         double * row = rows + (*n) * (N+3);
+         row[0] = (*fold).param;
+         for (i=0; i < N; ++i) row[1+i] = (*fold).x[i];
+         row[N+1] = (n0 < n1) ? n0 : n1;
+         row[N+2] = CONTINUATION_FOLD;
+         ++(*n);
+         foldFree(fold);
+         return;
+      }
+      type = CONTINUATION_FOLD;
+      theta = t0[N] / (t0[N] - t1[N]);
+   }
+   else if (n0 >= 0 && n1 >= 0 && n0 != n1)
+   {
+      type = ((n0 - n1) % 2 == 0) ? CONTINUATION_HOPF : CONTINUATION_BRANCH;
+      if (type == CONTINUATION_HOPF && re0 * re1 < 0) theta = re0 / (re0 - re1);
+   }
+   if (type == CONTINUATION_POINT) return;
+
+   double * u = METRIC_MALLOC(m * sizeof(double));
+   for (i=0; i < m; ++i) u[i] = u0[i] + theta * (u1[i] - u0[i]);
+   addRow(C, rows, n, u, (n0 < n1) ? n0 : n1, type);
+   free(u);
+}
+
+/*
+ * follow the branch one way from u until it leaves [smin, smax], the step gets too small, or the
+ * points run out
+ * @param: receives the rows, up to 2 * maxPoints + 1
+ * @ret: number of rows
+*/
+static int trace(Tracer * C, double * u, int dir, double smin, double smax, int maxPoints, double * rows)
+{
+   int i, k, n = 0, N = (*C).N, m = N+1, n0, n1, iterations, landing = 0;
+   double h = CONTINUATION_FIRST_STEP, re0, re1;
+   double * w = METRIC_MALLOC(5 * m * sizeof(double)),
+          * u0 = w, * t0 = u0 + m, * u1 = t0 + m, * t1 = u1 + m, * r = t1 + m;
+
+   for (i=0; i < m; ++i)
+   {
+      u0[i] = u[i];
+      r[i] = (i == N) ? dir : 0;
+   }
+   if (tracerFactor(C, u0, r, t0, &n0, &re0))
+   {
+      free(w);
+      return (0);
+   }
+   addRow(C, rows, &n, u0, n0, CONTINUATION_END);
+
+   for (k=1; k < maxPoints; )
+   {
+      iterations = tracerStep(C, u0, t0, h, u1);
+      if (iterations < 0)
+      {
+         h *= 0.5;
+         if (h < CONTINUATION_MIN_STEP) break;
+         continue;
+      }
+      if (!landing && (u1[N] < smin || u1[N] > smax))   //shorten the step once to end on the edge of the range
+      {
+         double edge = (u1[N] < smin) ? smin : smax;
+         if (u1[N] == u0[N]) break;
+         landing = 1;
+         h *= (edge - u0[N]) / (u1[N] - u0[N]);
+         if (h < CONTINUATION_MIN_STEP) break;
+         continue;
+      }
+      if (tracerFactor(C, u1, t0, t1, &n1, &re1)) break;
+      specialPoint(C, rows, &n, u0, t0, n0, re0, u1, t1, n1, re1);
+      addRow(C, rows, &n, u1, n1, CONTINUATION_POINT);
+      ++k;
+      for (i=0; i < m; ++i)
+      {
+         u0[i] = u1[i];
+         t0[i] = t1[i];
+      }
+      n0 = n1;
+      re0 = re1;
+      if (landing) break;
+      if (iterations <= CONTINUATION_QUICK) h = fmin(2.0 * h, CONTINUATION_MAX_STEP);
+   }
+   if (n > 1) rows[(n-1) * (N+3) + N+2] = CONTINUATION_END;
+   free(w);
+   return (n);
+}
+
+Branch * continuation(int N, double * x, double * param, void (*odefnc)(double,double*,double*,void*), void * params,
+                      double pmin, double pmax, int maxPoints)
+{
+   if (N < 1 || x == 0 || param == 0 || odefnc == 0 || maxPoints < 2 || !(pmin < pmax)) return (0);
+
+   int i, k, m = N+1, cols = N+3, n[2];
+   double p0 = *param;
+   Tracer C;
+   C.N = N;
+   C.param = param;
+   C.logScale = (p0 > 0 && pmin > 0);
+   C.scale = fmax(fabs(p0), 1.0);
+   C.odefnc = odefnc;
+   C.params = params;
+   C.B = METRIC_MALLOC((m*m + 4*N + m) * sizeof(double));
+   C.wr = C.B + m*m;
+   C.wi = C.wr + N;
+   C.f1 = C.wi + N;
+   C.f2 = C.f1 + N;
+   C.pivot = METRIC_MALLOC(m * sizeof(int));
+   double * u = C.f2 + N;
+   double * rows[2];
+   rows[0] = METRIC_MALLOC(2 * (2*maxPoints + 1) * cols * sizeof(double));
+   rows[1] = rows[0] + (2*maxPoints + 1) * cols;
+
+   double smin = C.logScale ? log(pmin) : pmin / C.scale,
+          smax = C.logScale ? log(pmax) : pmax / C.scale;
+   for (i=0; i < N; ++i) u[i] = x[i];
+   u[N] = C.logScale ? log(p0) : p0 / C.scale;
+
+   Branch * branch = 0;
+   if (u[N] >= smin && u[N] <= smax &&
+       deflatedNewton(N, u, odefnc, params, 0, 0, CONTINUATION_TOL * CONTINUATION_TOL, 20, 0))
+   {
+      for (k=0; k < 2; ++k)
+         n[k] = trace(&C, u, k ? -1 : 1, smin, smax, maxPoints, rows[k]);
+      if (n[0] > 0 && n[1] > 0)
+      {
+         //the way down reversed, then the way up without its first point (the same one)
+         branch = METRIC_MALLOC(sizeof(Branch));
+         (*branch).numVars = N;
+         (*branch).numPoints = n[0] + n[1] - 1;
+         (*branch).table = METRIC_MALLOC((*branch).numPoints * cols * sizeof(double));
+         for (k=0; k < n[1]; ++k)
+            for (i=0; i < cols; ++i)
+               (*branch).table[k*cols + i] = rows[1][(n[1]-1-k)*cols + i];
+         for (k=1; k < n[0]; ++k)
+            for (i=0; i < cols; ++i)
+               (*branch).table[(n[1]+k-1)*cols + i] = rows[0][k*cols + i];
+         if (n[1] > 1 && n[0] > 1)
+            (*branch).table[(n[1]-1)*cols + N+2] = CONTINUATION_POINT;
+      }
+   }
+
+   *param = p0;
+   free(C.B);
+   free(C.pivot);
+   free(rows[0]);
+   return (branch);
+}
+
+void branchFree(Branch * branch)
+{
+   if (!branch) return;
+   free((*branch).table);
+   free(branch);
+}
@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#ifndef GA_CONTINUATION_FILE
+#define GA_CONTINUATION_FILE
+
+/*type of each point of a branch (last column of its table)*/
+#define CONTINUATION_POINT   0   //regular point
+#define CONTINUATION_FOLD    1   //fold (saddle-node): the branch turns back in the parameter
+#define CONTINUATION_HOPF    2   //a complex pair of eigenvalues crosses the imaginary axis
+#define CONTINUATION_BRANCH  3   //a real eigenvalue crosses zero where the branch does not turn (branch point)
+#define CONTINUATION_END     4   //first or last point (range left, step too small, or budget exhausted)
+
+/*step control of the continuation, in arclength of (state, log of a positive parameter or parameter / max(|p|,1))*/
+#define CONTINUATION_FIRST_STEP  0.02
+#define CONTINUATION_MAX_STEP    0.2
+#define CONTINUATION_MIN_STEP    1.0e-6
+
+/*
+ * A branch of steady states in one parameter, as a table with one row per point:
+ *    parameter, state (numVars columns), number of eigenvalues of the Jacobian with positive real part, type
+ * ordered along the branch. Write it with writeToFile(name, table, numPoints, numVars+3)
+*/
+typedef struct
+{
+   int numVars;
+   int numPoints;
+   double * table;   //numPoints x (numVars+3)
+} Branch;
+
+/*
+ * Trace the branch of steady states through x in one parameter, both ways from its value, by
+ * pseudo-arclength continuation: tangent predictor, then chord Newton corrections on
+ *    f(x,p) = 0,   t.(u - u_predicted) = 0
+ * with u = (x, p) and t the tangent. The bordered matrix [J f_p; t] is factored once per point
+ * (see matrixlu) and the factors serve for the tangent there and for every correction of the next
+ * step, so each point costs one Jacobian (see jacobian) and a few ode function calls. The step
+ * grows after quick corrections and is halved after failed ones. A change of sign of the parameter
+ * component of the tangent is a fold, located by foldPolish; a change in the number of unstable
+ * eigenvalues (see matrixeigenvalues) elsewhere is a Hopf or a branch point, located by linear
+ * interpolation. A positive parameter is followed in its logarithm. The system must have no
+ * conservation laws, or J is singular everywhere
+ * @param: number of variables
+ * @param: steady state to start from (corrected by Newton iterations first)
+ * @param: the free parameter, inside params; it is changed during the continuation and restored on return
+ * @param: ode function pointer
+ * @param: additional parameters needed for ode function
+ * @param: lowest value of the parameter
+ * @param: highest value of the parameter
+ * @param: maximum number of points each way
+ * @ret: the branch, or 0 if x is not near a regular steady state
+*/
+Branch * continuation(int N, double * x, double * param, void (*odefnc)(double,double*,double*,void*), void * params,
+                      double pmin, double pmax, int maxPoints);
+
+/*
+ * free the structure
+ * @param: branch (may be null)
+*/
+void branchFree(Branch *);
+
+#endif
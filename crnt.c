@@ -0,0 +1,223 @@
+#include "crnt.h"
+#include "opt.h"
+
+/*singular values below this (relative) count as zero*/
+#define CRNT_EPS 1.0e-10
+
+/*index of a complex, added to the list if it is new*/
+static int findComplex(ReactionNetwork * net, int N, int R, double * side, int reaction)
+{
+   int c, i;
+   for (c=0; c < (*net).numComplexes; ++c)
+   {
+      for (i=0; i < N && (*net).complexes[c*N + i] == side[i*R + reaction]; ++i) ;
+      if (i == N) return (c);
+   }
+   for (i=0; i < N; ++i) (*net).complexes[c*N + i] = side[i*R + reaction];
+   ++(*net).numComplexes;
+   return (c);
+}
+
+/*rank of the reactions of one linkage class (all of them when the class is -1)*/
+static int stoichiometricRank(ReactionNetwork * net, int linkageClass)
+{
+   int i, j, k, r = 0, N = (*net).numSpecies, R = (*net).numReactions;
+   int * cols = malloc((R + 1) * sizeof(int));
+   for (j=0; j < R; ++j)
+      if (linkageClass < 0 || (*net).linkage[ (*net).reactant[j] ] == linkageClass) cols[r++] = j;
+   if (r == 0)
+   {
+      free(cols);
+      return (0);
+   }
+
+   double * S = malloc(N * r * sizeof(double)), * V = malloc(r * r * sizeof(double));
+   int * order = malloc(r * sizeof(int));
+   for (i=0; i < N; ++i)
+      for (k=0; k < r; ++k)
+      {
+         j = cols[k];
+         S[i*r + k] = (*net).complexes[ (*net).product[j] * N + i ] - (*net).complexes[ (*net).reactant[j] * N + i ];
+      }
+   int rank = svd(N, r, S, V, order, CRNT_EPS);
+   free(S);
+   free(V);
+   free(order);
+   free(cols);
+   return (rank);
+}
+
+/*Tarjan's algorithm for the strongly connected parts of the complex graph*/
+typedef struct
+{
+   ReactionNetwork * net;
+   int counter, top;
+   int * index, * low, * onStack, * stack;
+} Tarjan;
+
+static void strongConnect(Tarjan * t, int v)
+{
+   ReactionNetwork * net = (*t).net;
+   int j, w;
+   (*t).index[v] = (*t).low[v] = (*t).counter++;
+   (*t).stack[ (*t).top++ ] = v;
+   (*t).onStack[v] = 1;
+
+   for (j=0; j < (*net).numReactions; ++j)
+   {
+      if ((*net).reactant[j] != v) continue;
+      w = (*net).product[j];
+      if ((*t).index[w] < 0)
+      {
+         strongConnect(t, w);
+         if ((*t).low[w] < (*t).low[v]) (*t).low[v] = (*t).low[w];
+      }
+      else
+      if ((*t).onStack[w] && (*t).index[w] < (*t).low[v])
+         (*t).low[v] = (*t).index[w];
+   }
+
+   if ((*t).low[v] == (*t).index[v])   //v is the root of a strong linkage class
+   {
+      do
+      {
+         w = (*t).stack[ --(*t).top ];
+         (*t).onStack[w] = 0;
+         (*net).strong[w] = (*net).numStrongClasses;
+      }
+      while (w != v);
+      ++(*net).numStrongClasses;
+   }
+}
+
+ReactionNetwork * networkAnalyze(int N, int R, double * reactants, double * products)
+{
+   int c, i, j, k;
+   if (N < 1 || R < 1 || reactants == NULL || products == NULL) return (0);
+
+   ReactionNetwork * net = malloc(sizeof(ReactionNetwork));
+   (*net).numSpecies = N;
+   (*net).numReactions = R;
+   (*net).numComplexes = 0;
+   (*net).complexes = malloc(2 * R * N * sizeof(double));
+   (*net).reactant = malloc(R * sizeof(int));
+   (*net).product = malloc(R * sizeof(int));
+   for (j=0; j < R; ++j)
+   {
+      (*net).reactant[j] = findComplex(net, N, R, reactants, j);
+      (*net).product[j] = findComplex(net, N, R, products, j);
+   }
+   int C = (*net).numComplexes;
+
+   /*linkage classes: connected parts of the graph without directions (union-find)*/
+   int * parent = malloc(C * sizeof(int));
+   for (c=0; c < C; ++c) parent[c] = c;
+   for (j=0; j < R; ++j)
+   {
+      int a = (*net).reactant[j], b = (*net).product[j];
+      while (parent[a] != a) a = parent[a] = parent[parent[a]];
+      while (parent[b] != b) b = parent[b] = parent[parent[b]];
+      if (a != b) parent[a] = b;
+   }
+   (*net).linkage = malloc(C * sizeof(int));
+   (*net).numLinkageClasses = 0;
+   for (c=0; c < C; ++c) (*net).linkage[c] = -1;
+   for (c=0; c < C; ++c)
+   {
+      int root = c;
+      while (parent[root] != root) root = parent[root];
+      if ((*net).linkage[root] < 0) (*net).linkage[root] = (*net).numLinkageClasses++;
+      (*net).linkage[c] = (*net).linkage[root];
+   }
+   free(parent);
+
+   /*strong linkage classes, and the terminal ones*/
+   Tarjan t;
+   t.net = net;
+   t.counter = t.top = 0;
+   t.index = malloc(4 * C * sizeof(int));
+   t.low = t.index + C;
+   t.onStack = t.low + C;
+   t.stack = t.onStack + C;
+   (*net).strong = malloc(C * sizeof(int));
+   (*net).numStrongClasses = 0;
+   for (c=0; c < C; ++c)
+   {
+      t.index[c] = -1;
+      t.onStack[c] = 0;
+   }
+   for (c=0; c < C; ++c)
+      if (t.index[c] < 0) strongConnect(&t, c);
+   free(t.index);
+
+   int S = (*net).numStrongClasses, L = (*net).numLinkageClasses;
+   int * terminal = malloc(S * sizeof(int)), * terminalPerClass = calloc(L, sizeof(int));
+   for (k=0; k < S; ++k) terminal[k] = 1;
+   for (j=0; j < R; ++j)
+      if ((*net).strong[ (*net).reactant[j] ] != (*net).strong[ (*net).product[j] ])
+         terminal[ (*net).strong[ (*net).reactant[j] ] ] = 0;
+   (*net).numTerminalClasses = 0;
+   for (c=0; c < C; ++c)   //count each strong class once, at its first complex
+   {
+      k = (*net).strong[c];
+      for (i=0; i < c && (*net).strong[i] != k; ++i) ;
+      if (i == c && terminal[k])
+      {
+         ++(*net).numTerminalClasses;
+         ++terminalPerClass[ (*net).linkage[c] ];
+      }
+   }
+   (*net).weaklyReversible = (S == L);
+
+   /*deficiency of the network and of each linkage class*/
+   (*net).rank = stoichiometricRank(net, -1);
+   (*net).deficiency = C - L - (*net).rank;
+   (*net).linkageDeficiency = malloc(L * sizeof(int));
+   int sum = 0, atMostOne = 1, oneTerminal = 1;
+   for (k=0; k < L; ++k)
+   {
+      int complexes = 0;
+      for (c=0; c < C; ++c) complexes += ((*net).linkage[c] == k);
+      (*net).linkageDeficiency[k] = complexes - 1 - stoichiometricRank(net, k);
+      sum += (*net).linkageDeficiency[k];
+      if ((*net).linkageDeficiency[k] > 1) atMostOne = 0;
+      if (terminalPerClass[k] != 1) oneTerminal = 0;
+   }
+   free(terminal);
+   free(terminalPerClass);
+
+   (*net).verdict = NETWORK_UNKNOWN;
+   if ((*net).deficiency == 0)
+      (*net).verdict = NETWORK_DEFICIENCY_ZERO;
+   else
+   if (atMostOne && oneTerminal && sum == (*net).deficiency)
+      (*net).verdict = NETWORK_DEFICIENCY_ONE;
+   return (net);
+}
+
+void networkFree(ReactionNetwork * net)
+{
+   if (net == NULL) return;
+   free((*net).complexes);
+   free((*net).reactant);
+   free((*net).product);
+   free((*net).linkage);
+   free((*net).strong);
+   free((*net).linkageDeficiency);
+   free(net);
+}
+
+void networkPrint(FILE * out, ReactionNetwork * net)
+{
+   static const char * VERDICTS[] =
+   {
+      "the theorems do not apply: it may be multistable",
+      "deficiency zero: at most one positive steady state in each class",
+      "deficiency one theorem: at most one positive steady state in each class"
+   };
+   if (out == NULL || net == NULL) return;
+   fprintf(out, "%i complexes, %i linkage classes (%i strong, %i terminal), rank %i, deficiency %i%s\n",
+           (*net).numComplexes, (*net).numLinkageClasses, (*net).numStrongClasses, (*net).numTerminalClasses,
+           (*net).rank, (*net).deficiency, (*net).weaklyReversible ? ", weakly reversible" : "");
+   fprintf(out, "%s\n", VERDICTS[ (*net).verdict ]);
+}
@@ -0,0 +1,69 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#ifndef GA_CRNT_FILE
+#define GA_CRNT_FILE
+
+/*what the structure of a network says about its steady states (see networkAnalyze)*/
+#define NETWORK_UNKNOWN          0   //neither theorem applies: the network may be multistable
+#define NETWORK_DEFICIENCY_ZERO  1   //deficiency zero theorem: at most one positive steady state in each class
+#define NETWORK_DEFICIENCY_ONE   2   //deficiency one theorem: at most one positive steady state in each class
+
+/*
+ * Chemical reaction network theory (Horn, Jackson and Feinberg) for a network given by the
+ * species on each side of its reactions. A complex is a distinct side (including the empty one,
+ * for inflow and outflow); the reactions make the complexes a directed graph whose connected
+ * parts are the linkage classes and whose strongly connected parts are the strong linkage
+ * classes (terminal when no reaction leaves them). The deficiency is
+ *    complexes - linkage classes - rank of the stoichiometry matrix
+ * Under mass-action kinetics, with any rate constants, a network of deficiency zero has at most
+ * one positive steady state in each stoichiometric class (none unless it is weakly reversible),
+ * and so has a network whose linkage classes each have deficiency at most one, adding up to the
+ * deficiency, and one terminal strong linkage class each. Such a network cannot be bistable
+*/
+typedef struct
+{
+   int numSpecies;
+   int numReactions;
+   int numComplexes;
+   double * complexes;       //numComplexes x numSpecies: the species of each complex
+   int * reactant;           //complex on the left of each reaction
+   int * product;            //complex on the right of each reaction
+   int numLinkageClasses;
+   int * linkage;            //linkage class of each complex
+   int numStrongClasses;
+   int * strong;             //strong linkage class of each complex
+   int numTerminalClasses;   //strong linkage classes that no reaction leaves
+   int rank;                 //rank of the stoichiometry matrix
+   int deficiency;
+   int * linkageDeficiency;  //deficiency of each linkage class
+   int weaklyReversible;     //1 if every linkage class is strongly connected
+   int verdict;              //NETWORK_UNKNOWN, NETWORK_DEFICIENCY_ZERO or NETWORK_DEFICIENCY_ONE
+} ReactionNetwork;
+
+/*
+ * find the complexes, linkage classes and deficiency of a network and apply the
+ * deficiency zero and deficiency one theorems
+ * @param: number of species
+ * @param: number of reactions
+ * @param: species consumed by each reaction, species x reactions, row by row
+ * @param: species produced by each reaction, species x reactions, row by row
+ * @ret: the structure, or 0 if the network is empty
+*/
+ReactionNetwork * networkAnalyze(int N, int R, double * reactants, double * products);
+
+/*
+ * free the structure
+ * @param: structure (may be null)
+*/
+void networkFree(ReactionNetwork *);
+
+/*
+ * print a summary: complexes, linkage classes, rank, deficiency and the verdict
+ * @param: output file
+ * @param: structure
+*/
+void networkPrint(FILE *, ReactionNetwork *);
+
+#endif
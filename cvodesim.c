@@ -1,4 +1,7 @@
 #include "cvodesim.h"
+#include "metrics.h"
+#include "opt.h"
+#include <time.h>
 
 /*
  * The differential equations function
@@ -7,16 +10,172 @@
  * @param: derviatives array used as the return array
  * @param: any other data pointer that is needed for the simulation
 */
-static void (*ODEfunc)(double, double*, double*, void*) = NULL;
+static THREAD_LOCAL void (*ODEfunc)(double, double*, double*, void*) = NULL;
 
 /*
  * relative error tolerance
  * absolute error tolerance
+ * (per thread, like the budget, so that simulations can run in parallel)
 */
-double RelTol = 0, AbsTol = 1.0e-5;
+THREAD_LOCAL double RelTol = 0, AbsTol = 1.0e-5;
+
+/*
+ * absolute tolerance of each variable, used instead of AbsTol for systems of ABSTOL_N variables
+ * (per thread; see ODEtoleranceVector)
+*/
+static THREAD_LOCAL double * ABSTOL = 0;
+static THREAD_LOCAL int ABSTOL_N = 0, ABSTOL_SIZE = 0;
+
+/*absolute tolerance of variable i of a system of N variables*/
+static double absTol(int N, int i)
+{
+   return (N == ABSTOL_N) ? ABSTOL[i] : AbsTol;
+}
 
 int ODE_POSITIVE_VALUES_ONLY = 0;
 
+/*
+ * integrator used by ODEsim and steadyState (per thread, like the tolerances)
+*/
+static THREAD_LOCAL int METHOD = ODE_CVODE;
+
+/*
+ * multistep method of the CVODE solver in use and the counts of the current integration (per thread)
+*/
+static THREAD_LOCAL int LMM = CV_BDF;
+static THREAD_LOCAL ODEstats STATS;
+
+/* ODE_AUTO: steps in one output interval that make Adams give way to BDF,
+   output intervals between the tests for going back, and the largest h*|J| that Adams takes */
+#define AUTO_MAX_ADAMS_STEPS 100
+#define AUTO_CHECK_INTERVALS 20
+#define AUTO_NONSTIFF 0.5
+
+/*
+ * budget charged by all integrations (0 = unlimited)
+*/
+static THREAD_LOCAL ODEbudget * BUDGET = 0;
+
+/* number of ode function calls between two reads of the clock */
+#define BUDGET_CLOCK_INTERVAL 64
+
+/*
+ * monotonic wall-clock time
+*/
+double ODEclock(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ((double)ts.tv_sec + 1.0e-9 * (double)ts.tv_nsec);
+}
+
+/*
+ * reset a budget
+*/
+void ODEbudgetInit(ODEbudget * b, long maxRHSEvals, long maxSteps, double seconds)
+{
+   if (b == NULL) return;
+   (*b).maxRHSEvals = maxRHSEvals;
+   (*b).maxSteps = maxSteps;
+   (*b).deadline = 0.0;
+   if (seconds > 0) (*b).deadline = ODEclock() + seconds;
+   (*b).rhsEvals = (*b).steps = (*b).lastClockCheck = 0;
+   (*b).exhausted = 0;
+}
+
+/*
+ * charge work against a budget. The clock is only read once per CVODE step
+ * or once every BUDGET_CLOCK_INTERVAL ode function calls
+*/
+int ODEbudgetCharge(ODEbudget * b, long rhsEvals, long steps)
+{
+   if (b == NULL) return 0;
+   if ((*b).exhausted) return 1;
+
+   (*b).rhsEvals += rhsEvals;
+   (*b).steps += steps;
+
+   if ((*b).maxRHSEvals > 0 && (*b).rhsEvals > (*b).maxRHSEvals)
+      (*b).exhausted = 1;
+   else
+   if ((*b).maxSteps > 0 && (*b).steps > (*b).maxSteps)
+      (*b).exhausted = 1;
+   else
+   if ((*b).deadline > 0 &&
+       (steps > 0 || ((*b).rhsEvals - (*b).lastClockCheck) >= BUDGET_CLOCK_INTERVAL))
+   {
+      (*b).lastClockCheck = (*b).rhsEvals;
+      if (ODEclock() > (*b).deadline)
+         (*b).exhausted = 1;
+   }
+   return ((*b).exhausted);
+}
+
+/*
+ * @param: budget charged by subsequent integrations
+*/
+void ODEsetBudget(ODEbudget * b)
+{
+   BUDGET = b;
+}
+
+ODEbudget * ODEgetBudget(void)
+{
+   return (BUDGET);
+}
+
+/*
+ * limit the number of internal steps of a new CVODE solver to what is left in the budget
+*/
+static void budgetMaxSteps(void * cvode_mem)
+{
+   if (BUDGET && (*BUDGET).maxSteps > 0)
+   {
+      long left = (*BUDGET).maxSteps - (*BUDGET).steps + 1;
+      if (left < 1) left = 1;
+      if (left < 500) CVodeSetMaxNumSteps(cvode_mem, left);  /*500 is the CVODE default*/
+   }
+}
+
+/*
+ * record the work done by a solver and free it
+*/
+static void freeSolver(void ** cvode_mem)
+{
+   long nst = 0;
+   if (*cvode_mem)
+      CVodeGetNumSteps(*cvode_mem, &nst);
+   if (LMM == CV_ADAMS)
+   {
+      STATS.adamsSteps += nst;
+      METRIC_ADD(METRIC_ADAMS_STEPS, nst);
+   }
+   else
+      STATS.bdfSteps += nst;
+#if GA_METRICS
+   long nsetups = 0;
+   if (*cvode_mem)
+      CVodeGetNumLinSolvSetups(*cvode_mem, &nsetups);
+   METRIC_ADD(METRIC_CVODE_STEPS, nst);
+   METRIC_ADD(METRIC_CVODE_SETUPS, nsetups);
+#endif
+   CVodeFree(cvode_mem);
+}
+
+/*
+ * charge the steps taken by a solver since the last call
+ * @ret: 1 if the budget is exhausted
+*/
+static int budgetSteps(void * cvode_mem, long * lastSteps)
+{
+   long nst = 0;
+   if (BUDGET == NULL) return 0;
+   CVodeGetNumSteps(cvode_mem, &nst);
+   nst -= (*lastSteps);
+   (*lastSteps) += nst;
+   return ODEbudgetCharge(BUDGET, 0, nst);
+}
+
 /*
  * set the flags
  * @param: only positive values
@@ -36,6 +195,310 @@ void ODEtolerance(double relerr,double abserr)
    AbsTol = abserr;
 }
 
+void ODEgetTolerance(double * relerr, double * abserr)
+{
+   if (relerr) (*relerr) = RelTol;
+   if (abserr) (*abserr) = AbsTol;
+}
+
+void ODEtoleranceVector(int N, double * abserr)
+{
+   int i;
+   if (abserr == 0 || N < 1)
+   {
+      free(ABSTOL);
+      ABSTOL = 0;
+      ABSTOL_N = ABSTOL_SIZE = 0;
+      return;
+   }
+   if (N > ABSTOL_SIZE)   /*the buffer only grows until it is freed by going back to one value*/
+   {
+      ABSTOL = METRIC_REALLOC(ABSTOL, N * sizeof(double));
+      ABSTOL_SIZE = N;
+   }
+   for (i=0; i < N; ++i) ABSTOL[i] = abserr[i];
+   ABSTOL_N = N;
+}
+
+void ODEmethod(int method)
+{
+   METHOD = method;
+}
+
+int ODEgetMethod(void)
+{
+   return (METHOD);
+}
+
+void ODEgetStats(ODEstats * stats)
+{
+   if (stats) (*stats) = STATS;
+}
+
+/*
+ * ode function with a batch form, the batch form, and the buffer of the one-point-per-call
+ * adapter (per thread; see ODEbatch)
+*/
+static THREAD_LOCAL void (*BATCH_ODE)(double,double*,double*,void*) = 0;
+static THREAD_LOCAL ODEbatchFunction BATCH = 0;
+static THREAD_LOCAL double * BATCH_BUFFER = 0;
+static THREAD_LOCAL int BATCH_BUFFER_SIZE = 0;
+
+void ODEbatch(void (*odefnc)(double,double*,double*,void*), ODEbatchFunction batch)
+{
+   BATCH_ODE = batch ? odefnc : 0;
+   BATCH = batch;
+}
+
+void ODEevaluateBatch(int N, int K, double * t, double * x, double * dx, void (*odefnc)(double,double*,double*,void*), void ** params)
+{
+   int i, k;
+   if (BATCH && odefnc == BATCH_ODE)
+   {
+      BATCH(K, t, x, dx, params);
+      return;
+   }
+   if (2*N > BATCH_BUFFER_SIZE)   /*the buffer only grows, and is kept by the thread*/
+   {
+      BATCH_BUFFER = METRIC_REALLOC(BATCH_BUFFER, 2 * N * sizeof(double));
+      BATCH_BUFFER_SIZE = 2*N;
+   }
+   double * u = BATCH_BUFFER, * du = BATCH_BUFFER + N;
+   for (k=0; k < K; ++k)
+   {
+      for (i=0; i < N; ++i) u[i] = x[i*K + k];
+      odefnc(t[k], u, du, params[k]);
+      for (i=0; i < N; ++i) dx[i*K + k] = du[i];
+   }
+}
+
+/*
+ * conservation laws that reduce the systems of their size, and the totals that fix the
+ * dependent variables (per thread; see ODEconservation)
+*/
+static THREAD_LOCAL Conservation * CONSERVATION = 0;
+static THREAD_LOCAL double * TOTALS = 0;
+static THREAD_LOCAL int NUM_TOTALS = 0, TOTALS_SIZE = 0;
+
+void ODEconservation(Conservation * laws, double * x0)
+{
+   CONSERVATION = laws;
+   NUM_TOTALS = 0;
+   if (laws == 0 || x0 == 0) return;
+   if ((*laws).numLaws > TOTALS_SIZE)   /*the buffer only grows, and is kept by the thread*/
+   {
+      TOTALS = METRIC_REALLOC(TOTALS, (*laws).numLaws * sizeof(double));
+      TOTALS_SIZE = (*laws).numLaws;
+   }
+   conservationTotals(laws, x0, TOTALS);
+   NUM_TOTALS = (*laws).numLaws;
+}
+
+/*1 if calls with N variables are reduced by the laws of the thread*/
+static int reducible(int N, double * x, void (*odefnc)(double,double*,double*,void*))
+{
+   return (CONSERVATION != 0 && (*CONSERVATION).numVars == N && x != 0 && odefnc != 0);
+}
+
+/*the system that is integrated in place of a reducible one*/
+typedef struct
+{
+   Conservation * laws;
+   double * totals;    //conserved totals (numLaws values)
+   double * x, * dx;   //full state and its rates
+   double * xr;        //independent variables of the initial point
+   double * abstol;    //absolute tolerance of each independent variable, or 0 (see ODEtoleranceVector)
+   void (*odefnc)(double,double*,double*,void*);
+   void * params;
+} ReducedSystem;
+
+/*
+ * set up the reduced system of the thread's laws; the totals are those given to
+ * ODEconservation, or else those of the initial point
+ * @param: receives the system
+ * @param: initial point (full state)
+ * @param: ode function and its parameters
+*/
+static void reducedOpen(ReducedSystem * s, double * x0, void (*odefnc)(double,double*,double*,void*), void * params)
+{
+   Conservation * c = CONSERVATION;
+   int i, N = (*c).numVars, k = (*c).numLaws;
+   (*s).laws = c;
+   (*s).totals = METRIC_MALLOC((k + 4*N) * sizeof(double));
+   (*s).x = (*s).totals + k;
+   (*s).dx = (*s).x + N;
+   (*s).xr = (*s).dx + N;
+   (*s).abstol = 0;
+   if (ABSTOL_N == N)   //the tolerances of the full system, mapped through the reduction
+   {
+      (*s).abstol = (*s).xr + N;
+      for (i=0; i < N - k; ++i) (*s).abstol[i] = ABSTOL[ (*c).independent[i] ];
+   }
+   (*s).odefnc = odefnc;
+   (*s).params = params;
+   if (NUM_TOTALS == k)
+      for (i=0; i < k; ++i) (*s).totals[i] = TOTALS[i];
+   else
+      conservationTotals(c, x0, (*s).totals);
+   conservationReduce(c, x0, (*s).xr);
+}
+
+/*
+ * swap the tolerances of the reduced system with those of the thread, so that it is integrated
+ * with the tolerances of its own variables; a second call swaps them back
+*/
+static void reducedTolerances(ReducedSystem * s)
+{
+   Conservation * c = (*s).laws;
+   double * a = ABSTOL;
+   if ((*s).abstol == 0) return;   //one tolerance for all variables
+   ABSTOL = (*s).abstol;
+   (*s).abstol = a;
+   ABSTOL_N = (ABSTOL_N == (*c).numVars) ? (*c).numVars - (*c).numLaws : (*c).numVars;
+}
+
+/*ode function of the reduced system: the rates of the independent variables*/
+static void reducedODE(double t, double * xr, double * dxr, void * data)
+{
+   ReducedSystem * s = (ReducedSystem*)data;
+   Conservation * c = (*s).laws;
+   int i;
+   conservationExpand(c, xr, (*s).totals, (*s).x);
+   (*s).odefnc(t, (*s).x, (*s).dx, (*s).params);
+   for (i=0; i < (*c).numVars - (*c).numLaws; ++i)
+      dxr[i] = (*s).dx[ (*c).independent[i] ];
+}
+
+/*
+ * full state of a point of the reduced system
+ * @ret: 0 if a variable is negative and only positive values are allowed, 1 otherwise
+*/
+static int reducedExpand(ReducedSystem * s, double * xr, double * x)
+{
+   int i;
+   conservationExpand((*s).laws, xr, (*s).totals, x);
+   if (ODE_POSITIVE_VALUES_ONLY)
+      for (i=0; i < (*(*s).laws).numVars; ++i)
+         if (x[i] < 0) return (0);
+   return (1);
+}
+
+static double* reducedSim(int N, double* initialValues, void (*odefnc)(double,double*,double*,void*), double startTime, double endTime, double stepSize, void * params)
+{
+   Conservation * c = CONSERVATION;
+   int i, n = N - (*c).numLaws, M = (endTime - startTime) / stepSize;
+   ReducedSystem s;
+   reducedOpen(&s, initialValues, odefnc, params);
+
+   CONSERVATION = 0;   /*the reduced system has no laws of its own*/
+   reducedTolerances(&s);
+   double * yr = ODEsim(n, s.xr, &reducedODE, startTime, endTime, stepSize, (void*)&s);
+   reducedTolerances(&s);
+   CONSERVATION = c;
+
+   double * y = 0;
+   if (yr)
+   {
+      y = METRIC_MALLOC((N+1) * (M+1) * sizeof(double));
+      for (i=0; i <= M; ++i)
+      {
+         getValue(y,N+1,i,0) = getValue(yr,n+1,i,0);
+         conservationExpand(c, &getValue(yr,n+1,i,1), s.totals, &getValue(y,N+1,i,1));
+      }
+      free(yr);
+   }
+   free(s.totals);
+   return (y);
+}
+
+static double* reducedSteadyState(int N, double * initialValues, void (*odefnc)(double,double*,double*,void*), void * params, double maxerr, double maxtime, double delta)
+{
+   Conservation * c = CONSERVATION;
+   ReducedSystem s;
+   reducedOpen(&s, initialValues, odefnc, params);
+
+   CONSERVATION = 0;
+   reducedTolerances(&s);
+   double * ssr = steadyState(N - (*c).numLaws, s.xr, &reducedODE, (void*)&s, maxerr, maxtime, delta);
+   reducedTolerances(&s);
+   CONSERVATION = c;
+
+   double * ss = 0;
+   if (ssr)
+   {
+      ss = METRIC_MALLOC(N * sizeof(double));
+      if (!reducedExpand(&s, ssr, ss))
+      {
+         free(ss);
+         ss = 0;
+      }
+      free(ssr);
+   }
+   free(s.totals);
+   return (ss);
+}
+
+static int reducedEnsemble(int W, int N, double * initialValues, void (*odefnc)(double,double*,double*,void*), void ** params,
+                           ODEbudget ** budgets, double minerr, double maxtime, double delta, double * ss, int * ok)
+{
+   Conservation * c = CONSERVATION;
+   int k, count, n = N - (*c).numLaws;
+   ReducedSystem * s = METRIC_MALLOC(W * sizeof(ReducedSystem));
+   void ** rp = METRIC_MALLOC(W * sizeof(void*));
+   double * ssr = METRIC_MALLOC(W * n * sizeof(double));
+   for (k=0; k < W; ++k)
+   {
+      reducedOpen(&s[k], initialValues, odefnc, params[k]);
+      rp[k] = (void*)&s[k];
+   }
+
+   CONSERVATION = 0;
+   reducedTolerances(&s[0]);   //the same for every system
+   count = ensembleSteadyState(W, n, s[0].xr, &reducedODE, rp, budgets, minerr, maxtime, delta, ssr, ok);
+   reducedTolerances(&s[0]);
+   CONSERVATION = c;
+
+   for (k=0; k < W; ++k)
+   {
+      if (ok[k] && !reducedExpand(&s[k], ssr + k*n, ss + k*N))
+      {
+         ok[k] = 0;
+         --count;
+      }
+      free(s[k].totals);
+   }
+   free(ssr);
+   free(rp);
+   free(s);
+   return (count);
+}
+
+static int reducedNewton(int N, double * x, void (*odefnc)(double,double*,double*,void*), void * params,
+                         double ** roots, int numRoots, double tol, int maxIter, double * fmin)
+{
+   Conservation * c = CONSERVATION;
+   int i, found, n = N - (*c).numLaws;
+   ReducedSystem s;
+   reducedOpen(&s, x, odefnc, params);
+   double ** rr = METRIC_MALLOC((numRoots + 1) * sizeof(double*));
+   double * rx = METRIC_MALLOC((numRoots * n + 1) * sizeof(double));
+   for (i=0; i < numRoots; ++i)
+   {
+      rr[i] = rx + i*n;
+      conservationReduce(c, roots[i], rr[i]);
+   }
+
+   CONSERVATION = 0;
+   found = deflatedNewton(n, s.xr, &reducedODE, (void*)&s, rr, numRoots, tol, maxIter, fmin);
+   CONSERVATION = c;
+
+   conservationExpand(c, s.xr, s.totals, x);
+   free(rx);
+   free(rr);
+   free(s.totals);
+   return (found);
+}
+
 /**/
 typedef struct
 {
@@ -54,6 +517,10 @@ static int f(realtype t, N_Vector u, N_Vector udot, void * userFunc)
 
   UserFunction * info = (UserFunction*) userFunc;
 
+  METRIC_INC(METRIC_RHS_EVALS);
+  if (BUDGET && ODEbudgetCharge(BUDGET, 1, 0))
+      return (-1);  /*unrecoverable: makes CVode return CV_RHSFUNC_FAIL*/
+
   if ((*info).ODEfunc != NULL)
       ((*info).ODEfunc)(t,udata,dudata,(*info).userData);
 
@@ -99,6 +566,680 @@ static int check_flag(void *flagvalue, char *funcname, int opt)
   return(0);
 }
 
+/*
+ * Jacobian pattern of the systems of its size (per thread; see ODEsparsity) and the buffers
+ * of the sparse path, made for that pattern and kept by the thread
+*/
+static THREAD_LOCAL SparseMatrix * SPARSITY = 0;
+
+typedef struct
+{
+  SparseMatrix * J;         //finite-difference Jacobian
+  SparseMatrix * M;         //I - gamma J
+  SparseLU * lu;            //factors of M (CVODE) or J (Newton)
+  int numColors;            //groups of columns without a common row (see sparseColor)
+  int * colorptr;           //numColors+1 offsets of the groups in colorcols
+  int * colorcols;          //columns of each group
+  int * color, * next;      //N each: color of each column, next free place of each group (work space)
+  double * f0, * f1, * step;  //vectors of N values
+  double * X, * DX;         //a batch of points and their derivatives (see ODEevaluateBatch)
+  UserFunction * funcData;  //ode function of the CVODE solver in use
+} SparseSolver;
+
+static THREAD_LOCAL SparseSolver SPARSE;
+
+/* relative step of forward and central differences, and of the pattern probe */
+#define SPARSE_DX 1.0e-7
+#define CENTRAL_DX 1.0e-5
+#define SPARSE_PROBE_DX 1.0e-3
+
+/*
+ * differences used by jacobian() and deflatedNewton (per thread; see ODEdifferences)
+*/
+static THREAD_LOCAL int DIFFERENCES = ODE_CENTRAL;
+
+void ODEdifferences(int differences)
+{
+  DIFFERENCES = differences;
+}
+
+void ODEsparsity(SparseMatrix * pattern)
+{
+  SPARSITY = pattern;
+}
+
+SparseMatrix * ODEsparsityProbe(int N, double * x, void (*odefnc)(double,double*,double*,void*), void * params, SparseMatrix * pattern)
+{
+  int i, j, k, p, nnz = 0;
+  if (odefnc == 0 || x == 0 || N < 1) return (0);
+  if (pattern && (*pattern).n != N) pattern = 0;
+  int * rowptr = METRIC_MALLOC((N+1) * sizeof(int)),
+      * colind = METRIC_MALLOC((N*N + 1) * sizeof(int)),
+      * found = METRIC_CALLOC(N*N, sizeof(int));
+  double * y = METRIC_MALLOC(N * sizeof(double)),
+         * f0 = METRIC_MALLOC(N * sizeof(double)),
+         * f1 = METRIC_MALLOC(N * sizeof(double));
+
+  if (pattern)
+     for (p=0; p < (*pattern).nnz; ++p)
+        found[ (*pattern).rowind[p] * N + (*pattern).colind[p] ] = 1;
+
+  METRIC_ADD(METRIC_RHS_EVALS, 2*N+1);
+  for (i=0; i < N; ++i) y[i] = x[i];
+  odefnc(1.0,y,f0,params);
+  for (j=0; j < N; ++j)
+     for (k=-1; k <= 1; k += 2)   //both directions, in case the function is flat on one side
+     {
+        y[j] = x[j] + k * SPARSE_PROBE_DX * (fabs(x[j]) + 1.0);
+        odefnc(1.0,y,f1,params);
+        y[j] = x[j];
+        for (i=0; i < N; ++i)
+           if (f1[i] != f0[i]) found[i*N + j] = 1;
+     }
+
+  for (i=0; i < N; ++i)
+  {
+     rowptr[i] = nnz;
+     for (j=0; j < N; ++j)
+        if (found[i*N + j]) colind[nnz++] = j;
+  }
+  rowptr[N] = nnz;
+  SparseMatrix * A = sparseNew(N, rowptr, colind);
+
+  free(rowptr);
+  free(colind);
+  free(found);
+  free(y);
+  free(f0);
+  free(f1);
+  return (A);
+}
+
+/*1 if two matrices have the same pattern*/
+static int samePattern(SparseMatrix * A, SparseMatrix * B)
+{
+  int i;
+  if ((*A).n != (*B).n || (*A).nnz != (*B).nnz) return (0);
+  for (i=0; i <= (*A).n; ++i)
+     if ((*A).rowptr[i] != (*B).rowptr[i]) return (0);
+  for (i=0; i < (*A).nnz; ++i)
+     if ((*A).colind[i] != (*B).colind[i]) return (0);
+  return (1);
+}
+
+/*
+ * the buffers of the sparse path for a system of N variables, (re)made when the pattern has changed
+ * @ret: the buffers, or 0 if no pattern of this size is set
+*/
+static SparseSolver * sparseSolver(int N)
+{
+  SparseSolver * s = &SPARSE;
+  if (SPARSITY == 0 || (*SPARSITY).n != N) return (0);
+  if ((*s).J && samePattern((*s).J, SPARSITY)) return (s);
+
+  int c, j;
+  sparseFree((*s).J);
+  sparseFree((*s).M);
+  sparseLUFree((*s).lu);
+  if ((*s).colorptr) free((*s).colorptr);
+  if ((*s).colorcols) free((*s).colorcols);
+  if ((*s).color) free((*s).color);
+  if ((*s).f0) free((*s).f0);
+  (*s).J = sparseClone(SPARSITY);
+  (*s).M = sparseClone(SPARSITY);
+  (*s).lu = sparseLUNew(N);
+  (*s).f0 = METRIC_MALLOC((3 + 2*ODE_BATCH_SIZE) * N * sizeof(double));
+  (*s).f1 = (*s).f0 + N;
+  (*s).step = (*s).f1 + N;
+  (*s).X = (*s).step + N;
+  (*s).DX = (*s).X + N * ODE_BATCH_SIZE;
+  (*s).color = METRIC_MALLOC(2 * N * sizeof(int));
+  (*s).next = (*s).color + N;
+
+  /*group the columns by color*/
+  int * color = (*s).color, * next = (*s).next;
+  (*s).numColors = sparseColor((*s).J, color);
+  (*s).colorptr = METRIC_CALLOC((*s).numColors + 1, sizeof(int));
+  (*s).colorcols = METRIC_MALLOC(N * sizeof(int));
+  for (j=0; j < N; ++j) ++(*s).colorptr[ color[j] + 1 ];
+  for (c=0; c < (*s).numColors; ++c)
+  {
+     (*s).colorptr[c+1] += (*s).colorptr[c];
+     next[c] = (*s).colorptr[c];
+  }
+  for (j=0; j < N; ++j) (*s).colorcols[ next[ color[j] ]++ ] = j;
+  return (s);
+}
+
+/*
+ * Finite-difference Jacobian in the pattern of the sparse buffers, charged to the budget. The
+ * columns of a color are perturbed together, so it costs one ode function call per color
+ * (two with central differences) instead of one or two per variable. The perturbed points
+ * are evaluated in batches (see ODEevaluateBatch)
+ * @param: buffers (see sparseSolver)
+ * @param: point (not changed)
+ * @param: ode function at the point (forward differences only)
+ * @param: ODE_CENTRAL or ODE_FORWARD
+ * @param: ode function and its parameters
+ * @ret: 0 if the budget is exhausted, 1 otherwise
+*/
+static int sparseJacobian(SparseSolver * s, double * point, double * fx, int differences, void (*odefnc)(double,double*,double*,void*), void * params)
+{
+  SparseMatrix * J = (*s).J;
+  double * X = (*s).X, * DX = (*s).DX, * step = (*s).step;
+  double T[ODE_BATCH_SIZE];
+  void * P[ODE_BATCH_SIZE];
+  int c, c0, nc, i, j, k, p, q, K, N = (*J).n, central = (differences == ODE_CENTRAL);
+  int per = central ? 2 : 1;   //points per color
+  double dx = central ? CENTRAL_DX : SPARSE_DX;
+  long calls = per * (*s).numColors;
+  if (ODEbudgetCharge(BUDGET, calls, 0)) return (0);
+  METRIC_INC(METRIC_JACOBIANS);
+  METRIC_ADD(METRIC_RHS_EVALS, calls);
+
+  for (k=0; k < ODE_BATCH_SIZE; ++k)
+  {
+     T[k] = 1.0;
+     P[k] = params;
+  }
+  for (c0=0; c0 < (*s).numColors; c0 += nc)
+  {
+     nc = (*s).numColors - c0;
+     if (nc > ODE_BATCH_SIZE/per) nc = ODE_BATCH_SIZE/per;
+     K = per * nc;
+     for (i=0; i < N; ++i)
+        for (k=0; k < K; ++k) X[i*K + k] = point[i];
+
+     //point per*c (and per*c+1) moves the columns of color c0+c up (and down)
+     for (c=0; c < nc; ++c)
+        for (q = (*s).colorptr[c0+c]; q < (*s).colorptr[c0+c+1]; ++q)
+        {
+           j = (*s).colorcols[q];
+           double h = dx * (fabs(point[j]) + 1.0);
+           X[j*K + per*c] = point[j] + h;
+           if (central)
+           {
+              X[j*K + 2*c + 1] = point[j] - h;
+              step[j] = X[j*K + 2*c] - X[j*K + 2*c + 1];   //the whole span actually taken
+           }
+           else
+              step[j] = X[j*K + c] - point[j];             //the step actually taken
+        }
+     ODEevaluateBatch(N, K, T, X, DX, odefnc, P);
+
+     //no two columns of a color share a row, so each derivative that changed belongs to one column
+     for (c=0; c < nc; ++c)
+        for (q = (*s).colorptr[c0+c]; q < (*s).colorptr[c0+c+1]; ++q)
+        {
+           j = (*s).colorcols[q];
+           for (k = (*J).colptr[j]; k < (*J).colptr[j+1]; ++k)
+           {
+              p = (*J).colpos[k];
+              i = (*J).rowind[p];
+              (*J).values[p] = (DX[i*K + per*c] - (central ? DX[i*K + per*c + 1] : fx[i])) / step[j];
+           }
+        }
+  }
+  return (1);
+}
+
+/*
+ * CVODE preconditioner setup: factor I - gamma J, computing J again unless CVODE says the old one will do
+ * @ret: 0 on success, 1 (recoverable: CVODE retries with a smaller step) if the factorization fails,
+ *       -1 if the budget is exhausted
+*/
+static int sparseSetup(realtype t, N_Vector y, N_Vector fy, booleantype jok, booleantype * jcurPtr,
+                       realtype gamma, void * pdata, N_Vector tmp1, N_Vector tmp2, N_Vector tmp3)
+{
+  SparseSolver * s = (SparseSolver*) pdata;
+  SparseMatrix * J = (*s).J, * M = (*s).M;
+  int p;
+
+  (*jcurPtr) = FALSE;
+  if (!jok)
+  {
+     if (!sparseJacobian(s, NV_DATA_S(y), NV_DATA_S(fy), ODE_FORWARD, (*(*s).funcData).ODEfunc, (*(*s).funcData).userData))
+        return (-1);
+     (*jcurPtr) = TRUE;
+  }
+
+  for (p=0; p < (*M).nnz; ++p)
+  {
+     (*M).values[p] = -gamma * (*J).values[p];
+     if ((*M).rowind[p] == (*M).colind[p]) (*M).values[p] += 1.0;
+  }
+  return (sparseLUFactor((*s).lu, M) ? 0 : 1);
+}
+
+/*CVODE preconditioner solve: z = (I - gamma J)^-1 r*/
+static int sparseSolve(realtype t, N_Vector y, N_Vector fy, N_Vector r, N_Vector z,
+                       realtype gamma, realtype delta, int lr, void * pdata, N_Vector tmp)
+{
+  SparseSolver * s = (SparseSolver*) pdata;
+  int i, N = NV_LENGTH_S(r);
+  for (i=0; i < N; ++i) NV_Ith_S(z,i) = NV_Ith_S(r,i);
+  sparseLUSolve((*s).lu, NV_DATA_S(z));
+  return (0);
+}
+
+/*
+ * Newton step with the sparse Jacobian: solve J dx = -F
+ * @param: number of variables
+ * @param: point
+ * @param: ode function at the point
+ * @param: receives the step
+ * @ret: 1 on success, 0 if the factorization fails, -1 if the budget is exhausted
+*/
+static int sparseNewtonStep(int N, double * x, double * F, double * dx, void (*odefnc)(double,double*,double*,void*), void * params)
+{
+  int i;
+  SparseSolver * s = sparseSolver(N);
+  if (!sparseJacobian(s, x, F, DIFFERENCES, odefnc, params)) return (-1);
+  if (!sparseLUFactor((*s).lu, (*s).J)) return (0);
+  for (i=0; i < N; ++i) dx[i] = -F[i];
+  sparseLUSolve((*s).lu, dx);
+  return (1);
+}
+
+/*
+ * create a CVODE solver that starts at (t0,u): Adams-Moulton with functional iteration,
+ * or BDF with Newton iteration and a full (banded) Jacobian, or GMRES with the sparse
+ * preconditioner when a pattern is set for systems of this size. The absolute tolerance is
+ * a vector (CV_SV) when one is set for systems of this size
+ * @param: CV_ADAMS or CV_BDF
+ * @param: initial values
+ * @param: initial time
+ * @param: ode function and its parameters
+ * @ret: the solver, or 0 on failure
+*/
+static void * newSolver(int lmm, N_Vector u, double t0, UserFunction * funcData)
+{
+  int flag, i, N = NV_LENGTH_S(u);
+  double reltol = RelTol, abstol = AbsTol;
+  void * cvode_mem = CVodeCreate(lmm, (lmm == CV_ADAMS) ? CV_FUNCTIONAL : CV_NEWTON);
+  if (check_flag((void *)cvode_mem, "CVodeCreate", 0)) return(0);
+  LMM = lmm;
+
+  if (N == ABSTOL_N)
+  {
+     N_Vector av = N_VNew_Serial(N);
+     if (check_flag((void*)av, "N_VNew_Serial", 0))
+     {
+        freeSolver(&cvode_mem);
+        return(0);
+     }
+     METRIC_INC(METRIC_ALLOCATIONS);
+     for (i=0; i < N; ++i) NV_Ith_S(av,i) = ABSTOL[i];
+     flag = CVodeMalloc(cvode_mem, f, t0, u, CV_SV, reltol, av);  /*CVODE keeps its own copy*/
+     N_VDestroy_Serial(av);
+  }
+  else
+     flag = CVodeMalloc(cvode_mem, f, t0, u, CV_SS, reltol, &abstol);
+  if (!check_flag(&flag, "CVodeMalloc", 1))
+     flag = CVodeSetFdata(cvode_mem, funcData);
+  if (!check_flag(&flag, "CVodeSetFdata", 1) && lmm == CV_BDF)
+  {
+     SparseSolver * s = sparseSolver(N);
+     if (s)
+     {
+        (*s).funcData = funcData;
+        flag = CVSpgmr(cvode_mem, PREC_LEFT, 0);
+        if (!check_flag(&flag, "CVSpgmr", 1))
+           flag = CVSpilsSetPreconditioner(cvode_mem, sparseSetup, sparseSolve, (void*)s);
+     }
+     else
+        flag = CVBand(cvode_mem, N, 0, N-1);
+  }
+  if (check_flag(&flag, "CVBand", 1))
+  {
+     freeSolver(&cvode_mem);
+     return(0);
+  }
+  budgetMaxSteps(cvode_mem);
+  return(cvode_mem);
+}
+
+/*what ODE_AUTO knows about the solver in use*/
+typedef struct
+{
+  int intervals;   //output intervals since the last test for going back to Adams
+  long steps;      //steps at the end of the previous output interval
+  long convFails;  //convergence failures at the end of the previous output interval
+} AutoSwitch;
+
+/*
+ * ODE_AUTO: after each output interval, move from Adams to BDF when the functional iteration
+ * failed to converge or the steps became too small, and from BDF back to Adams when the last
+ * step is inside the region where Adams is stable. The new solver restarts at (t,u)
+ * @param: solver; replaced when the method changes
+ * @param: state of the switching
+ * @param: current values
+ * @param: current time
+ * @param: ode function
+ * @param: steps already charged to the budget; reset with the solver
+ * @ret: 1 if a new solver could not be created, 0 otherwise
+*/
+static int switchMethod(void ** cvode_mem, AutoSwitch * state, N_Vector u, double t, UserFunction * funcData, long * nsteps)
+{
+  long nst = 0, ncf = 0;
+  int i, j, N = NV_LENGTH_S(u), lmm = LMM;
+  if (METHOD != ODE_AUTO) return 0;
+
+  CVodeGetNumSteps(*cvode_mem, &nst);
+  CVodeGetNumNonlinSolvConvFails(*cvode_mem, &ncf);
+
+  if (LMM == CV_ADAMS)
+  {
+     if (ncf > (*state).convFails || nst - (*state).steps > AUTO_MAX_ADAMS_STEPS)
+        lmm = CV_BDF;
+  }
+  else
+  if (++(*state).intervals >= AUTO_CHECK_INTERVALS)
+  {
+     realtype h = 0;
+     double norm = 0, row;
+     double * J = jacobian(N, NV_DATA_S(u), (*funcData).ODEfunc, (*funcData).userData);
+     (*state).intervals = 0;
+     CVodeGetLastStep(*cvode_mem, &h);
+     if (J)
+     {
+        for (i=0; i < N; ++i)
+        {
+           row = 0;
+           for (j=0; j < N; ++j) row += fabs(getValue(J,N,i,j));
+           if (row > norm) norm = row;
+        }
+        free(J);
+        if (h * norm < AUTO_NONSTIFF)
+           lmm = CV_ADAMS;
+     }
+  }
+  (*state).steps = nst;
+  (*state).convFails = ncf;
+  if (lmm == LMM) return 0;
+
+  freeSolver(cvode_mem);
+  ++STATS.switches;
+  METRIC_INC(METRIC_METHOD_SWITCHES);
+  (*state).intervals = 0;
+  (*state).steps = (*state).convFails = 0;
+  (*nsteps) = 0;
+  (*cvode_mem) = newSolver(lmm, u, t, funcData);
+  return ((*cvode_mem) == 0);
+}
+
+/* smallest step of the Rosenbrock method, and the number of steps a Jacobian is kept for */
+#define ROSENBROCK_MIN_STEP 1.0e-12
+#define ROSENBROCK_JACOBIAN_AGE 10
+
+/*state of one integration with the built-in Rosenbrock method*/
+typedef struct
+{
+   int N;
+   double t, h;                          //time and the size of the next step
+   double y[ODE_SMALL_MAX];              //values at t
+   double F[ODE_SMALL_MAX];              //derivatives at t
+   double J[ODE_SMALL_MAX*ODE_SMALL_MAX];//Jacobian (J[i*N+j] = dF_i/dy_j)
+   double dFdt[ODE_SMALL_MAX];           //time derivative of the ode function
+   int jacobianAge;                      //steps the Jacobian has been used for (-1 = none)
+   void (*odefnc)(double,double*,double*,void*);
+   void * params;
+} Rosenbrock;
+
+/*
+ * one call of the ode function, charged to the budget
+ * @ret: 0, or 1 if the budget is exhausted
+*/
+static int rosenbrockRHS(Rosenbrock * r, double t, double * y, double * dy)
+{
+   if (ODEbudgetCharge(BUDGET, 1, 0)) return (1);
+   METRIC_INC(METRIC_RHS_EVALS);
+   (*r).odefnc(t, y, dy, (*r).params);
+   return (0);
+}
+
+/*
+ * forward-difference Jacobian and time derivative at the current point
+ * @ret: 0, or 1 if the budget is exhausted
+*/
+static int rosenbrockJacobian(Rosenbrock * r)
+{
+   int i, j, N = (*r).N;
+   double y[ODE_SMALL_MAX], dy[ODE_SMALL_MAX];
+   METRIC_INC(METRIC_JACOBIANS);
+   for (j=0; j < N; ++j) y[j] = (*r).y[j];
+   for (j=0; j < N; ++j)
+   {
+      double dx = 1.0e-8 * fmax(fabs(y[j]), 1.0);
+      y[j] += dx;
+      if (rosenbrockRHS(r, (*r).t, y, dy)) return (1);
+      y[j] = (*r).y[j];
+      for (i=0; i < N; ++i) (*r).J[i*N+j] = (dy[i] - (*r).F[i]) / dx;
+   }
+   double dt = 1.0e-8 * fmax(fabs((*r).t), 1.0);
+   if (rosenbrockRHS(r, (*r).t + dt, y, dy)) return (1);
+   for (i=0; i < N; ++i) (*r).dFdt[i] = (dy[i] - (*r).F[i]) / dt;
+   (*r).jacobianAge = 0;
+   return (0);
+}
+
+/*
+ * LU decomposition with partial pivoting, in place
+ * @ret: 0, or 1 if the matrix is singular
+*/
+static int smallLU(int N, double * A, int * pivot)
+{
+   int i, j, k;
+   for (k=0; k < N; ++k)
+   {
+      int p = k;
+      for (i=k+1; i < N; ++i)
+         if (fabs(A[i*N+k]) > fabs(A[p*N+k])) p = i;
+      pivot[k] = p;
+      if (A[p*N+k] == 0.0) return (1);
+      if (p != k)
+         for (j=0; j < N; ++j)
+         {
+            double temp = A[k*N+j];
+            A[k*N+j] = A[p*N+j];
+            A[p*N+j] = temp;
+         }
+      for (i=k+1; i < N; ++i)
+      {
+         double l = (A[i*N+k] /= A[k*N+k]);
+         for (j=k+1; j < N; ++j) A[i*N+j] -= l * A[k*N+j];
+      }
+   }
+   return (0);
+}
+
+/*solve with the result of smallLU; b receives the solution*/
+static void smallSolve(int N, double * LU, int * pivot, double * b)
+{
+   int i, j;
+   for (i=0; i < N; ++i)
+   {
+      double temp = b[pivot[i]];
+      b[pivot[i]] = b[i];
+      b[i] = temp;
+      for (j=0; j < i; ++j) b[i] -= LU[i*N+j] * b[j];
+   }
+   for (i=N-1; i >= 0; --i)
+   {
+      for (j=i+1; j < N; ++j) b[i] -= LU[i*N+j] * b[j];
+      b[i] /= LU[i*N+i];
+   }
+}
+
+/*
+ * start an integration with the Rosenbrock method at time 0
+ * @ret: 0, or 1 if the budget is exhausted
+*/
+static int rosenbrockInit(Rosenbrock * r, int N, double * initialValues, void (*odefnc)(double,double*,double*,void*), void * params)
+{
+   int i;
+   (*r).N = N;
+   (*r).t = 0.0;
+   (*r).h = 1.0e-3;
+   (*r).jacobianAge = -1;
+   (*r).odefnc = odefnc;
+   (*r).params = params;
+   for (i=0; i < N; ++i) (*r).y[i] = (initialValues != NULL) ? initialValues[i] : 0.0;
+   METRIC_INC(METRIC_CVODE_RUNS);
+   return rosenbrockRHS(r, 0.0, (*r).y, (*r).F);
+}
+
+/*
+ * one accepted step of the Rosenbrock method (Shampine and Reichelt, The MATLAB ODE Suite, 1997),
+ * no longer than hmax. The W matrix I - h d J uses the stored Jacobian, which is renewed
+ * after a rejected step or every ROSENBROCK_JACOBIAN_AGE steps
+ * @ret: 0, or 1 if the step size underflows or the budget is exhausted
+*/
+static int rosenbrockStep(Rosenbrock * r, double hmax)
+{
+   const double d = 1.0 / (2.0 + M_SQRT2), e32 = 6.0 + M_SQRT2;
+   int i, j, N = (*r).N;
+   int pivot[ODE_SMALL_MAX];
+   double W[ODE_SMALL_MAX*ODE_SMALL_MAX], k1[ODE_SMALL_MAX], k2[ODE_SMALL_MAX], k3[ODE_SMALL_MAX],
+          F1[ODE_SMALL_MAX], F2[ODE_SMALL_MAX], y1[ODE_SMALL_MAX], T[ODE_SMALL_MAX];
+
+   while (1)
+   {
+      double h = ((*r).h < hmax) ? (*r).h : hmax;
+      if (h < ROSENBROCK_MIN_STEP) return (1);
+      if ((*r).jacobianAge < 0 || (*r).jacobianAge >= ROSENBROCK_JACOBIAN_AGE)
+         if (rosenbrockJacobian(r)) return (1);
+
+      for (i=0; i < N; ++i)
+      {
+         for (j=0; j < N; ++j) W[i*N+j] = -h * d * (*r).J[i*N+j];
+         W[i*N+i] += 1.0;
+         T[i] = h * d * (*r).dFdt[i];
+      }
+      if (smallLU(N, W, pivot))
+      {
+         (*r).h = 0.5 * h;
+         continue;
+      }
+
+      for (i=0; i < N; ++i) k1[i] = (*r).F[i] + T[i];
+      smallSolve(N, W, pivot, k1);
+      for (i=0; i < N; ++i) y1[i] = (*r).y[i] + 0.5 * h * k1[i];
+      if (rosenbrockRHS(r, (*r).t + 0.5 * h, y1, F1)) return (1);
+
+      for (i=0; i < N; ++i) k2[i] = F1[i] - k1[i];
+      smallSolve(N, W, pivot, k2);
+      for (i=0; i < N; ++i)
+      {
+         k2[i] += k1[i];
+         y1[i] = (*r).y[i] + h * k2[i];
+      }
+      if (rosenbrockRHS(r, (*r).t + h, y1, F2)) return (1);
+
+      for (i=0; i < N; ++i) k3[i] = F2[i] - e32 * (k2[i] - F1[i]) - 2.0 * (k1[i] - (*r).F[i]) + T[i];
+      smallSolve(N, W, pivot, k3);
+
+      //weighted RMS norm of the error estimate, as in CVODE
+      double err = 0;
+      for (i=0; i < N; ++i)
+      {
+         double e = (h / 6.0) * (k1[i] - 2.0 * k2[i] + k3[i]);
+         double w = absTol(N,i) + RelTol * fmax(fabs((*r).y[i]), fabs(y1[i]));
+         err += (e / w) * (e / w);
+      }
+      err = sqrt(err / N);
+
+      double factor = (err > 0) ? 0.8 * pow(err, -1.0/3.0) : 5.0;
+      if (!(factor >= 0.2)) factor = 0.2;   //also when the error is not finite
+      if (factor > 5.0) factor = 5.0;
+
+      if (err <= 1.0)
+      {
+         (*r).t += h;
+         for (i=0; i < N; ++i)
+         {
+            (*r).y[i] = y1[i];
+            (*r).F[i] = F2[i];
+         }
+         ++(*r).jacobianAge;
+         if (h < (*r).h)   //shortened to hmax: keep the longer step for later
+            (*r).h = fmax((*r).h, factor * h);
+         else
+            (*r).h = factor * h;
+         METRIC_INC(METRIC_ROSENBROCK_STEPS);
+         return ODEbudgetCharge(BUDGET, 0, 1);
+      }
+      (*r).h = factor * h;
+      (*r).jacobianAge = -1;
+   }
+}
+
+/*ODEsim with the Rosenbrock method (the steps are shortened to land on each output time)*/
+static double* rosenbrockSim(int N, double * initialValues, void (*odefnc)(double,double*,double*,void*), double startTime, double endTime, double stepSize, void * params)
+{
+   int i, j, M = (endTime - startTime) / stepSize;
+   Rosenbrock r;
+   if (rosenbrockInit(&r, N, initialValues, odefnc, params)) return (0);
+
+   double * data = METRIC_MALLOC((N+1) * (M+1) * sizeof(double) );
+
+   for (i=0; i <= M; ++i)
+   {
+      double tout = i * stepSize;
+      while (r.t < tout - 1.0e-12 * stepSize)
+         if (rosenbrockStep(&r, tout - r.t))
+         {
+            free(data);
+            return (0);
+         }
+      getValue(data,N+1,i,0) = r.t;
+      for (j=0; j < N; ++j)
+      {
+         if (ODE_POSITIVE_VALUES_ONLY && r.y[j] < 0)
+         {
+            free(data);
+            return (0);
+         }
+         getValue(data,N+1,i,j+1) = r.y[j];
+      }
+   }
+   return (data);
+}
+
+/*steadyState with the Rosenbrock method (the test is made after the first step that ends delta or more after the last one)*/
+static double* rosenbrockSteadyState(int N, double * initialValues, void (*odefnc)(double,double*,double*,void*), void * params, double maxerr, double maxtime, double delta)
+{
+   int j;
+   double u0[ODE_SMALL_MAX], t0 = 0.0;
+   Rosenbrock r;
+   if (rosenbrockInit(&r, N, initialValues, odefnc, params)) return (0);
+   for (j=0; j < N; ++j) u0[j] = r.y[j];
+
+   while (r.t < maxtime)
+   {
+      if (rosenbrockStep(&r, maxtime)) return (0);
+      if ((r.t - t0) >= delta)  //measure difference between y[t] - y[t-delta]
+      {
+         double err = 0, temp;
+         t0 = r.t;
+         for (j=0; j < N; ++j)
+         {
+            temp = (r.y[j] - u0[j]) * (r.y[j] - u0[j]);
+            if (temp > err) err = temp;
+            u0[j] = r.y[j];
+            if (ODE_POSITIVE_VALUES_ONLY && r.y[j] < 0) return (0);
+         }
+         if (err <= maxerr)
+         {
+            double * ss = METRIC_MALLOC(N * sizeof(double));
+            for (j=0; j < N; ++j) ss[j] = r.y[j];
+            return (ss);
+         }
+      }
+   }
+   return (0);   //steady state not reached in the given amount of time
+}
+
 /*
  * The Simulate function using Cvode (double precision)
  * @param: number of variables
@@ -117,16 +1258,18 @@ double* ODEsim(int N, double* initialValues, void (*odefnc)(double,double*,doubl
 
   if ( (2*stepSize) > (endTime-startTime) ) stepSize = (endTime - startTime)/2.0;
 
-  double reltol = 0.0, abstol = 1.0e-5;
+  if (reducible(N,initialValues,odefnc))
+     return reducedSim(N,initialValues,odefnc,startTime,endTime,stepSize,params);
+
+  if (METHOD == ODE_ROSENBROCK && N > 0 && N <= ODE_SMALL_MAX && odefnc != NULL)
+     return rosenbrockSim(N,initialValues,odefnc,startTime,endTime,stepSize,params);
+
   double t = 0.0, tout = 0.0;
   void * cvode_mem = 0;
   N_Vector u;
   int flag, i, j;
-
-  /*setup tolerance*/
-
-  reltol = RelTol; 
-  abstol = AbsTol;
+  long nsteps = 0;  /*steps already charged to the budget*/
+  AutoSwitch autoSwitch = { 0, 0, 0 };
 
   /*setup ode func*/
 
@@ -136,6 +1279,7 @@ double* ODEsim(int N, double* initialValues, void (*odefnc)(double,double*,doubl
 
   u = N_VNew_Serial(N);  /* Allocate u vector */
   if(check_flag((void*)u, "N_VNew_Serial", 0)) return(0);
+  METRIC_INC(METRIC_ALLOCATIONS);
 
   /* Initialize u vector */
 
@@ -148,40 +1292,20 @@ double* ODEsim(int N, double* initialValues, void (*odefnc)(double,double*,doubl
   /* allocate output matrix */
 
   int M = (endTime - startTime) / stepSize;
-  double* data = malloc ((N+1) * (M+1)  * sizeof(double) );
+  double* data = METRIC_MALLOC((N+1) * (M+1)  * sizeof(double) );
 
   /* setup CVODE */
 
-  cvode_mem = CVodeCreate(CV_BDF, CV_NEWTON);
-  if (check_flag((void *)cvode_mem, "CVodeCreate", 0)) return(0);
+  METRIC_INC(METRIC_CVODE_RUNS);
 
-  flag = CVodeMalloc(cvode_mem, f, 0, u, CV_SS, reltol, &abstol);
-  if (check_flag(&flag, "CVodeMalloc", 1))
-  {
-     CVodeFree(&cvode_mem);
-     N_VDestroy_Serial(u);
-     if (data) free(data);
-     return(0);
-  }
-
-  UserFunction * funcData = malloc( sizeof(UserFunction) );
+  UserFunction * funcData = METRIC_MALLOC( sizeof(UserFunction) );
   (*funcData).ODEfunc = odefnc;
   (*funcData).userData = params;
 
-  flag = CVodeSetFdata(cvode_mem, funcData);
-  if(check_flag(&flag, "CVodeSetFdata", 1))
-  {
-     CVodeFree(&cvode_mem);
-     N_VDestroy_Serial(u);
-     free(funcData);
-     if (data) free(data);
-     return(0);
-  }
-
-  flag = CVBand(cvode_mem, N, 0, N-1);
-  if (check_flag(&flag, "CVBand", 1))
+  STATS.adamsSteps = STATS.bdfSteps = STATS.switches = 0;
+  cvode_mem = newSolver((METHOD == ODE_AUTO) ? CV_ADAMS : CV_BDF, u, 0, funcData);
+  if (cvode_mem == 0)
   {
-     CVodeFree(&cvode_mem);
      N_VDestroy_Serial(u);
      free(funcData);
      if (data) free(data);
@@ -207,7 +1331,7 @@ double* ODEsim(int N, double* initialValues, void (*odefnc)(double,double*,doubl
        {
            if (ODE_POSITIVE_VALUES_ONLY && (NV_DATA_S(u))[j] < 0) //special for bio networks
            {
-              CVodeFree(&cvode_mem);
+              freeSolver(&cvode_mem);
               N_VDestroy_Serial(u);
               free(funcData);
               if (data) free(data);
@@ -222,9 +1346,10 @@ double* ODEsim(int N, double* initialValues, void (*odefnc)(double,double*,doubl
 
     tout = t + stepSize;
     flag = CVode(cvode_mem, tout, u, &t, CV_NORMAL);
-    if (check_flag(&flag, "CVode", 1))
+    if (check_flag(&flag, "CVode", 1) || budgetSteps(cvode_mem, &nsteps) ||
+        switchMethod(&cvode_mem, &autoSwitch, u, t, funcData, &nsteps))
     {
-       CVodeFree(&cvode_mem);
+       freeSolver(&cvode_mem);
        N_VDestroy_Serial(u);
        free(funcData);
        if (data) free(data);
@@ -233,7 +1358,7 @@ double* ODEsim(int N, double* initialValues, void (*odefnc)(double,double*,doubl
     }
   }
 
-  CVodeFree(&cvode_mem);
+  freeSolver(&cvode_mem);
   N_VDestroy_Serial(u);
   free(funcData);
   return(data);   /*return outptus*/
@@ -250,27 +1375,75 @@ double* ODEsim(int N, double* initialValues, void (*odefnc)(double,double*,doubl
 double* jacobian(int N, double * point,  void (*odefnc)(double,double*,double*,void*), void * params)
 {
    if (odefnc == 0 || point == 0) return (0);
-   double * J = (double*) malloc( N*N*sizeof(double));
-
-   double dx = 1.0e-5;
-   double * dy0 = (double*) malloc( N*sizeof(double) ),
-          * dy1 = (double*) malloc( N*sizeof(double) );
-   int i,j,k;
+   int i,j,p;
+   SparseSolver * s = sparseSolver(N);
+   if (s)   //one or two ode function calls per color of the pattern
+   {
+      if (DIFFERENCES == ODE_FORWARD)
+      {
+         if (ODEbudgetCharge(BUDGET, 1, 0)) return (0);
+         METRIC_INC(METRIC_RHS_EVALS);
+         odefnc(1.0,point,(*s).f0,params);
+      }
+      if (!sparseJacobian(s, point, (*s).f0, DIFFERENCES, odefnc, params)) return (0);
+      double * J = (double*) METRIC_CALLOC( N*N, sizeof(double));
+      for (p=0; p < (*(*s).J).nnz; ++p)
+         getValue(J,N,(*(*s).J).rowind[p],(*(*s).J).colind[p]) = (*(*s).J).values[p];
+      return (J);
+   }
 
-   for (i=0; i < N; ++i)
+   long calls = (DIFFERENCES == ODE_FORWARD) ? N+1 : 2*N;
+   if (ODEbudgetCharge(BUDGET, calls, 0)) return (0);
+   METRIC_INC(METRIC_JACOBIANS);
+   METRIC_ADD(METRIC_RHS_EVALS, calls);
+   double * J = (double*) METRIC_MALLOC( N*N*sizeof(double));
+
+   //the perturbed points are evaluated ODE_BATCH_SIZE at a time (see ODEevaluateBatch)
+   int c, c0, nc, K, central = (DIFFERENCES != ODE_FORWARD), per = central ? 2 : 1;
+   double dx = 1.0e-5, T[ODE_BATCH_SIZE];
+   void * P[ODE_BATCH_SIZE];
+   double * X = (double*) METRIC_MALLOC( (2*ODE_BATCH_SIZE + 1) * N * sizeof(double) ),
+          * DX = X + ODE_BATCH_SIZE * N,
+          * f0 = DX + ODE_BATCH_SIZE * N;
+
+   for (i=0; i < ODE_BATCH_SIZE; ++i)
    {
-     point[i] -= dx;             //x = x0-h
-     odefnc(1.0,point,dy0,params);  //dy0 = f(x-h)
-     point[i] += 2*dx;           //x = x0+h
-     odefnc(1.0,point,dy1,params);  //dy1 = f(x+h)
-     point[i] -= dx;             //x = x0
-     for (j=0; j < N; ++j)
-     {
-        getValue(J,N,j,i) = (dy1[j] - dy0[j])/(dx+dx);  // J[j,i] = f(x+h) - f(x-h) / 2h
-     }
+      T[i] = 1.0;
+      P[i] = params;
+   }
+   if (!central) odefnc(1.0,point,f0,params);  //f0 = f(x)
+   for (c0=0; c0 < N; c0 += nc)
+   {
+      nc = N - c0;
+      if (nc > ODE_BATCH_SIZE/per) nc = ODE_BATCH_SIZE/per;
+      K = per * nc;
+      for (j=0; j < N; ++j)
+         for (p=0; p < K; ++p) X[j*K + p] = point[j];
+      for (c=0; c < nc; ++c)
+      {
+         i = c0 + c;
+         if (central)
+         {
+            X[i*K + 2*c] = point[i] - dx;       //x = x0-h
+            X[i*K + 2*c + 1] = point[i] + dx;   //x = x0+h
+         }
+         else
+            X[i*K + c] = point[i] + SPARSE_DX * (fabs(point[i]) + 1.0);
+      }
+      ODEevaluateBatch(N, K, T, X, DX, odefnc, P);
+      for (c=0; c < nc; ++c)
+      {
+         i = c0 + c;
+         for (j=0; j < N; ++j)
+         {
+            if (central)   // J[j,i] = f(x+h) - f(x-h) / 2h
+               getValue(J,N,j,i) = (DX[j*K + 2*c + 1] - DX[j*K + 2*c])/(dx+dx);
+            else
+               getValue(J,N,j,i) = (DX[j*K + c] - f0[j])/(X[i*K + c] - point[i]);
+         }
+      }
    }
-   free (dy0);
-   free (dy1);
+   free (X);
    return (J);
 }
 
@@ -284,20 +1457,23 @@ double* jacobian(int N, double * point,  void (*odefnc)(double,double*,double*,v
  */
 double* steadyState(int N, double * initialValues, void (*odefnc)(double,double*,double*,void*), void * params, double maxerr, double maxtime, double delta)
 {
+  if (reducible(N,initialValues,odefnc))
+     return reducedSteadyState(N,initialValues,odefnc,params,maxerr,maxtime,delta);
+
+  if (METHOD == ODE_ROSENBROCK && N > 0 && N <= ODE_SMALL_MAX && odefnc != NULL)
+     return rosenbrockSteadyState(N,initialValues,odefnc,params,maxerr,maxtime,delta);
+
   double startTime = 0;
   double endTime = maxtime;
 
   double stepSize = 0.1;
 
-  double reltol = 0.0, abstol = 1.0e-5;
   double t = 0.0, tout = 0.0;
   void * cvode_mem = 0;
   N_Vector u;
   int flag, i, j;
-  /*setup tolerance*/
-
-  reltol = RelTol;
-  abstol = AbsTol;
+  long nsteps = 0;  /*steps already charged to the budget*/
+  AutoSwitch autoSwitch = { 0, 0, 0 };
 
   /*setup ode func*/
   ODEfunc = odefnc;
@@ -305,52 +1481,32 @@ double* steadyState(int N, double * initialValues, void (*odefnc)(double,double*
 
   u = N_VNew_Serial(N);  /* Allocate u vector */
   if(check_flag((void*)u, "N_VNew_Serial", 0)) return(0);
+  METRIC_INC(METRIC_ALLOCATIONS);
 
   /* allocate output matrix */
 
-  double* ss = malloc (N * sizeof(double) );
+  double* ss = METRIC_MALLOC(N * sizeof(double) );
 
   /* Initialize u vector */
 
   realtype * udata = NV_DATA_S(u);
-  realtype * u0 = malloc(N*sizeof(realtype));
+  realtype * u0 = METRIC_MALLOC(N*sizeof(realtype));
   if (initialValues != NULL)
      for (i=0; i < N; ++i)
         udata[i] = u0[i] = initialValues[i];
 
   /* setup CVODE */
 
-  cvode_mem = CVodeCreate(CV_BDF, CV_NEWTON);
-  if (check_flag((void *)cvode_mem, "CVodeCreate", 0)) return(0);
-
-  flag = CVodeMalloc(cvode_mem, f, 0, u, CV_SS, reltol, &abstol);
-  if (check_flag(&flag, "CVodeMalloc", 1))
-  {
-     CVodeFree(&cvode_mem);
-     N_VDestroy_Serial(u);
-     if (ss) free(ss);
-     if (u0) free(u0);
-     return(0);
-  }
+  METRIC_INC(METRIC_CVODE_RUNS);
 
-  UserFunction * funcData = malloc( sizeof(UserFunction) );
+  UserFunction * funcData = METRIC_MALLOC( sizeof(UserFunction) );
   (*funcData).ODEfunc = odefnc;
   (*funcData).userData = params;
 
-  flag = CVodeSetFdata(cvode_mem, funcData);
-  if(check_flag(&flag, "CVodeSetFdata", 1))
-  {
-     CVodeFree(&cvode_mem);
-     N_VDestroy_Serial(u);
-     free(funcData);
-     if (ss) free(ss);
-     if (u0) free(u0);
-     return(0);
-  }
-  flag = CVBand(cvode_mem, N, 0, N-1);
-  if (check_flag(&flag, "CVBand", 1))
+  STATS.adamsSteps = STATS.bdfSteps = STATS.switches = 0;
+  cvode_mem = newSolver((METHOD == ODE_AUTO) ? CV_ADAMS : CV_BDF, u, 0, funcData);
+  if (cvode_mem == 0)
   {
-     CVodeFree(&cvode_mem);
      N_VDestroy_Serial(u);
      free(funcData);
      if (ss) free(ss);
@@ -371,9 +1527,10 @@ double* steadyState(int N, double * initialValues, void (*odefnc)(double,double*
   {
     tout = t + stepSize;
     flag = CVode(cvode_mem, tout, u, &t, CV_NORMAL);
-    if (check_flag(&flag, "CVode", 1))
+    if (check_flag(&flag, "CVode", 1) || budgetSteps(cvode_mem, &nsteps) ||
+        switchMethod(&cvode_mem, &autoSwitch, u, t, funcData, &nsteps))
     {
-       CVodeFree(&cvode_mem);
+       freeSolver(&cvode_mem);
        N_VDestroy_Serial(u);
        free(funcData);
        if (ss) free(ss);
@@ -393,7 +1550,7 @@ double* steadyState(int N, double * initialValues, void (*odefnc)(double,double*
          ss[j] = u0[j] = (NV_DATA_S(u))[j];  //next y points
          if (ODE_POSITIVE_VALUES_ONLY && (NV_DATA_S(u))[j] < 0)
          {
-              CVodeFree(&cvode_mem);
+              freeSolver(&cvode_mem);
               N_VDestroy_Serial(u);
               free(funcData);
               if (ss) free(ss);
@@ -441,13 +1598,351 @@ double* steadyState(int N, double * initialValues, void (*odefnc)(double,double*
       u0 = 0;
   }
   if (u0) free(u0);
-  CVodeFree(&cvode_mem);  /* Free the integrator memory */
+  freeSolver(&cvode_mem);  /* Free the integrator memory */
   N_VDestroy_Serial(u);
   free(funcData);
   return(ss);   /*return outptus*/
 }
 
 
+/* first step and smallest step of the ensemble integrator */
+#define ENSEMBLE_FIRST_STEP 0.01
+#define ENSEMBLE_MIN_STEP 1.0e-10
+
+/*
+ * one stage of the ensemble: evaluate the ode function for the active lanes of Y (variable j of lane l
+ * at j*L+l) at time t + c h and store the derivatives in K the same way.
+ * A lane whose budget runs out is made inactive
+*/
+static void ensembleRHS(int N, double c, double * t, double * h, double * Y, double * K, int * active,
+                        void (*odefnc)(double,double*,double*,void*), void ** params, ODEbudget ** budgets,
+                        double * u, double * du)
+{
+   int j, l, m = 0, L = ODE_ENSEMBLE_LANES;
+   int lane[ODE_ENSEMBLE_LANES];
+   double tl[ODE_ENSEMBLE_LANES];
+   void * pl[ODE_ENSEMBLE_LANES];
+   for (l=0; l < L; ++l)
+   {
+      if (!active[l]) continue;
+      if (budgets && ODEbudgetCharge(budgets[l], 1, 0))
+      {
+         active[l] = 0;
+         continue;
+      }
+      lane[m] = l;
+      tl[m] = t[l] + c*h[l];
+      pl[m++] = params[l];
+   }
+   METRIC_ADD(METRIC_RHS_EVALS, m);
+   if (m == L)   //the lanes are already in the layout of a batch
+   {
+      ODEevaluateBatch(N, L, tl, Y, K, odefnc, pl);
+      return;
+   }
+   if (m == 0) return;
+   for (j=0; j < N; ++j)   //gather the active lanes
+      for (l=0; l < m; ++l) u[j*m+l] = Y[j*L + lane[l]];
+   ODEevaluateBatch(N, m, tl, u, du, odefnc, pl);
+   for (j=0; j < N; ++j)
+      for (l=0; l < m; ++l) K[j*L + lane[l]] = du[j*m+l];
+}
+
+/*
+ * ensembleSteadyState for up to ODE_ENSEMBLE_LANES systems, one per lane
+ * @param: number of systems in this block (the rest of the lanes stay idle)
+*/
+static void ensembleBlock(int M, int N, double * initialValues, void (*odefnc)(double,double*,double*,void*), void ** params,
+                          ODEbudget ** budgets, double maxerr, double maxtime, double delta, double * ss, int * ok)
+{
+   int i, j, l, L = ODE_ENSEMBLE_LANES;
+   double t[ODE_ENSEMBLE_LANES], h[ODE_ENSEMBLE_LANES], t0[ODE_ENSEMBLE_LANES], err[ODE_ENSEMBLE_LANES];
+   int active[ODE_ENSEMBLE_LANES], accept[ODE_ENSEMBLE_LANES];
+
+   double * work = METRIC_MALLOC( 9*N*L * sizeof(double) );
+   double * y = work,          //current values
+          * y1 = y + N*L,      //stage values, then the new values
+          * k1 = y1 + N*L,     //derivatives of the four stages
+          * k2 = k1 + N*L,
+          * k3 = k2 + N*L,
+          * k4 = k3 + N*L,
+          * u0 = k4 + N*L,     //values at the last steady state test
+          * u = u0 + N*L,      //the active lanes, for the ode function
+          * du = u + N*L;
+
+   for (l=0; l < L; ++l)
+   {
+      active[l] = (l < M);
+      if (active[l]) ok[l] = 0;
+      t[l] = t0[l] = 0.0;
+      h[l] = ENSEMBLE_FIRST_STEP;
+      for (j=0; j < N; ++j)
+         y[j*L+l] = u0[j*L+l] = (initialValues != NULL) ? initialValues[j] : 0.0;
+   }
+   ensembleRHS(N,0.0,t,h,y,k1,active,odefnc,params,budgets,u,du);
+
+   while (1)
+   {
+      int left = 0;
+      for (l=0; l < L; ++l) left += active[l];
+      if (left == 0) break;
+
+      /*Bogacki-Shampine 3(2); k4 is k1 of the next step*/
+      for (i=0; i < N*L; i += L)
+      {
+         #pragma omp simd
+         for (l=0; l < L; ++l) y1[i+l] = y[i+l] + 0.5*h[l]*k1[i+l];
+      }
+      ensembleRHS(N,0.5,t,h,y1,k2,active,odefnc,params,budgets,u,du);
+      for (i=0; i < N*L; i += L)
+      {
+         #pragma omp simd
+         for (l=0; l < L; ++l) y1[i+l] = y[i+l] + 0.75*h[l]*k2[i+l];
+      }
+      ensembleRHS(N,0.75,t,h,y1,k3,active,odefnc,params,budgets,u,du);
+      for (i=0; i < N*L; i += L)
+      {
+         #pragma omp simd
+         for (l=0; l < L; ++l)
+            y1[i+l] = y[i+l] + h[l]*((2.0/9.0)*k1[i+l] + (1.0/3.0)*k2[i+l] + (4.0/9.0)*k3[i+l]);
+      }
+      ensembleRHS(N,1.0,t,h,y1,k4,active,odefnc,params,budgets,u,du);
+
+      /*weighted RMS norm of the difference between the two solutions, as in CVODE*/
+      for (l=0; l < L; ++l) err[l] = 0.0;
+      for (i=0; i < N*L; i += L)
+      {
+         double atol = absTol(N,i/L);
+         #pragma omp simd
+         for (l=0; l < L; ++l)
+         {
+            double e = h[l]*((-5.0/72.0)*k1[i+l] + (1.0/12.0)*k2[i+l] + (1.0/9.0)*k3[i+l] - 0.125*k4[i+l]);
+            double w = atol + RelTol*fmax(fabs(y[i+l]),fabs(y1[i+l]));
+            err[l] += (e/w)*(e/w);
+         }
+      }
+      for (l=0; l < L; ++l)
+      {
+         err[l] = sqrt(err[l]/N);
+         accept[l] = (active[l] && err[l] <= 1.0);
+      }
+      for (i=0; i < N*L; i += L)
+      {
+         #pragma omp simd
+         for (l=0; l < L; ++l)
+         {
+            y[i+l] = accept[l] ? y1[i+l] : y[i+l];
+            k1[i+l] = accept[l] ? k4[i+l] : k1[i+l];
+         }
+      }
+
+      /*per lane: the steady state test, the end of the time, and the next step*/
+      for (l=0; l < L; ++l)
+      {
+         if (!active[l]) continue;
+         if (accept[l])
+         {
+            t[l] += h[l];
+            METRIC_INC(METRIC_ENSEMBLE_STEPS);
+            if (budgets && ODEbudgetCharge(budgets[l], 0, 1))
+            {
+               active[l] = 0;
+               continue;
+            }
+            if ((t[l] - t0[l]) >= delta)  //measure difference between y[t] - y[t-delta]
+            {
+               double diff = 0, temp;
+               int negative = 0;
+               t0[l] = t[l];
+               for (j=0; j < N; ++j)
+               {
+                  temp = (y[j*L+l] - u0[j*L+l])*(y[j*L+l] - u0[j*L+l]);
+                  if (temp > diff) diff = temp;
+                  u0[j*L+l] = y[j*L+l];
+                  if (ODE_POSITIVE_VALUES_ONLY && y[j*L+l] < 0) negative = 1;
+               }
+               if (negative)
+               {
+                  active[l] = 0;
+                  continue;
+               }
+               if (diff <= maxerr)
+               {
+                  for (j=0; j < N; ++j) ss[l*N+j] = y[j*L+l];
+                  ok[l] = 1;
+                  active[l] = 0;
+                  continue;
+               }
+            }
+            if (t[l] >= maxtime)  //steady state not reached in the given amount of time
+            {
+               active[l] = 0;
+               continue;
+            }
+         }
+         double factor = (err[l] > 0) ? 0.9*pow(err[l],-1.0/3.0) : 5.0;
+         if (!(factor >= 0.2)) factor = 0.2;   //also when the error is not finite
+         if (factor > 5.0) factor = 5.0;
+         h[l] *= factor;
+         if (h[l] < ENSEMBLE_MIN_STEP) active[l] = 0;
+      }
+   }
+   free(work);
+}
+
+int ensembleSteadyState(int W, int N, double * initialValues, void (*odefnc)(double,double*,double*,void*), void ** params,
+                        ODEbudget ** budgets, double minerr, double maxtime, double delta, double * ss, int * ok)
+{
+   int k, count = 0, L = ODE_ENSEMBLE_LANES;
+   if (N < 1 || W < 1 || odefnc == 0) return (0);
+   if (reducible(N,initialValues,odefnc))
+      return reducedEnsemble(W,N,initialValues,odefnc,params,budgets,minerr,maxtime,delta,ss,ok);
+   for (k=0; k < W; k += L)
+   {
+      int M = (W - k < L) ? (W - k) : L;
+      ensembleBlock(M, N, initialValues, odefnc, params + k, budgets ? (budgets + k) : 0,
+                    minerr, maxtime, delta, ss + k*N, ok + k);
+   }
+   for (k=0; k < W; ++k) count += ok[k];
+   return (count);
+}
+
+/*
+ * evaluate the ode function at x, charged to the budget
+ * @ret: sum of squares of the derivatives, or -1 if the budget is exhausted
+*/
+static double residual(int N, double * x, double * dx, void (*odefnc)(double,double*,double*,void*), void * params)
+{
+   int i;
+   double sumsq = 0;
+   if (ODEbudgetCharge(BUDGET, 1, 0)) return (-1.0);
+   METRIC_INC(METRIC_RHS_EVALS);
+   odefnc(1.0,x,dx,params);
+   for (i=0; i < N; ++i) sumsq += dx[i]*dx[i];
+   if (!isfinite(sumsq)) return (HUGE_VAL);
+   return (sumsq);
+}
+
+/*
+ * deflation factor M(x) = prod_i (1/|x - r_i|^2 + 1)
+ * @param: gradient of log M (output)
+ * @ret: M
+*/
+static double deflation(int N, double * x, double ** roots, int numRoots, double * eta)
+{
+   int i,j;
+   double M = 1.0;
+   for (j=0; j < N; ++j) eta[j] = 0;
+   for (i=0; i < numRoots; ++i)
+   {
+      double d2 = 0;
+      for (j=0; j < N; ++j) d2 += (x[j]-roots[i][j])*(x[j]-roots[i][j]);
+      if (d2 < 1.0e-300) d2 = 1.0e-300;
+      double m = 1.0/d2 + 1.0;
+      M *= m;
+      for (j=0; j < N; ++j)
+         eta[j] -= 2.0*(x[j]-roots[i][j])/(d2*d2*m);
+   }
+   return (M);
+}
+
+int deflatedNewton(int N, double * x, void (*odefnc)(double,double*,double*,void*), void * params,
+                   double ** roots, int numRoots, double tol, int maxIter, double * fmin)
+{
+   if (odefnc == 0 || x == 0) return (0);
+   if (reducible(N,x,odefnc))
+      return reducedNewton(N,x,odefnc,params,roots,numRoots,tol,maxIter,fmin);
+   int i,j,k,found = 0;
+   double * F = (double*) METRIC_MALLOC( N*sizeof(double) ),
+          * Fy = (double*) METRIC_MALLOC( N*sizeof(double) ),
+          * eta = (double*) METRIC_MALLOC( N*sizeof(double) ),
+          * etay = (double*) METRIC_MALLOC( N*sizeof(double) ),
+          * dx = (double*) METRIC_MALLOC( N*sizeof(double) ),
+          * y = (double*) METRIC_MALLOC( N*sizeof(double) ),
+          * swap;
+
+   double ssq = residual(N,x,F,odefnc,params);
+   double M = deflation(N,x,roots,numRoots,eta);
+   double g = M*M*ssq;   //sum of squares of the deflated function M(x) f(x)
+   if (fmin) (*fmin) = g;
+
+   for (k=0; k < maxIter && ssq >= 0; ++k)
+   {
+      if (ssq <= tol)
+      {
+         found = 1;
+         for (i=0; i < numRoots; ++i)   //deflation makes this rare, but it is not a new root
+         {
+            double d2 = 0, r2 = 0;
+            for (j=0; j < N; ++j)
+            {
+               d2 += (x[j]-roots[i][j])*(x[j]-roots[i][j]);
+               r2 += roots[i][j]*roots[i][j];
+            }
+            if (d2 <= 1.0e-12 * (1.0 + r2)) found = 0;
+         }
+         break;
+      }
+
+      //Newton step for f, then the step for M f: dx / (1 - eta . dx) (Farrell, Birkisson and Funke 2015)
+      int sparseStep = sparseSolver(N) ? sparseNewtonStep(N,x,F,dx,odefnc,params) : 0;
+      if (sparseStep < 0) break;
+      if (sparseStep == 0)   //dense, also when the sparse factorization (without pivoting) fails
+      {
+         double * J = jacobian(N,x,odefnc,params);
+         if (J == 0) break;
+         for (i=0; i < N; ++i) dx[i] = -F[i];
+         status s = matrixsolve(N,J,dx,dx);
+         free(J);
+         if (s != success) break;
+      }
+
+      double ed = 0;
+      for (i=0; i < N; ++i) ed += eta[i]*dx[i];
+      if (fabs(1.0 - ed) < 1.0e-12) break;
+      for (i=0; i < N; ++i) dx[i] /= (1.0 - ed);
+
+      //halve the step until the deflated residual decreases
+      double step = 1.0, ssqy = 0, My = 0, gy = 0;
+      for (j=0; j < 10; ++j)
+      {
+         for (i=0; i < N; ++i) y[i] = x[i] + step*dx[i];
+         ssqy = residual(N,y,Fy,odefnc,params);
+         if (ssqy < 0) break;
+         My = deflation(N,y,roots,numRoots,etay);
+         gy = My*My*ssqy;
+         if (gy < g) break;
+         step *= 0.5;
+      }
+      if (ssqy < 0) break;   //out of budget
+      if (j == 10)   //no decrease along the step: take the full step to get out of the local minimum of |M f|
+      {
+         for (i=0; i < N; ++i) y[i] = x[i] + dx[i];
+         ssqy = residual(N,y,Fy,odefnc,params);
+         if (ssqy < 0) break;
+         My = deflation(N,y,roots,numRoots,etay);
+         gy = My*My*ssqy;
+      }
+
+      METRIC_INC(METRIC_NEWTON_ITERATIONS);
+      for (i=0; i < N; ++i) x[i] = y[i];
+      swap = F; F = Fy; Fy = swap;
+      swap = eta; eta = etay; etay = swap;
+      ssq = ssqy;
+      M = My;
+      g = gy;
+      if (fmin && g < (*fmin)) (*fmin) = g;
+   }
+
+   free(F);
+   free(Fy);
+   free(eta);
+   free(etay);
+   free(dx);
+   free(y);
+   return (found);
+}
+
 /*
  * Find the rates of change after simulating for the given amount of time
  * @param: number of variables
@@ -461,7 +1956,7 @@ double* getDerivatives(int N, double * initialValues, void (*odefnc)(double,doub
   double * y = ODEsim(N,initialValues,odefnc,startTime,endTime,stepSize,params);
   if (y == 0) return 0;
   int sz = (int)((endTime-startTime)/stepSize);
-  double * dy = malloc(N * sizeof(double));
+  double * dy = METRIC_MALLOC(N * sizeof(double));
 
   int i;
   for (i=0; i < N; ++i)
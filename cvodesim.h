@@ -8,12 +8,66 @@
 #include <cvode/cvode.h>             /* prototypes for CVODE fcts. and consts. */
 #include <nvector/nvector_serial.h>  /* serial N_Vector types, fcts., and macros */
 #include <sundials/sundials_band.h>  /* definitions of type BandMat and macros */
+#include <cvode/cvode_spgmr.h>       /* Krylov linear solver, used with a sparse preconditioner */
 #include <sundials/sundials_types.h> /* definition of type realtype */
 #include <sundials/sundials_math.h>  /* definition of ABS and EXP */
 //#include "mathfunc.h"   /*eigenvalue computation */
+#include "conservation.h"
+#include "sparse.h"
 
 #define SUNDIALS_DOUBLE_PRECISION 1
 
+/*
+ * Cost budget for a single evaluation. A limit of zero means "no limit".
+ * The used counts grow with every integration started while the budget is active (see ODEsetBudget)
+*/
+typedef struct
+{
+   long maxRHSEvals;   //maximum number of ode function calls
+   long maxSteps;      //maximum number of internal CVODE steps
+   double deadline;    //wall-clock deadline in ODEclock() seconds
+   long rhsEvals;      //ode function calls used so far
+   long steps;         //CVODE steps used so far
+   long lastClockCheck; //rhsEvals at the time the clock was last read
+   int exhausted;      //1 once any of the limits has been crossed
+} ODEbudget;
+
+/*
+ * monotonic wall-clock time
+ * @ret: seconds
+*/
+double ODEclock(void);
+
+/*
+ * reset a budget
+ * @param: budget to initialize
+ * @param: maximum number of ode function calls (0 = unlimited)
+ * @param: maximum number of CVODE steps (0 = unlimited)
+ * @param: wall-clock seconds from now (0 = no deadline)
+*/
+void ODEbudgetInit(ODEbudget *, long, long, double);
+
+/*
+ * charge work against a budget and check all of its limits
+ * @param: budget (may be null)
+ * @param: number of ode function calls
+ * @param: number of CVODE steps
+ * @ret: 1 if the budget is exhausted, 0 otherwise
+*/
+int ODEbudgetCharge(ODEbudget *, long, long);
+
+/*
+ * set the budget charged by ODEsim, steadyState, getDerivatives and jacobian.
+ * An integration that exceeds the budget fails (returns 0). The setting only applies to the calling thread
+ * @param: budget, or 0 for unlimited
+*/
+void ODEsetBudget(ODEbudget *);
+
+/*
+ * @ret: the budget of the calling thread (see ODEsetBudget), or 0 for unlimited
+*/
+ODEbudget * ODEgetBudget(void);
+
 /*
  * set the flags
  * @param: only positive values
@@ -21,12 +75,163 @@
 void ODEflags(int);
 
 /*
- * specify number of variables in the ODE system
+ * set the error tolerances of the calling thread
  * @param: relative error allowed
  * @param: absolute error allowed
 */
 void ODEtolerance(double,double);
 
+/*
+ * get the error tolerances of the calling thread (see ODEtolerance)
+ * @param: receives the relative error allowed
+ * @param: receives the absolute error allowed
+*/
+void ODEgetTolerance(double *,double *);
+
+/*
+ * set an absolute tolerance for each variable (CVODE's CV_SV), used instead of the one of
+ * ODEtolerance by every integration of a system with this many variables in the calling thread,
+ * and by its reduced form (see ODEconservation), whose variables keep their own tolerances.
+ * Give small variables a small tolerance and large ones a large tolerance, so that each is
+ * resolved to about the same relative accuracy. The values are copied into a buffer of the
+ * thread, which is freed by going back to the single value: do so before a thread exits
+ * @param: number of variables
+ * @param: absolute error allowed for each variable, or 0 to go back to the single value
+*/
+void ODEtoleranceVector(int,double*);
+
+/*integration methods (see ODEmethod)*/
+#define ODE_CVODE       0   //CVODE, BDF with Newton iterations (the default)
+#define ODE_ROSENBROCK  1   //built-in Rosenbrock-W method, for systems of up to ODE_SMALL_MAX variables
+#define ODE_AUTO        2   //CVODE, switching between Adams and BDF as the stiffness changes
+
+/*largest system the built-in method takes; larger ones always use CVODE*/
+#define ODE_SMALL_MAX 8
+
+/*
+ * set the integrator used by ODEsim and steadyState in the calling thread.
+ * ODE_AUTO starts CVODE with Adams-Moulton and functional iteration, which needs no linear
+ * algebra, and restarts it with BDF and Newton iteration once the functional iteration fails
+ * to converge or an output interval takes more than 100 steps. While on BDF it tests every
+ * 20 output intervals whether the last step times the norm of the Jacobian is small enough
+ * for Adams, and switches back if so (see ODEgetStats for the counts).
+ * ODE_ROSENBROCK is the stiffly accurate 2(3) pair of Shampine and Reichelt (MATLAB's ode23s)
+ * with a finite-difference Jacobian that is kept across steps while they succeed. Its work
+ * arrays are on the stack, so a small system is integrated without any allocation or CVODE setup
+ * @param: ODE_CVODE, ODE_AUTO or ODE_ROSENBROCK
+*/
+void ODEmethod(int);
+
+/*
+ * @ret: the integrator of the calling thread (see ODEmethod)
+*/
+int ODEgetMethod(void);
+
+/*
+ * Integrate systems that have conservation laws in reduced form: ODEsim, steadyState,
+ * ensembleSteadyState and deflatedNewton, when called in this thread for a system of
+ * laws->numVars variables, integrate (or solve for) the independent variables only and
+ * compute the others from the conserved totals. Results are returned as full states.
+ * The ode function must keep the laws
+ * @param: laws (see conservationLaws), or 0 to stop reducing
+ * @param: state whose totals every reduced call keeps, or 0 to use the totals of each call's initial point
+*/
+void ODEconservation(Conservation *, double *);
+
+/*
+ * Batch form of an ode function: evaluates K points in one call. The points are stored variable
+ * by variable (structure of arrays): variable i of point k is x[i*K + k], and its derivative goes
+ * to dx[i*K + k]. Each point has its own time and parameters. A compiled model can then run the
+ * same arithmetic across the points in vector registers, with one indirect call per batch
+ * @param: number of points (at most ODE_BATCH_SIZE when called by this library)
+ * @param: time of each point
+ * @param: values, K per variable
+ * @param: receives the derivatives, K per variable
+ * @param: additional parameters of each point
+*/
+typedef void (*ODEbatchFunction)(int, double *, double *, double *, void **);
+
+/*largest batch passed to a batch function: columns of a Jacobian are evaluated in groups of this many points*/
+#define ODE_BATCH_SIZE 16
+
+/*
+ * Give the batch form of an ode function. Wherever an ode function is evaluated at many points
+ * at once in the calling thread (the columns of jacobian() and of the sparse Jacobians, the
+ * lanes of ensembleSteadyState), that function is then evaluated through its batch form
+ * @param: ode function
+ * @param: its batch form, or 0 to evaluate one point per call (the default)
+*/
+void ODEbatch(void (*odefnc)(double,double*,double*,void*), ODEbatchFunction);
+
+/*
+ * Evaluate an ode function at K points in the layout of ODEbatchFunction: through its batch form
+ * when one is set (see ODEbatch), otherwise one call per point (so that any single-point model
+ * can be used where a batch is expected). Not charged to the budget
+ * @param: number of variables
+ * @param: number of points
+ * @param: time of each point
+ * @param: values, K per variable
+ * @param: receives the derivatives, K per variable
+ * @param: ode function pointer
+ * @param: additional parameters of each point
+*/
+void ODEevaluateBatch(int N, int K, double * t, double * x, double * dx, void (*odefnc)(double,double*,double*,void*), void ** params);
+
+/*
+ * Use a sparse Jacobian for the systems of pattern->n variables in the calling thread.
+ * CVODE (BDF) then solves its linear systems with GMRES, preconditioned by a sparse LU
+ * factorization of I - gamma J; the preconditioner is the exact inverse, so GMRES takes one
+ * iteration. deflatedNewton solves its Newton steps with the same factorization, and jacobian()
+ * returns the dense form of the sparse one. The Jacobian is a finite difference stored in the
+ * pattern only; columns that share no row are perturbed together, so it costs one ode function
+ * call per color of the columns (a few for a network where each species takes part in a few
+ * reactions) instead of one or two per variable. The factorization costs time and memory in proportion to the nonzeros and their fill-in rather
+ * than N^3 and N^2. Reduced systems (see ODEconservation) have fewer variables and stay dense.
+ * The pattern is not copied and must stay valid while it is set
+ * @param: pattern of the Jacobian (see sparseNew and ODEsparsityProbe), or 0 for dense (the default)
+*/
+void ODEsparsity(SparseMatrix *);
+
+/*
+ * Find the pattern of the Jacobian at a point: entry (i,j) is in it if a change of variable j
+ * changes derivative i. Entries that happen to vanish at the point (a rate that is zero there)
+ * are missed, so add the patterns of a few points. Costs 2N+1 ode function calls
+ * @param: number of variables
+ * @param: point
+ * @param: ode function pointer
+ * @param: additional parameters needed for ode function
+ * @param: pattern whose entries are added (may be null; it is not changed)
+ * @ret: new pattern
+*/
+SparseMatrix * ODEsparsityProbe(int N, double * x, void (*odefnc)(double,double*,double*,void*), void * params, SparseMatrix *);
+
+/*finite differences of the Jacobians (see ODEdifferences)*/
+#define ODE_CENTRAL 0   //(f(x+h) - f(x-h)) / 2h: two ode function calls per column (the default)
+#define ODE_FORWARD 1   //(f(x+h) - f(x)) / h: one call per column, plus f(x)
+
+/*
+ * choose the differences of jacobian() and of the Newton steps of deflatedNewton in the calling
+ * thread. Forward differences halve the cost and are accurate to about 1e-7 instead of 1e-10.
+ * With a sparsity pattern (see ODEsparsity) the cost is per color of the columns instead of per
+ * column; the CVODE preconditioner always uses forward differences
+ * @param: ODE_CENTRAL or ODE_FORWARD
+*/
+void ODEdifferences(int);
+
+/*work done by the last CVODE integration of the calling thread*/
+typedef struct
+{
+   long adamsSteps;   //steps with Adams-Moulton
+   long bdfSteps;     //steps with BDF
+   long switches;     //changes of method (ODE_AUTO)
+} ODEstats;
+
+/*
+ * get the counts of the last ODEsim or steadyState that used CVODE in the calling thread
+ * @param: receives the counts
+*/
+void ODEgetStats(ODEstats *);
+
 /*
  * The Simulate function using Cvode (double precision)
  * @param: number of variables
@@ -43,6 +248,7 @@ double* ODEsim(int N, double * initValues, void (*odefnc)(double,double*,double*
 
 /*
  * Gets jacobian matrix of the system at the given point
+ * (finite differences, see ODEdifferences and ODEsparsity)
  * @param: number of variables
  * @param: array of values (point where Jacobian will be calculated)
  * @param: ode function pointer
@@ -63,6 +269,64 @@ double* jacobian(int N, double * point,  void (*odefnc)(double,double*,double*,v
  */
 double* steadyState(int N, double * initialValues, void (*odefnc)(double,double*,double*,void*), void * params, double minerr, double maxtime, double delta);
 
+/*
+ * number of systems the ensemble integrator advances together (its lanes): one per double in a
+ * vector register of the target (AVX-512: 8, AVX/AVX2: 4, otherwise 2)
+ */
+#if defined(__AVX512F__)
+#define ODE_ENSEMBLE_LANES 8
+#elif defined(__AVX__)
+#define ODE_ENSEMBLE_LANES 4
+#else
+#define ODE_ENSEMBLE_LANES 2
+#endif
+
+/*
+ * Bring many copies of a system, each with its own parameters, to steady state with the same
+ * test as steadyState. The systems are integrated in lockstep, ODE_ENSEMBLE_LANES at a time, by an
+ * explicit Runge-Kutta 3(2) method (Bogacki-Shampine) with one adaptive step per system. This is
+ * lane batching: the stage updates and the error norm are loops across the lanes marked
+ * "omp simd", which the compiler turns into vector instructions only when built with
+ * -fopenmp-simd (or -fopenmp) and -O3 -march=native (gcc -fopt-info-vec lists them); otherwise
+ * they are plain loops. The ode function is called once per system and stage, through
+ * ODEevaluateBatch, so it only runs across the lanes when a batch form is set (see ODEbatch).
+ * Uses the tolerances of the calling thread. Stiff systems need
+ * many small steps here, so give each one a budget and use steadyState for those that fail
+ * @param: number of systems
+ * @param: number of variables
+ * @param: array of initial values (shared by all systems)
+ * @param: ode function pointer
+ * @param: additional parameters of each system (one pointer per system)
+ * @param: budget of each system (may be null; an entry may be null)
+ * @param: minimum allowed value
+ * @param: maximum time for simulation
+ * @param: the difference in time to use for estimating steady state
+ * @param: receives the steady states, system k at k*N
+ * @param: receives 1 for each system that reached steady state, 0 otherwise
+ * @ret: number of systems that reached steady state
+ */
+int ensembleSteadyState(int W, int N, double * initialValues, void (*odefnc)(double,double*,double*,void*), void ** params,
+                        ODEbudget ** budgets, double minerr, double maxtime, double delta, double * ss, int * ok);
+
+/*
+ * Find a steady state (zero of the ode function) with a damped Newton method that avoids the known ones.
+ * The iteration works on the deflated function M(x) f(x), M(x) = prod_i (1/|x - r_i|^2 + 1), which
+ * does not vanish at the known roots r_i, so each call from the same initial point converges to a
+ * different root once the previous result is added to the list. Charged to the budget (see ODEsetBudget)
+ * @param: number of variables
+ * @param: initial point; receives the last iterate (the root when one is found)
+ * @param: ode function pointer
+ * @param: additional parameters needed for ode function
+ * @param: known roots (may be null)
+ * @param: number of known roots
+ * @param: largest sum of squares of the ode function accepted as a root
+ * @param: maximum number of Newton iterations
+ * @param: receives the smallest sum of squares of the deflated function seen (may be null)
+ * @ret: 1 if a new root was found, 0 otherwise
+ */
+int deflatedNewton(int N, double * x, void (*odefnc)(double,double*,double*,void*), void * params,
+                   double ** roots, int numRoots, double tol, int maxIter, double * fmin);
+
 /*
  * Find the rates of change after simulating for the given amount of time
  * @param: number of variables
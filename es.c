@@ -0,0 +1,271 @@
+#include "es.h"
+#include "opt.h"
+
+/*standard normal random number (Box-Muller)*/
+static double ESgauss(void)
+{
+   double u1 = mtrand(), u2 = mtrand();
+   if (u1 < 1.0e-300) u1 = 1.0e-300;
+   return (sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2));
+}
+
+/*random index in 0 .. n-1*/
+static int ESindex(int n)
+{
+   return (((int)(mtrand() * n)) % n);
+}
+
+/*sort the indices 0 .. n-1 by fitness, best first*/
+static void ESorder(double * f, int * order, int n)
+{
+   int i, j, k;
+   for (i=0; i < n; ++i) order[i] = i;
+   for (i=1; i < n; ++i)
+   {
+      k = order[i];
+      for (j=i; j > 0 && f[ order[j-1] ] < f[k]; --j)
+         order[j] = order[j-1];
+      order[j] = k;
+   }
+}
+
+double CMAESrun(int n, double * lower, double * upper, int lambda, int maxEvals,
+                ESBatchFitnessFnc fitness, ESCallbackFnc callback, double * best)
+{
+   int i, j, k, gen = 0, evals = 0, stop = 0;
+   double bestFitness = -HUGE_VAL;
+
+   initMTrand();
+   if (lambda < 4) lambda = 4 + (int)(3.0 * log((double)n));
+
+   double * m = malloc(n * sizeof(double)),
+          * ps = malloc(n * sizeof(double)),
+          * pc = malloc(n * sizeof(double)),
+          * D = malloc(n * sizeof(double)),
+          * z = malloc(n * sizeof(double)),
+          * tmp = malloc(n * sizeof(double)),
+          * C = malloc(n * n * sizeof(double)),
+          * B = malloc(n * n * sizeof(double));
+
+   while (!stop && evals < maxEvals)  //one run per pass, each with twice the population of the last
+   {
+      int mu = lambda / 2, stall = 0;
+      double * X = malloc(lambda * n * sizeof(double)),   //candidates
+             * Y = malloc(lambda * n * sizeof(double)),   //their steps (X - m) / sigma
+             * f = malloc(lambda * sizeof(double)),
+             * w = malloc(mu * sizeof(double));
+      int * order = malloc(lambda * sizeof(int));
+
+      //recombination weights and learning rates (Hansen, The CMA Evolution Strategy: A Tutorial)
+      double sum = 0, sumsq = 0;
+      for (i=0; i < mu; ++i) sum += (w[i] = log(mu + 0.5) - log(i + 1.0));
+      for (i=0; i < mu; ++i)
+      {
+         w[i] /= sum;
+         sumsq += w[i] * w[i];
+      }
+      double mueff = 1.0 / sumsq;
+      double cc = (4.0 + mueff / n) / (n + 4.0 + 2.0 * mueff / n),
+             cs = (mueff + 2.0) / (n + mueff + 5.0),
+             c1 = 2.0 / ((n + 1.3) * (n + 1.3) + mueff),
+             cmu = 2.0 * (mueff - 2.0 + 1.0 / mueff) / ((n + 2.0) * (n + 2.0) + mueff),
+             damps = 1.0 + 2.0 * fmax(0.0, sqrt((mueff - 1.0) / (n + 1.0)) - 1.0) + cs,
+             chiN = sqrt((double)n) * (1.0 - 1.0 / (4.0 * n) + 1.0 / (21.0 * n * n));
+      if (cmu > 1.0 - c1) cmu = 1.0 - c1;
+      int maxStall = 10 + (int)(30.0 * n / lambda);
+
+      //random mean in the box, covariance matching the width of the box
+      double sigma = 0.3, runBest = -HUGE_VAL;
+      for (i=0; i < n; ++i)
+      {
+         m[i] = lower[i] + mtrand() * (upper[i] - lower[i]);
+         ps[i] = pc[i] = 0;
+         D[i] = upper[i] - lower[i];
+         if (D[i] <= 0) D[i] = 1.0;
+         for (j=0; j < n; ++j)
+         {
+            B[i*n+j] = (i == j) ? 1.0 : 0.0;
+            C[i*n+j] = (i == j) ? D[i] * D[i] : 0.0;
+         }
+      }
+
+      int gens = 0;
+      while (!stop && evals < maxEvals)
+      {
+         for (k=0; k < lambda; ++k)   //x = m + sigma B D z
+         {
+            for (i=0; i < n; ++i) z[i] = D[i] * ESgauss();
+            for (i=0; i < n; ++i)
+            {
+               double y = 0;
+               for (j=0; j < n; ++j) y += B[i*n+j] * z[j];
+               Y[k*n+i] = y;
+               X[k*n+i] = m[i] + sigma * y;
+            }
+         }
+
+         fitness(lambda, n, X, f);
+         evals += lambda;
+         ++gens;
+
+         ESorder(f, order, lambda);
+         if (f[ order[0] ] > bestFitness)
+         {
+            bestFitness = f[ order[0] ];
+            for (i=0; i < n; ++i) best[i] = X[ order[0]*n + i ];
+         }
+         if (f[ order[0] ] > runBest)
+         {
+            runBest = f[ order[0] ];
+            stall = 0;
+         }
+         else
+            ++stall;
+
+         //new mean and the step it took, in units of sigma
+         for (i=0; i < n; ++i)
+         {
+            double y = 0;
+            for (k=0; k < mu; ++k) y += w[k] * Y[ order[k]*n + i ];
+            z[i] = y;
+            m[i] += sigma * y;
+         }
+
+         //evolution paths: ps uses C^(-1/2) step = B D^-1 B^T step
+         for (j=0; j < n; ++j)
+         {
+            double y = 0;
+            for (i=0; i < n; ++i) y += B[i*n+j] * z[i];
+            tmp[j] = y / D[j];
+         }
+         double norm = 0;
+         for (i=0; i < n; ++i)
+         {
+            double y = 0;
+            for (j=0; j < n; ++j) y += B[i*n+j] * tmp[j];
+            ps[i] = (1.0 - cs) * ps[i] + sqrt(cs * (2.0 - cs) * mueff) * y;
+            norm += ps[i] * ps[i];
+         }
+         norm = sqrt(norm);
+         int hsig = (norm / sqrt(1.0 - pow(1.0 - cs, 2.0 * gens)) / chiN) < (1.4 + 2.0 / (n + 1.0));
+         for (i=0; i < n; ++i)
+            pc[i] = (1.0 - cc) * pc[i] + hsig * sqrt(cc * (2.0 - cc) * mueff) * z[i];
+
+         //rank-one and rank-mu update of the covariance
+         for (i=0; i < n; ++i)
+            for (j=0; j <= i; ++j)
+            {
+               double rankmu = 0;
+               for (k=0; k < mu; ++k)
+                  rankmu += w[k] * Y[ order[k]*n + i ] * Y[ order[k]*n + j ];
+               C[i*n+j] = (1.0 - c1 - cmu) * C[i*n+j]
+                        + c1 * (pc[i] * pc[j] + (1 - hsig) * cc * (2.0 - cc) * C[i*n+j])
+                        + cmu * rankmu;
+               C[j*n+i] = C[i*n+j];
+            }
+
+         sigma *= exp((cs / damps) * (norm / chiN - 1.0));
+
+         //C = B D^2 B^T
+         int ok = (matrixsymmetriceigen(n, C, D, B) >= 0);
+         double dmin = HUGE_VAL, dmax = 0;
+         for (i=0; i < n; ++i)
+         {
+            if (!(D[i] > 1.0e-20)) D[i] = 1.0e-20;
+            D[i] = sqrt(D[i]);
+            if (D[i] < dmin) dmin = D[i];
+            if (D[i] > dmax) dmax = D[i];
+         }
+
+         if (callback != NULL)
+            stop = callback(gen, n, best, bestFitness);
+         ++gen;
+
+         if (!ok || stall > maxStall || !isfinite(sigma)
+             || sigma * dmax < 1.0e-12 || dmax > 1.0e7 * dmin)
+            break;   //restart
+      }
+
+      free(X);
+      free(Y);
+      free(f);
+      free(w);
+      free(order);
+      lambda *= 2;
+   }
+
+   free(m);
+   free(ps);
+   free(pc);
+   free(D);
+   free(z);
+   free(tmp);
+   free(C);
+   free(B);
+   return (bestFitness);
+}
+
+double DErun(int n, double * lower, double * upper, int NP, double F, double CR, int maxEvals,
+             ESBatchFitnessFnc fitness, ESCallbackFnc callback, double * best)
+{
+   int i, j, r1, r2, r3, gen = 0, stop = 0, evals;
+   double bestFitness = -HUGE_VAL;
+
+   initMTrand();
+   if (NP < 4) NP = 4;
+
+   double * X = malloc(NP * n * sizeof(double)),    //population
+          * U = malloc(NP * n * sizeof(double)),    //trial vectors
+          * fx = malloc(NP * sizeof(double)),
+          * fu = malloc(NP * sizeof(double));
+
+   for (i=0; i < NP; ++i)
+      for (j=0; j < n; ++j)
+         X[i*n+j] = lower[j] + mtrand() * (upper[j] - lower[j]);
+   fitness(NP, n, X, fx);
+   evals = NP;
+
+   while (1)
+   {
+      for (i=0; i < NP; ++i)
+         if (fx[i] > bestFitness)
+         {
+            bestFitness = fx[i];
+            for (j=0; j < n; ++j) best[j] = X[i*n+j];
+         }
+
+      if (callback != NULL)
+         stop = callback(gen, n, best, bestFitness);
+      ++gen;
+      if (stop || evals >= maxEvals) break;
+
+      for (i=0; i < NP; ++i)
+      {
+         do r1 = ESindex(NP); while (r1 == i);
+         do r2 = ESindex(NP); while (r2 == i || r2 == r1);
+         do r3 = ESindex(NP); while (r3 == i || r3 == r1 || r3 == r2);
+         int jrand = ESindex(n);   //at least one value comes from the mutant
+         for (j=0; j < n; ++j)
+            if (j == jrand || mtrand() < CR)
+               U[i*n+j] = X[r1*n+j] + F * (X[r2*n+j] - X[r3*n+j]);
+            else
+               U[i*n+j] = X[i*n+j];
+      }
+
+      fitness(NP, n, U, fu);
+      evals += NP;
+
+      for (i=0; i < NP; ++i)
+         if (fu[i] >= fx[i])
+         {
+            fx[i] = fu[i];
+            for (j=0; j < n; ++j) X[i*n+j] = U[i*n+j];
+         }
+   }
+
+   free(X);
+   free(U);
+   free(fx);
+   free(fu);
+   return (bestFitness);
+}
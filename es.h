@@ -0,0 +1,67 @@
+#include <stdlib.h>
+#include <math.h>
+#include "mtrand.h"
+
+#ifndef GA_EVOLUTION_STRATEGIES
+#define GA_EVOLUTION_STRATEGIES
+
+/*
+ * Optimizers for real vectors: CMA-ES with restarts and differential evolution (DE/rand/1/bin).
+ * Like the GA they maximize a fitness. Each generation is evaluated with a single call to a
+ * batch function, so the user can evaluate the candidates in parallel.
+*/
+
+/*
+ * Compute the fitness of a batch of candidates
+ * @param: number of candidates
+ * @param: number of values in each candidate
+ * @param: candidates, one after the other (row i starts at i * dim)
+ * @param: array that receives the fitness values
+*/
+typedef void(*ESBatchFitnessFnc)(int, int, double *, double *);
+
+/*
+ * Callback function. This function is called after each generation.
+ * @param: generation (counted across restarts)
+ * @param: number of values in a candidate
+ * @param: best candidate so far
+ * @param: fitness of the best candidate
+ * @ret: 0 = continue, 1 = stop
+*/
+typedef int(*ESCallbackFnc)(int, int, double *, double);
+
+/*
+ * CMA-ES (covariance matrix adaptation) with restarts. The run restarts from a random mean
+ * with twice the population size when the search stalls or the step size collapses (IPOP-CMA-ES)
+ * @param: number of values in a candidate
+ * @param: lower end of the box the initial means are drawn from
+ * @param: upper end of that box (the initial step size in each direction is 0.3 of its width)
+ * @param: population size of the first run (0 = 4 + 3 ln(dim))
+ * @param: maximum number of fitness evaluations (rounded up to a whole generation)
+ * @param: batch fitness function
+ * @param: callback function (may be null)
+ * @param: array that receives the best candidate
+ * @ret: fitness of the best candidate
+*/
+double CMAESrun(int dim, double * lower, double * upper, int lambda, int maxEvals,
+                ESBatchFitnessFnc fitness, ESCallbackFnc callback, double * best);
+
+/*
+ * Differential evolution, DE/rand/1/bin: each trial vector is x_r1 + F (x_r2 - x_r3),
+ * mixed with its target by binomial crossover, and replaces the target if it is at least as fit
+ * @param: number of values in a candidate
+ * @param: lower end of the box the initial population is drawn from
+ * @param: upper end of that box
+ * @param: population size (at least 4)
+ * @param: differential weight F (typically 0.5)
+ * @param: crossover probability CR (typically 0.9)
+ * @param: maximum number of fitness evaluations (rounded up to a whole generation)
+ * @param: batch fitness function
+ * @param: callback function (may be null)
+ * @param: array that receives the best candidate
+ * @ret: fitness of the best candidate
+*/
+double DErun(int dim, double * lower, double * upper, int popSz, double F, double CR, int maxEvals,
+             ESBatchFitnessFnc fitness, ESCallbackFnc callback, double * best);
+
+#endif
@@ -0,0 +1,462 @@
+#include "fold.h"
+#include "cvodesim.h"
+#include "opt.h"
+#include "metrics.h"
+
+#define FOLD_INVERSE_ITERATIONS 8        //inverse iterations for the starting null vector
+#define FOLD_EPSILON            1.0e-4   //relative step of the differences along the null vector and in the parameter
+#define FOLD_MAX_HALVINGS       10       //step halvings of the damped Newton iteration
+#define FOLD_MAX_LOG_STEP       1.0      //largest change of the log of a positive free parameter per Newton step
+#define FOLD_SCAN_MAX_STEP      0.5      //largest step of the scan (same units as FOLD_SCAN_STEP)
+#define FOLD_SCAN_MIN_STEP      1.0e-3   //step below which the scan stops next to the fold
+#define FOLD_SCAN_MAX_DX        0.1      //largest change of the state per scan step, relative to its norm
+#define FOLD_CORRECTOR          8        //Newton iterations on f per scan step
+
+/*the augmented system of one fold search; the unknowns are y = (x, s, v), with p = exp(s) or p = s*/
+typedef struct
+{
+   int N;
+   double * param;
+   int logScale;       //1 = s is the log of the parameter
+   void (*odefnc)(double,double*,double*,void*);
+   void * params;
+   double * c;         //N: normalization c.v = 1
+   double * J;         //N x N: Jacobian at the last residual
+   double * f1, * f2;  //N: work space
+} Fold;
+
+static void setParam(Fold * F, double s)
+{
+   *((*F).param) = (*F).logScale ? exp(s) : s;
+}
+
+static double norm(int n, double * a)
+{
+   int i;
+   double s = 0;
+   for (i=0; i < n; ++i) s += a[i] * a[i];
+   return (sqrt(s));
+}
+
+/*
+ * ode function at x with the parameter at s, charged to the budget (see ODEsetBudget)
+ * @ret: 0, or 1 if the budget is exhausted
+*/
+static int foldRHS(Fold * F, double * x, double s, double * dx)
+{
+   METRIC_INC(METRIC_RHS_EVALS);
+   setParam(F, s);
+   (*F).odefnc(1.0, x, dx, (*F).params);
+   return ODEbudgetCharge(ODEgetBudget(), 1, 0);
+}
+
+/*
+ * the augmented system at y; the Jacobian there is kept in (*F).J
+ * @ret: 0, or 1 if the budget is exhausted
+*/
+static int foldResidual(Fold * F, double * y, double * G)
+{
+   int i, j, N = (*F).N;
+   double * v = y + N + 1;
+   if (foldRHS(F, y, y[N], G)) return (1);
+   double * J = jacobian(N, y, (*F).odefnc, (*F).params);
+   if (!J) return (1);
+   free((*F).J);
+   (*F).J = J;
+   for (i=0; i < N; ++i)
+   {
+      G[N+i] = 0;
+      for (j=0; j < N; ++j) G[N+i] += getValue(J,N,i,j) * v[j];
+   }
+   G[2*N] = vectorvector(N, (*F).c, v) - 1.0;
+   return (0);
+}
+
+/*
+ * Newton matrix of the augmented system at y, with the Jacobian of the last residual:
+ *    [ J       f_s      0 ]
+ *    [ (Jv)_x  (Jv)_s   J ]
+ *    [ 0       0        c ]
+ * (Jv)_x is the change of J along v and (Jv)_s the change of f_s along v, both by central differences
+ * @ret: 0, or 1 if the budget is exhausted
+*/
+static int foldMatrix(Fold * F, double * y, double * A)
+{
+   int i, j, N = (*F).N, n = 2*N+1;
+   double * x = y, s = y[N], * v = y + N + 1;
+   double * J = (*F).J, * f1 = (*F).f1, * f2 = (*F).f2;
+   double e = FOLD_EPSILON * fmax(norm(N, x), 1.0), ds = FOLD_EPSILON * fmax(fabs(s), 1.0);
+   double * xp = METRIC_MALLOC(2 * N * sizeof(double)), * xm = xp + N;
+
+   for (i=0; i < n*n; ++i) A[i] = 0;
+   for (j=0; j < N; ++j)
+   {
+      xp[j] = x[j] + e * v[j];
+      xm[j] = x[j] - e * v[j];
+      A[2*N*n + N+1+j] = (*F).c[j];
+   }
+
+   setParam(F, s);
+   double * Jp = jacobian(N, xp, (*F).odefnc, (*F).params);
+   double * Jm = Jp ? jacobian(N, xm, (*F).odefnc, (*F).params) : 0;
+   if (!Jm)
+   {
+      free(Jp);
+      free(xp);
+      return (1);
+   }
+   for (i=0; i < N; ++i)
+      for (j=0; j < N; ++j)
+      {
+         A[i*n + j] = getValue(J,N,i,j);
+         A[(N+i)*n + j] = (getValue(Jp,N,i,j) - getValue(Jm,N,i,j)) / (2.0 * e);
+         A[(N+i)*n + N+1+j] = getValue(J,N,i,j);
+      }
+   free(Jp);
+   free(Jm);
+
+   int exhausted = foldRHS(F, x, s + ds, f1);   //f_s
+   exhausted |= foldRHS(F, x, s - ds, f2);
+   for (i=0; i < N; ++i) A[i*n + N] = (f1[i] - f2[i]) / (2.0 * ds);
+
+   exhausted |= foldRHS(F, xp, s + ds, f1);  //(Jv)_s
+   exhausted |= foldRHS(F, xm, s + ds, f2);
+   for (i=0; i < N; ++i) A[(N+i)*n + N] = f1[i] - f2[i];
+   exhausted |= foldRHS(F, xp, s - ds, f1);
+   exhausted |= foldRHS(F, xm, s - ds, f2);
+   for (i=0; i < N; ++i) A[(N+i)*n + N] = (A[(N+i)*n + N] - f1[i] + f2[i]) / (4.0 * e * ds);
+
+   setParam(F, s);
+   free(xp);
+   return (exhausted);
+}
+
+/*
+ * the eigenvector of J whose eigenvalue is closest to zero, by inverse iteration
+ * @param: receives the unit vector
+*/
+static void nullVector(int N, double * J, double * v)
+{
+   int i, k;
+   double * y = METRIC_MALLOC(N * sizeof(double));
+   for (i=0; i < N; ++i) v[i] = 1.0 / sqrt((double)N);
+   for (k=0; k < FOLD_INVERSE_ITERATIONS; ++k)
+   {
+      if (matrixsolve(N, J, v, y) != success) break;   //J is singular: v is close enough
+      double s = norm(N, y);
+      if (!(s > 0) || !isfinite(s)) break;
+      for (i=0; i < N; ++i) v[i] = y[i] / s;
+   }
+   free(y);
+}
+
+/*
+ * the side of the fold on which the two states exist. With w the left null vector of J, the
+ * states near the fold are x + a v where, to second order, b (p - p0) + (w.f_xx[v,v]/2) a^2 = 0
+ * and b = w.f_p, so they exist for (p - p0) of the sign of -b / w.f_xx[v,v]
+ * @ret: +1, -1, or 0 if either coefficient vanishes
+*/
+static int foldDirection(Fold * F, double * y)
+{
+   int i, j, N = (*F).N, m = N+1, d = 0;
+   double * x = y, s = y[N], * v = y + N + 1, * J = (*F).J;
+   double e = FOLD_EPSILON * fmax(norm(N, x), 1.0), ds = FOLD_EPSILON * fmax(fabs(s), 1.0);
+   double * B = METRIC_MALLOC((m*m + 3*m + 2*N) * sizeof(double)),
+          * r = B + m*m, * w = r + m, * f0 = w + m, * xp = f0 + m, * xm = xp + N;
+
+   //bordered system [J^T v; v^T 0] [w; 0] = [0; 1], regular at a simple fold
+   for (i=0; i < N; ++i)
+   {
+      for (j=0; j < N; ++j) B[i*m + j] = getValue(J,N,j,i);
+      B[i*m + N] = B[N*m + i] = v[i];
+      r[i] = 0;
+      xp[i] = x[i] + e * v[i];
+      xm[i] = x[i] - e * v[i];
+   }
+   B[N*m + N] = 0;
+   r[N] = 1.0;
+
+   if (matrixsolve(m, B, r, w) == success)
+   {
+      double a = 0, b = 0;
+      foldRHS(F, x, s, f0);
+      foldRHS(F, xp, s, (*F).f1);
+      foldRHS(F, xm, s, (*F).f2);
+      for (i=0; i < N; ++i) a += w[i] * ((*F).f1[i] - 2.0 * f0[i] + (*F).f2[i]) / (e * e);
+      foldRHS(F, x, s + ds, (*F).f1);
+      foldRHS(F, x, s - ds, (*F).f2);
+      for (i=0; i < N; ++i) b += w[i] * ((*F).f1[i] - (*F).f2[i]) / (2.0 * ds);   //same sign as w.f_p
+      if (a * b < 0) d = 1;
+      if (a * b > 0) d = -1;
+   }
+   free(B);
+   return (d);
+}
+
+/*
+ * damped Newton iterations on the augmented system from the steady state x at s
+ * @param: receives the solution y = (x, s, v)
+ * @param: receives the number of steps
+ * @ret: 1 if it converged, 0 otherwise
+*/
+static int foldNewton(Fold * F, double * x, double s, int maxIter, double tol, double * y, int * steps)
+{
+   int i, j, k, N = (*F).N, n = 2*N+1, failed = 0, converged = 0;
+   double * yt = METRIC_MALLOC((4*n + n*n) * sizeof(double)),
+          * G = yt + n, * Gt = G + n, * dy = Gt + n, * A = dy + n;
+
+   //start from x and the null vector of the nearest singular Jacobian
+   for (i=0; i < N; ++i) y[i] = x[i];
+   y[N] = s;
+   for (i=0; i < N; ++i) y[N+1+i] = 0;
+   failed = foldResidual(F, y, G);
+   if (!failed)
+   {
+      nullVector(N, (*F).J, (*F).c);
+      for (i=0; i < N; ++i)
+      {
+         y[N+1+i] = (*F).c[i];
+         G[N+i] = 0;
+         for (j=0; j < N; ++j) G[N+i] += getValue((*F).J,N,i,j) * (*F).c[j];
+      }
+      G[2*N] = 0;
+   }
+
+   double r = norm(n, G);
+   for (k=0; !failed && k < maxIter; ++k)
+   {
+      if (r < tol)
+      {
+         converged = 1;
+         break;
+      }
+      if (foldMatrix(F, y, A) || matrixsolve(n, A, G, dy) != success) break;
+
+      //halve the step until the residual decreases
+      double lambda = 1.0;
+      if ((*F).logScale && fabs(dy[N]) > FOLD_MAX_LOG_STEP) lambda = FOLD_MAX_LOG_STEP / fabs(dy[N]);
+      int h, accepted = 0;
+      for (h=0; !accepted && !failed && h <= FOLD_MAX_HALVINGS; ++h, lambda *= 0.5)
+      {
+         for (i=0; i < n; ++i) yt[i] = y[i] - lambda * dy[i];
+         failed = foldResidual(F, yt, Gt);
+         double rt = norm(n, Gt);
+         if (!failed && rt < r && isfinite(rt))
+         {
+            accepted = 1;
+            r = rt;
+            for (i=0; i < n; ++i)
+            {
+               y[i] = yt[i];
+               G[i] = Gt[i];
+            }
+         }
+      }
+      if (!accepted) failed = 1;
+   }
+   if (!failed && r < tol) converged = 1;
+
+   //leave the Jacobian at the solution in (*F).J
+   if (converged && foldResidual(F, y, G)) converged = 0;
+   *steps = k;
+   free(yt);
+   return (converged);
+}
+
+/*one direction of the scan along the branch of steady states*/
+typedef struct
+{
+   int dir;           //+1 or -1
+   double * x, * t;   //N: last state on the branch and its tangent dx/ds
+   double s, h;
+   double det;        //determinant of the Jacobian at x
+   int done;
+} Scan;
+
+/*
+ * the state, the tangent dx/ds = -J^-1 f_s and the determinant at the current point of the scan
+ * @ret: 0, or 1 if the budget is exhausted or J is singular
+*/
+static int scanPoint(Fold * F, Scan * sc, double ds)
+{
+   int i, N = (*F).N;
+   setParam(F, (*sc).s);
+   double * J = jacobian(N, (*sc).x, (*F).odefnc, (*F).params);
+   if (!J) return (1);
+   if (foldRHS(F, (*sc).x, (*sc).s + ds, (*F).f1) || foldRHS(F, (*sc).x, (*sc).s - ds, (*F).f2))
+   {
+      free(J);
+      return (1);
+   }
+   for (i=0; i < N; ++i) (*F).f1[i] = ((*F).f2[i] - (*F).f1[i]) / (2.0 * ds);
+   (*sc).det = matrixdeterminant(N, J);
+   status st = matrixsolve(N, J, (*F).f1, (*sc).t);
+   free(J);
+   return (st != success || (*sc).det == 0);
+}
+
+/*
+ * one step of the scan: correct the predicted state at s + h by Newton iterations, and accept it if
+ * they converge near the prediction and the determinant of the Jacobian keeps its sign; otherwise
+ * halve the step. Past a fold the branch turns back, and before it the tangent grows without bound,
+ * so the steps shrink onto it
+ * @ret: 0 to go on, 1 if the scan stopped next to a fold, -1 if it ended without one
+*/
+static int scanStep(Fold * F, Scan * sc, double s0, double scale, double tol)
+{
+   int i, N = (*F).N;
+   double dx = FOLD_SCAN_MAX_DX * fmax(norm(N, (*sc).x), 1.0), t = norm(N, (*sc).t);
+   if ((*sc).h * t > dx) (*sc).h = dx / t;   //the tangent grows without bound at the fold
+   if ((*sc).h < FOLD_SCAN_MIN_STEP * scale) return (1);
+   double s1 = (*sc).s + (*sc).dir * (*sc).h;
+   if (fabs(s1 - s0) > FOLD_SCAN_RANGE * scale) return (-1);
+
+   double * x1 = METRIC_MALLOC(2 * N * sizeof(double)), * x0 = x1 + N;
+   for (i=0; i < N; ++i) x1[i] = (*sc).x[i] + (*sc).dir * (*sc).h * (*sc).t[i];
+   setParam(F, s1);
+   for (i=0; i < N; ++i) x0[i] = x1[i];
+   int ok = deflatedNewton(N, x1, (*F).odefnc, (*F).params, 0, 0, tol * tol, FOLD_CORRECTOR, 0);
+   for (i=0; i < N; ++i) x0[i] -= x1[i];
+   if (norm(N, x0) > dx) ok = 0;   //jumped to another branch
+
+   if (ok)
+   {
+      double s = (*sc).s, det = (*sc).det;
+      for (i=0; i < N; ++i)
+      {
+         x0[i] = (*sc).x[i];
+         (*sc).x[i] = x1[i];
+      }
+      (*sc).s = s1;
+      if (scanPoint(F, sc, FOLD_EPSILON * scale) || (*sc).det * det < 0)   //back to the last point
+      {
+         for (i=0; i < N; ++i) (*sc).x[i] = x0[i];
+         (*sc).s = s;
+         scanPoint(F, sc, FOLD_EPSILON * scale);
+         ok = 0;
+      }
+   }
+   free(x1);
+   if (ok)
+   {
+      (*sc).h = fmin(2.0 * (*sc).h, FOLD_SCAN_MAX_STEP * scale);
+      return (0);
+   }
+   (*sc).h *= 0.5;
+   return ((*sc).h < FOLD_SCAN_MIN_STEP * scale) ? 1 : 0;
+}
+
+static void foldInit(Fold * F, int N, double * param, void (*odefnc)(double,double*,double*,void*), void * params)
+{
+   (*F).N = N;
+   (*F).param = param;
+   (*F).logScale = (*param > 0);
+   (*F).odefnc = odefnc;
+   (*F).params = params;
+   (*F).J = 0;
+   (*F).c = METRIC_MALLOC(3 * N * sizeof(double));
+   (*F).f1 = (*F).c + N;
+   (*F).f2 = (*F).f1 + N;
+}
+
+/*the fold at the solution y of the augmented system (see foldNewton), or 0 if there is none*/
+static FoldPoint * foldResult(Fold * F, int found, double * y, int steps)
+{
+   int i, N = (*F).N;
+   if (!found)
+   {
+      METRIC_INC(METRIC_FOLD_FAILURES);
+      return (0);
+   }
+   double s = norm(N, y + N + 1);
+   FoldPoint * fold = METRIC_MALLOC(sizeof(FoldPoint));
+   (*fold).numVars = N;
+   (*fold).x = METRIC_MALLOC(N * sizeof(double));
+   (*fold).v = METRIC_MALLOC(N * sizeof(double));
+   for (i=0; i < N; ++i)
+   {
+      (*fold).x[i] = y[i];
+      (*fold).v[i] = y[N+1+i] / s;
+   }
+   (*fold).param = (*F).logScale ? exp(y[N]) : y[N];
+   (*fold).direction = foldDirection(F, y);
+   (*fold).iterations = steps;
+   (*fold).residual = 0;
+   double * G = METRIC_MALLOC((2*N+1) * sizeof(double));
+   if (!foldResidual(F, y, G)) (*fold).residual = norm(2*N+1, G);
+   free(G);
+   METRIC_INC(METRIC_FOLDS);
+   return (fold);
+}
+
+FoldPoint * foldFind(int N, double * x, double * param, void (*odefnc)(double,double*,double*,void*), void * params, int maxIter, double tol)
+{
+   if (N < 1 || x == 0 || param == 0 || odefnc == 0) return (0);
+
+   int i, k, steps = 0, found = 0;
+   double p0 = *param;
+   Fold F;
+   foldInit(&F, N, param, odefnc, params);
+
+   double s0 = F.logScale ? log(p0) : p0, scale = F.logScale ? 1.0 : fmax(fabs(p0), 1.0);
+   double * y = METRIC_MALLOC((2*N+1 + 4*N) * sizeof(double));
+   Scan scan[2];
+
+   //scan both ways along the branch, a step at a time each, and refine the first fold bracketed
+   for (i=0; i < N; ++i) y[2*N+1+i] = x[i];
+   deflatedNewton(N, y + 2*N+1, odefnc, params, 0, 0, tol * tol, FOLD_CORRECTOR, 0);
+   for (k=0; k < 2; ++k)
+   {
+      scan[k].dir = k ? -1 : 1;
+      scan[k].x = y + 2*N+1 + 2*k*N;
+      scan[k].t = scan[k].x + N;
+      scan[k].s = s0;
+      scan[k].h = FOLD_SCAN_STEP * scale;
+      for (i=0; i < N; ++i) scan[k].x[i] = y[2*N+1+i];
+      scan[k].done = scanPoint(&F, &scan[k], FOLD_EPSILON * scale);
+   }
+   while (!found && !(scan[0].done && scan[1].done))
+      for (k=0; k < 2 && !found; ++k)
+      {
+         if (scan[k].done) continue;
+         int r = scanStep(&F, &scan[k], s0, scale, tol);
+         if (r == 0) continue;
+         scan[k].done = 1;
+         if (r > 0)
+            found = foldNewton(&F, scan[k].x, scan[k].s, maxIter, tol, y, &steps);
+      }
+
+   FoldPoint * fold = foldResult(&F, found, y, steps);
+   *param = p0;
+   free(F.J);
+   free(F.c);
+   free(y);
+   return (fold);
+}
+
+FoldPoint * foldPolish(int N, double * x, double * param, void (*odefnc)(double,double*,double*,void*), void * params, int maxIter, double tol)
+{
+   if (N < 1 || x == 0 || param == 0 || odefnc == 0) return (0);
+
+   int steps = 0;
+   double p0 = *param;
+   Fold F;
+   foldInit(&F, N, param, odefnc, params);
+   double * y = METRIC_MALLOC((2*N+1) * sizeof(double));
+
+   int found = foldNewton(&F, x, F.logScale ? log(p0) : p0, maxIter, tol, y, &steps);
+   FoldPoint * fold = foldResult(&F, found, y, steps);
+   *param = p0;
+   free(F.J);
+   free(F.c);
+   free(y);
+   return (fold);
+}
+
+void foldFree(FoldPoint * fold)
+{
+   if (!fold) return;
+   free((*fold).x);
+   free((*fold).v);
+   free(fold);
+}
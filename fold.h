@@ -0,0 +1,75 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#ifndef GA_FOLD_FILE
+#define GA_FOLD_FILE
+
+/*reach of the scan along the branch of steady states (see foldFind), in units of the log of a
+  positive free parameter, or of max(|p|,1) for any other*/
+#define FOLD_SCAN_STEP   0.05   //first step
+#define FOLD_SCAN_RANGE  5.0    //farthest the scan goes each way
+
+/*
+ * A fold (saddle-node bifurcation) of a steady state: f(x,p) = 0 and J(x,p)v = 0 with v != 0.
+ * Two steady states meet at a fold and disappear, so moving the free parameter from the fold in
+ * the given direction creates two states (a saddle and a node) next to x, and moving it the
+ * other way removes them
+*/
+typedef struct
+{
+   int numVars;
+   double * x;        //steady state at the fold
+   double * v;        //null vector of the Jacobian there (unit length)
+   double param;      //value of the free parameter at the fold
+   int direction;     //+1 or -1: sign of the parameter change that creates the two states (0 = degenerate fold, e.g. a cusp)
+   int iterations;    //Newton steps taken
+   double residual;   //norm of the augmented system at the fold
+} FoldPoint;
+
+/*
+ * Locate the fold nearest to a steady state. The branch of steady states through x is followed both
+ * ways in the free parameter p, a step at a time each way (tangent predictor, Newton corrector, see
+ * deflatedNewton); a step is halved when the corrector fails or the determinant of the Jacobian
+ * changes sign, which happens past a fold, where the branch turns back. Next to the first fold met,
+ * the solver switches to damped Newton iterations on the augmented system
+ *    f(x,p) = 0,   J(x,p)v = 0,   c.v = 1
+ * in the 2N+1 unknowns (x, p, v), where c is the eigenvector of the Jacobian whose eigenvalue is
+ * closest to zero (by inverse iteration). Each of its steps costs three Jacobians (see jacobian) and
+ * a few ode function calls, and it converges in a handful of steps from there. A positive parameter
+ * stays positive: the search works on its logarithm. The system must have no conservation laws, or
+ * J is singular everywhere and every steady state is a fold. The ode function calls and the
+ * Jacobians are charged to the budget of the calling thread (see ODEsetBudget)
+ * @param: number of variables
+ * @param: steady state to start from
+ * @param: the free parameter, inside params; it is changed during the search and restored on return
+ * @param: ode function pointer
+ * @param: additional parameters needed for ode function
+ * @param: maximum number of Newton steps on the augmented system
+ * @param: tolerance on the norm of the augmented system (its square is the tolerance of the corrector)
+ * @ret: the fold, or 0 if there is none within FOLD_SCAN_RANGE (or the budget was exhausted, see ODEsetBudget)
+*/
+FoldPoint * foldFind(int N, double * x, double * param, void (*odefnc)(double,double*,double*,void*), void * params, int maxIter, double tol);
+
+/*
+ * The Newton iterations of foldFind alone, from a point already next to a fold, such as a
+ * CONTINUATION_FOLD row of a branch (continuation.h uses it to locate them). Charged to the budget
+ * like foldFind
+ * @param: number of variables
+ * @param: steady state next to the fold
+ * @param: the free parameter, inside params, at its value for that state; restored on return
+ * @param: ode function pointer
+ * @param: additional parameters needed for ode function
+ * @param: maximum number of Newton steps
+ * @param: tolerance on the norm of the augmented system
+ * @ret: the fold, or 0 if the iteration did not converge
+*/
+FoldPoint * foldPolish(int N, double * x, double * param, void (*odefnc)(double,double*,double*,void*), void * params, int maxIter, double tol);
+
+/*
+ * free the structure
+ * @param: fold (may be null)
+*/
+void foldFree(FoldPoint *);
+
+#endif
@@ -7,6 +7,45 @@
  
 #include "ga.h"
 #include <stdio.h>
+#include <time.h>
+
+static double GA_TIME_LIMIT = 0;   /*seconds, 0 = no limit*/
+static double GA_DEADLINE = 0;     /*absolute time at which the current run stops*/
+static int GA_TIMED_OUT = 0;
+static GABatchFitnessFnc GA_BATCH_FITNESS = 0;
+
+static double GAclock(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ((double)ts.tv_sec + 1.0e-9 * (double)ts.tv_nsec);
+}
+
+/*
+ * check whether the time limit of the current run has expired
+*/
+static int GAexpired(void)
+{
+   if (GA_DEADLINE > 0 && !GA_TIMED_OUT && GAclock() > GA_DEADLINE)
+      GA_TIMED_OUT = 1;
+   return (GA_TIMED_OUT);
+}
+
+void GAsetTimeLimit(double seconds)
+{
+   GA_TIME_LIMIT = seconds;
+}
+
+int GAtimedOut(void)
+{
+   return (GA_TIMED_OUT);
+}
+
+void GAsetBatchFitness(GABatchFitnessFnc batch)
+{
+   GA_BATCH_FITNESS = batch;
+}
+
 /*
  * Selects an individual at random, with probability of selection ~ fitness
  * @param: array of individuals
@@ -57,9 +96,21 @@ Population GAnextGen(Population currentPopulation, int oldPopSz, int newPopSz,
    double totalFitness = 0;
    int best = 0;  //save best's index
 
+   int batch = (GA_BATCH_FITNESS != NULL && !GAexpired());
+   if (batch)
+      GA_BATCH_FITNESS(currentPopulation,oldPopSz,fitnessArray);
+
    for (i = 0; i < oldPopSz; ++i)
    {
-      fitnessArray[i] = fitness(currentPopulation[i]);
+      if (!batch)
+      {
+         if (GAexpired())   //out of time: the rest of the generation is not evaluated
+         {
+            fitnessArray[i] = 0;
+            continue;
+         }
+         fitnessArray[i] = fitness(currentPopulation[i]);
+      }
       if (fitnessArray[i] < 0) fitnessArray[i] = 0;   //negative fitness not allowed
 
       totalFitness += fitnessArray[i];
@@ -130,6 +181,10 @@ Population GArun(Population initialPopulation, int initPopSz, int popSz, int num
    FILE * errfile = freopen("GArun_errors.log", "w", stderr);
 
    initMTrand(); /*initialize seeds for MT random number generator*/
+   GA_TIMED_OUT = 0;
+   GA_DEADLINE = 0;
+   if (GA_TIME_LIMIT > 0) GA_DEADLINE = GAclock() + GA_TIME_LIMIT;
+
    int i = 0, stop = 0;
    Population population = initialPopulation;
 
@@ -144,9 +199,10 @@ Population GArun(Population initialPopulation, int initPopSz, int popSz, int num
          stop = callback(i,population,popSz);
 
      ++i;
-     if (i >= numGenerations) stop = 1;
+     if (i >= numGenerations || GAexpired()) stop = 1;
    }
-   GAsort(population,fitness,popSz);
+   if (!GA_TIMED_OUT)  //re-evaluating everything would overrun the time limit; the best is already first
+      GAsort(population,fitness,popSz);
 
    fclose(errfile);
    return (population);
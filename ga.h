@@ -69,6 +69,14 @@ typedef int(*GASelectionFnc)(Population , double * , double , int );
  * @ret: 0 = continue GA, 1 = stop GA. This can be used to stop the GA before it reaches max iterations
 */
 typedef int(*GACallbackFnc)(int,Population,int);
+/*
+ * Batch fitness function. Computes the fitness of a whole population at once, so the
+ * user can decide which individuals are worth a full evaluation (see GAsetBatchFitness)
+ * @param: Population of individuals
+ * @param: number of individuals in the population
+ * @param: array that receives the fitness values (same order as the population)
+*/
+typedef void(*GABatchFitnessFnc)(Population,int,double*);
 
 /************************************************************************************************************
   The central functions of the genetic algorithm
@@ -111,6 +119,26 @@ Population GAnextGen(Population,int,int,GAFitnessFnc,GACrossoverFnc,GAMutateFnc,
 */
 Population GArun(Population,int,int,int,GAFitnessFnc,GACrossoverFnc,GAMutateFnc, GACallbackFnc);
 
+/*
+ * Limit the wall-clock time of GArun. When the limit expires, the remaining individuals of
+ * the current generation are not evaluated (fitness 0) and GArun returns after that generation.
+ * The returned population is then not sorted, but its first individual is the best one found
+ * @param: seconds (0 = no limit)
+*/
+void GAsetTimeLimit(double seconds);
+
+/*
+ * @ret: 1 if the last call to GArun was stopped by its time limit, 0 otherwise
+*/
+int GAtimedOut(void);
+
+/*
+ * Compute the fitness values of each generation with a batch function instead of calling
+ * the fitness function once per individual. The fitness function is still used by GAsort
+ * @param: batch fitness function, or 0 to call the fitness function for every individual
+*/
+void GAsetBatchFitness(GABatchFitnessFnc);
+
 /*
  * sort (Quicksort) a population by its fitness
  * @param: population to sort
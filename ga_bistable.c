@@ -1,22 +1,144 @@
 #include "ga_bistable.h"
 #include "opt.h"
+#include "metrics.h"
+#include "surrogate.h"
+#include "es.h"
+#include "crnt.h"
 
-static Parameters * _PARAM = 0;
-static double * _DU = 0;
-static double * _U = 0;
-static double * _U0 = 0;
 static double MIN_EIG_DEV = 0.1;
 static double SS_MIN_ERROR = 1.0e-5;
 static double SS_MAX_TIME = 1000.0;
+static THREAD_LOCAL double SS0_MAX_TIME = 1000.0;  //SS_MAX_TIME for the first steady state (set by the accuracy schedule)
 static double SS_MIN_DT = 10.0;
 static double * INIT_VALUE = 0;
 static double MIN_ERROR = 1.0;
+static double ZERO_MAX_ERROR = 1.0e-10;  //sum of squares of the ode function accepted as a zero
+static int ZERO_MAX_ITER = 50;           //Newton iterations from each initial point
+static int SECOND_STATE_STARTS = 100;    //initial points for the second stable state
 static int PRINT_STEPS = 1;
 static int GA_MAX_ITERATIONS = 100;
 static int GA_POPULATION_SZ = 1000;
 
+/*per-evaluation cost limits (0 = unlimited)*/
+static long EVAL_MAX_RHS_EVALS = 200000;
+static long EVAL_MAX_STEPS = 20000;
+static double EVAL_MAX_SECONDS = 0;
+static THREAD_LOCAL ODEbudget * _BUDGET = 0;    //budget of the running evaluation, charged by the screens
+
+static double RUN_MAX_SECONDS = 0;  //wall-clock limit for makeBistable (0 = unlimited)
+static double RUN_DEADLINE = 0;     //ODEclock() time at which the current run stops
+static double TIMEOUT_GRACE_SECONDS = 1.0;  //time left for the result of a run that timed out
+
+/*accuracy schedule: loose tolerances and short simulations while the best fitness is low*/
+#define MAX_FIDELITY_LEVELS 8
+static FidelityLevel FIDELITY[MAX_FIDELITY_LEVELS] =
+{
+   { 1.0e-3, 1.0e-4, 1000.0, 0.0  },
+   { 1.0e-4, 1.0e-5, 1000.0, 0.25 },
+   { 0.0,    1.0e-5, 1000.0, 0.45 }
+};
+static int NUM_FIDELITY = 3;
+static int FIDELITY_DEFAULT = 1;      //1 until setBistableFidelity: the last level takes the caller's tolerances
+static double CALLER_RELTOL = 0, CALLER_ABSTOL = 1.0e-5;   //tolerances of the thread that called makeBistable
+static int CALLER_METHOD = ODE_CVODE; //and its integrator, given back at the end
+static int INTEGRATOR = ODE_CVODE;    //integration method of every level (see ODEmethod)
+static int DIFFERENCES = ODE_CENTRAL; //finite differences of the Jacobians (see ODEdifferences)
+static ODEbatchFunction BATCH_FNC = 0;  //batch form of the ode function (see ODEbatch)
+
+/*tolerance of each variable: the absTol of the level times the variable's scale (see setBistableScales)*/
+static double * SCALES = 0;     //characteristic magnitude of each variable (0 = one tolerance for all)
+static int NUM_SCALES = 0;
+static int AUTO_SCALE = 0;      //1 = also estimate the magnitudes from INIT_VALUE and the first steady state
+#define SCALE_FLOOR 1.0e-3      //smallest scale, relative to the largest one
+
+/*conservation laws of the network, used to integrate a reduced system (see setBistableStoichiometry)*/
+static double * STOICHIOMETRY = 0;   //variables x reactions
+static int STOICHIOMETRY_VARS = 0, NUM_REACTIONS = 0;
+static Conservation * LAWS = 0;      //laws of the current run (0 = none)
+
+/*reactions of the network, for the structural test that can rule out bistability (see setBistableNetwork)*/
+static double * NETWORK_REACTANTS = 0, * NETWORK_PRODUCTS = 0;   //species x reactions
+static int NETWORK_VARS = 0, NETWORK_REACTIONS = 0;
+
+/*polynomial ode function whose steady states are all found by homotopy continuation (see setBistablePolynomial)*/
+static PolynomialSystem * POLYNOMIAL = 0;
+#define POLYNOMIAL_NEGATIVE 1.0e-8   //a root counts as non-negative down to this (relative)
+
+/*box whose steady states a system of two variables gets from its nullclines (see setBistableNullclines)*/
+static int NULLCLINE_GRID = 0;   //cells per side (0 = off)
+static double NULLCLINE_LOWER[2], NULLCLINE_UPPER[2];
+
+/*sparse Jacobian for large networks (see setBistableSparse)*/
+static int SPARSE_VARS = 0;          //size of the systems that use it (0 = dense)
+static int * SPARSE_ROWPTR = 0, * SPARSE_COLIND = 0;   //declared pattern (0 = probe it)
+static SparseMatrix * PATTERN = 0;   //pattern of the current run (0 = dense)
+#define SPARSE_PROBES 3              //random individuals whose Jacobians make up a probed pattern
+static int FIDELITY_LEVEL = 0;  //level of the current generation
+static THREAD_LOCAL int _LEVEL = -1;  //level of the running evaluation (see fidelityLevel)
+
+/*surrogate prescreening: only the most promising part of each generation gets a full evaluation*/
+static double SURROGATE_FRACTION = 1.0;  //fraction fully evaluated (1 = surrogate off)
+static int SURROGATE_INHERIT = 1;        //1 = the others keep the estimate, 0 = they score 0
+static int SURROGATE_K = 5;              //neighbours per estimate
+static int SURROGATE_MIN_POINTS = 200;   //evaluations needed before the estimates are used
+#define SURROGATE_CAPACITY 5000
+static Surrogate * SURROGATE = 0;
+static long SURROGATE_GEN_CHECKED = 0, SURROGATE_GEN_SKIPPED = 0;  //counts of the current generation
+static double SURROGATE_GEN_ERROR = 0;
+
+/*memetic step: the best individuals of each GA generation are refined by a short local search*/
+static int MEMETIC_TOP = 0;          //individuals refined per generation (0 = off)
+static int MEMETIC_ITERATIONS = 10;  //Nelder-Mead iterations per individual
+static double REFINE_STEP = 0.25;    //initial simplex size (log parameters and alphas)
+static double REFINE_LOG_MIN = -9.2, REFINE_LOG_MAX = 9.2;  //bounds of the log parameters (1e-4 to 1e4)
+static THREAD_LOCAL Parameters * _REFINE = 0;      //trial individual of the running refinement
+static THREAD_LOCAL double * _REFINE_X = 0;        //best point found by it
+static THREAD_LOCAL double * _REFINE_TRIAL = 0;    //the trial point within the bounds
+static THREAD_LOCAL double _REFINE_BEST = 0;       //fitness of _REFINE_X
+static long MEMETIC_GEN_REFINED = 0, MEMETIC_GEN_IMPROVED = 0;  //counts of the current generation
+
+/*fold refinement of the memetic step (see setBistableFoldRefinement)*/
+static int FOLD_REFINE = 0;
+static int FOLD_PARAM = -1;         //free parameter of the fold search (-1 = the one with the nearest fold)
+static int FOLD_ITERATIONS = 30;    //Newton steps on the augmented system
+#define FOLD_TRIALS 3               //points tried inside the window past the fold
+
+/*first steady states of a whole batch with the ensemble integrator (see setBistableEnsemble)*/
+static int ENSEMBLE = 0;
+static THREAD_LOCAL double * _SS0 = 0;            //first steady state of the next evaluation, if already known
+static THREAD_LOCAL ODEbudget * _SS0_COST = 0;    //the work it took
+
+/*optimizer used by makeBistable, and the problem size for decoding its candidates*/
+static int ENGINE = BISTABLE_ENGINE_GA;
+static int NUM_VARS = 0, NUM_PARAMS = 0;
+
+static FILE * METRICS_FILE = 0;     //one JSON record per generation (0 = none)
+static FILE * EVENT_LOG = 0;        //one binary MetricEvent per evaluation (0 = none)
+
+/*the stages at which a fitness evaluation can exit, in the order they are reached*/
+enum
+{
+   EXIT_OUT_OF_TIME,   //the run deadline has passed
+   EXIT_ALPHAS,        //all alphas non-negative
+   EXIT_NOT_FINITE,    //the ode function is not finite at INIT_VALUE
+   EXIT_SS0_FAILED,    //no steady state from INIT_VALUE
+   EXIT_NO_ZERO,       //Newton found no second zero (partial score)
+   EXIT_STABLE_ZERO,   //the second zero is stable
+   EXIT_TOO_CLOSE,     //the second zero is too close to ss0
+   EXIT_BUDGET,        //evaluation budget exhausted
+   EXIT_BISTABLE,      //fitness 1
+   EXIT_STAGES
+};
+
+static const char * EXIT_NAMES[EXIT_STAGES] =
+{
+   "out_of_time", "alphas", "not_finite",
+   "ss0_failed", "no_zero", "stable_zero", "too_close", "budget", "bistable"
+};
+
 static double * UNSTABLE_PT = 0;
 static double * STABLE_PT = 0;
+static double * SECOND_PT = 0;   //second stable state, when the evaluation found it (see polynomialFitness)
 
 static Parameters ** BAD_PARAMS = 0;
 
@@ -96,16 +218,110 @@ static void deleteBadParams()
    }
 }
 
-static double FMIN(int n, double x[])
+/*the level of the running evaluation: full accuracy (NUM_FIDELITY-1) until useFidelity sets one*/
+static int fidelityLevel()
 {
-   if (_U0 && distance(x,_U0,n) < MIN_ERROR) return 1.0;
+   if (_LEVEL < 0 || _LEVEL >= NUM_FIDELITY) return (NUM_FIDELITY-1);
+   return _LEVEL;
+}
 
-   ODE_FNC(1.0,x,_DU,(void*)_PARAM);
-   double sumsq = 0;
-   int i;
-   for (i=0; i < n; ++i)
-       sumsq += (_DU[i]*_DU[i]);
-   return (sumsq);
+/*
+ * set one absolute tolerance per variable from the given scales and, with AUTO_SCALE,
+ * the magnitudes of INIT_VALUE and the first steady state (uses the level of the thread)
+ * @param: first steady state of the running evaluation, or 0
+*/
+static void scaleTolerances(double * ss0)
+{
+   int i, N = NUM_VARS;
+   double largest = 0;
+   if (N < 1 || (NUM_SCALES != N && (ss0 == 0 || !AUTO_SCALE)))
+   {
+      ODEtoleranceVector(0,0);
+      return;
+   }
+   double * abstol = METRIC_MALLOC(N * sizeof(double));
+   for (i=0; i < N; ++i)
+   {
+      abstol[i] = (NUM_SCALES == N) ? fabs(SCALES[i]) : 0.0;
+      if (ss0 && AUTO_SCALE)
+      {
+         if (INIT_VALUE && fabs(INIT_VALUE[i]) > abstol[i]) abstol[i] = fabs(INIT_VALUE[i]);
+         if (fabs(ss0[i]) > abstol[i]) abstol[i] = fabs(ss0[i]);
+      }
+      if (abstol[i] > largest) largest = abstol[i];
+   }
+   if (largest > 0)
+   {
+      for (i=0; i < N; ++i)
+      {
+         if (abstol[i] < SCALE_FLOOR * largest) abstol[i] = SCALE_FLOOR * largest;
+         abstol[i] *= FIDELITY[fidelityLevel()].absTol;
+      }
+      ODEtoleranceVector(N,abstol);
+   }
+   else   //everything is zero: nothing to scale by
+      ODEtoleranceVector(0,0);
+   free(abstol);
+}
+
+/*set the tolerances and simulation time of one accuracy level*/
+static void useFidelity(int level)
+{
+   _LEVEL = level;
+   SS0_MAX_TIME = FIDELITY[level].maxTime;
+   ODEtolerance(FIDELITY[level].relTol, FIDELITY[level].absTol);
+   ODEmethod(INTEGRATOR);
+   ODEsparsity(PATTERN);
+   ODEdifferences(DIFFERENCES);
+   ODEbatch(ODE_FNC, BATCH_FNC);
+   scaleTolerances(0);
+}
+
+/*drop the thread's copy of the scales and its pointer to the run's sparsity pattern*/
+static void leaveFidelity()
+{
+   ODEtoleranceVector(0,0);
+   ODEsparsity(0);
+}
+
+/*give the thread that called makeBistable back its tolerances and integrator*/
+static void restoreCaller()
+{
+   ODEtolerance(CALLER_RELTOL, CALLER_ABSTOL);
+   ODEtoleranceVector(0,0);
+   ODEmethod(CALLER_METHOD);
+}
+
+/*the time limit of one evaluation: EVAL_MAX_SECONDS cut to what is left before RUN_DEADLINE (-1 = none left)*/
+static double evalSeconds()
+{
+   double seconds = EVAL_MAX_SECONDS;
+   if (RUN_DEADLINE > 0)   //never run past the end of the run
+   {
+       double left = RUN_DEADLINE - ODEclock();
+       if (left <= 0) return (-1.0);
+       if (seconds <= 0 || left < seconds) seconds = left;
+   }
+   return seconds;
+}
+
+/*
+ * score of an individual whose second zero was not found: below 0.5, and rising smoothly
+ * towards it as the least squared residual of the search falls
+ * @param: least squared residual
+*/
+static double nearMiss(double fmin)
+{
+   return 1.0e-5/(2.0e-5 + fmin);
+}
+
+/*the outcome of an evaluation that ran out of budget: free its partial results and score 0*/
+static double outOfBudget(double * x, double * y)
+{
+   if (x) free(x);
+   if (y) free(y);
+   METRIC_INC(METRIC_BUDGET_EXHAUSTED);
+   return (0.0);
 }
 
 void deleteIndividual(void * individual)
@@ -121,12 +337,12 @@ void deleteIndividual(void * individual)
 
 void * clone(void * x)
 {
-   Parameters * p = malloc(sizeof(Parameters));
+   Parameters * p = METRIC_MALLOC(sizeof(Parameters));
    Parameters * net = (Parameters*)x;
    (*p).numVars = (*net).numVars;
    (*p).numParams = (*net).numParams;
-   (*p).params  = malloc(  (*p).numParams * sizeof(double) );
-   (*p).alphas  = malloc(  (*p).numVars * sizeof(double) );
+   (*p).params  = METRIC_MALLOC(  (*p).numParams * sizeof(double) );
+   (*p).alphas  = METRIC_MALLOC(  (*p).numVars * sizeof(double) );
 
    int i;
    for (i = 0; i < (*p).numVars; ++i)
@@ -142,11 +358,11 @@ void * clone(void * x)
 
 Parameters * randomNetwork(int numVars, int numParams)
 {
-   Parameters * p = malloc(sizeof(Parameters));
+   Parameters * p = METRIC_MALLOC(sizeof(Parameters));
    (*p).numParams = numParams;
    (*p).numVars = numVars;
-   (*p).params  = malloc( numParams * sizeof(double) );
-   (*p).alphas  = malloc( numVars * sizeof(double) );
+   (*p).params  = METRIC_MALLOC( numParams * sizeof(double) );
+   (*p).alphas  = METRIC_MALLOC( numVars * sizeof(double) );
 
    int i;
    for (i = 0; i < numParams; ++i) (*p).params[i] = 10.0*randnum;
@@ -155,11 +371,25 @@ Parameters * randomNetwork(int numVars, int numParams)
    return (p);
 }
 
-static double * regularSteadyState(Parameters * p, double * iv)
+/*
+ * reduce the integrations of the calling thread by the conservation laws of the network, on
+ * the class of INIT_VALUE. The system with alphas keeps the laws only if the alphas are all equal
+ * @param: individual, or 0 to stop reducing
+*/
+static void conserve(Parameters * p)
+{
+   int i, keep = (LAWS != 0 && p != 0);
+   for (i=1; keep && i < (*p).numVars; ++i)
+      if ((*p).alphas[i] != (*p).alphas[0]) keep = 0;
+   ODEconservation(keep ? LAWS : 0, INIT_VALUE);
+}
+
+static double * regularSteadyState(Parameters * p, double * iv, ODEbudget * budget)
 {
    int i;
    int N = (*p).numVars;
-   double * alphas = malloc(N*sizeof(double));
+   METRIC_TIMER_START(t0);
+   double * alphas = METRIC_MALLOC(N*sizeof(double));
 
    for (i=0; i < N; ++i)
    {
@@ -167,70 +397,232 @@ static double * regularSteadyState(Parameters * p, double * iv)
        (*p).alphas[i] = 1.0;
    }
 
-   double * ss = steadyState(N,iv,ODE_FNC,(void*)p,SS_MIN_ERROR,SS_MAX_TIME,SS_MIN_DT);
-   
+   ODEsetBudget(budget);
+   conserve(p);
+   double * ss = steadyState(N,iv,ODE_FNC,(void*)p,SS_MIN_ERROR,SS0_MAX_TIME,SS_MIN_DT);
+   conserve(0);
+   ODEsetBudget(0);
+
    for (i=0; i < N; ++i)
        (*p).alphas[i] = alphas[i];
    free(alphas);
 
+   METRIC_TIMER_STOP(t0, TIMER_REGULAR_SS);
    return ss;
 }
 
-static double * unstableSteadyState(Parameters * p, double * iv)
+static double * unstableSteadyState(Parameters * p, double * iv, ODEbudget * budget)
 {
+   METRIC_TIMER_START(t0);
+   ODEsetBudget(budget);
+   conserve(p);
    double * ss = steadyState((*p).numVars,iv,ODE_FNC,(void*)p,SS_MIN_ERROR,SS_MAX_TIME,SS_MIN_DT);
+   conserve(0);
+   ODEsetBudget(0);
+   METRIC_TIMER_STOP(t0, TIMER_UNSTABLE_SS);
    return ss;
 }
 
-static double * findZeros(Parameters * p, double * x, double * fopt)
+/*
+ * a zero of the ode function other than the given ones, by deflated Newton iterations
+ * from INIT_VALUE and then from points 10 units away from the first known zero
+ * @param: individual
+ * @param: known zeros
+ * @param: number of known zeros
+ * @param: receives the smallest deflated sum of squares seen (the partial score when nothing is found)
+ * @param: budget
+ * @ret: the new zero, or 0
+*/
+static double * findZeros(Parameters * p, double ** known, int numKnown, double * fopt, ODEbudget * budget)
 {
-   //double fopt;
-   double * ss = 0;
-   _DU = malloc((*p).numVars*sizeof(double));
-   _PARAM = p;
+   int i, j, N = (*p).numVars;
+   double fmin, * ss = METRIC_MALLOC(N*sizeof(double));
+   METRIC_TIMER_START(t0);
+
+   (*fopt) = HUGE_VAL;
+   ODEsetBudget(budget);
+   ODEconservation(LAWS, INIT_VALUE);   //the zeros do not depend on the alphas
+   for (j=-1; j < N && !(*budget).exhausted; ++j)
+   {
+       for (i=0; i < N; ++i)
+           ss[i] = (j < 0) ? INIT_VALUE[i] : known[0][i];
+       if (j >= 0) ss[j] += 10.0;
+
+       int found = deflatedNewton(N,ss,ODE_FNC,(void*)p,known,numKnown,ZERO_MAX_ERROR,ZERO_MAX_ITER,&fmin);
+       if (fmin < (*fopt)) (*fopt) = fmin;
+       if (found)
+       {
+           ODEconservation(0,0);
+           ODEsetBudget(0);
+           METRIC_TIMER_STOP(t0, TIMER_FIND_ZEROS);
+           return ss;
+       }
+   }
+   ODEconservation(0,0);
+   ODEsetBudget(0);
+   free(ss);
+
+   METRIC_TIMER_STOP(t0, TIMER_FIND_ZEROS);
+   return 0;
+}
 
+/*
+ * Pre-screens: cheap tests that run before any integration.
+ * Each test returns 1 to reject the individual.
+*/
+
+/*all alphas non-negative: the modified system cannot expose the saddle*/
+static int screenAlphas(Parameters * p)
+{
    int i;
    for (i=0; i < (*p).numVars; ++i)
+      if ((*p).alphas[i] < -MIN_EIG_DEV)
+         return 0;
+   return 1;
+}
+
+/*the ode function is not finite at the initial values: integration would fail*/
+static int screenFinite(Parameters * p)
+{
+   int i, N = (*p).numVars, bad = 0;
+   double * du = METRIC_MALLOC(N * sizeof(double));
+   ODEbudgetCharge(_BUDGET,1,0);
+   ODE_FNC(1.0,INIT_VALUE,du,(void*)p);
+   for (i=0; i < N; ++i)
+      if (!isfinite(du[i])) bad = 1;
+   free(du);
+   return bad;
+}
+
+typedef struct
+{
+   int flag;                     //SCREEN_* bit
+   int stage;                    //exit stage of the rejected individuals
+   int (*test)(Parameters *);
+} Screen;
+
+#define NUM_SCREENS 2
+
+/*cheapest first: the alphas cost nothing, the finite test one ode function call*/
+static Screen SCREENS[NUM_SCREENS] =
+{
+   { SCREEN_ALPHAS,      EXIT_ALPHAS,      &screenAlphas },
+   { SCREEN_FINITE,      EXIT_NOT_FINITE,  &screenFinite }
+};
+
+static int SCREEN_MASK = SCREEN_ALPHAS | SCREEN_FINITE;
+
+/*
+ * run the enabled screens in order
+ * @ret: exit stage of the screen that rejected the individual, or -1
+*/
+static int prescreen(Parameters * p, ODEbudget * budget)
+{
+   int i, reject = 0;
+   Screen * s;
+   _BUDGET = budget;
+   ODEsetBudget(budget);
+   for (i=0; i < NUM_SCREENS && !reject; ++i)
    {
-       _U[i] = x[i];
+      s = &SCREENS[i];
+      if (SCREEN_MASK & (*s).flag)
+         reject = (*s).test(p);
    }
+   ODEsetBudget(0);
+   _BUDGET = 0;
+   if (reject) return (*s).stage;
+   return -1;
+}
+
+static double evaluate(Parameters * p, ODEbudget * budget, int * stage);
+static double polynomialFitness(Parameters * p, ODEbudget * budget, int * stage);
+static double nullclineFitness(Parameters * p, ODEbudget * budget, int * stage);
+static double statesFitness(Parameters * p, double * roots, int n, double nearReal, ODEbudget * budget, int * stage);
 
-   if (NelderMeadSimplexMethod((*p).numVars, &(FMIN), _U, 10.00, fopt, 1000.0, 1.0e-10) == success)
+double fitness(void * individual)
+{
+   int stage = EXIT_BISTABLE;
+   ODEbudget budget;
+   ODEbudgetInit(&budget, 0, 0, 0);
+
+   METRIC_TIMER_START(t0);
+   useFidelity(FIDELITY_LEVEL);
+   double score = evaluate((Parameters*)individual, &budget, &stage);
+   long rhsEvals = budget.rhsEvals, steps = budget.steps;
+   if (_SS0)   //the evaluation exited before it needed the first steady state
    {
-         if ((*fopt) <= 1.0e-5)
-              ss = _DU;
-          else
-              free(_DU);
+       free(_SS0);
+       _SS0 = 0;
    }
-   else
-      free(_DU);
+   _SS0_COST = 0;
 
-   return ss;
+   if (score >= 1.0 && fidelityLevel() < NUM_FIDELITY-1)  //a low-accuracy result is never accepted as it is
+   {
+       METRIC_INC(METRIC_REVERIFICATIONS);
+       useFidelity(NUM_FIDELITY-1);
+       score = evaluate((Parameters*)individual, &budget, &stage);
+       rhsEvals += budget.rhsEvals;
+       steps += budget.steps;
+       if (score < 1.0) METRIC_INC(METRIC_FALSE_POSITIVES);
+   }
+
+   leaveFidelity();   //worker threads do not keep the scales or the pattern
+   METRIC_INC(METRIC_EVALUATIONS);
+   METRIC_TIMER_STOP(t0, TIMER_FITNESS);
+   METRIC_STAGE(stage, rhsEvals, steps, t0);
+   return score;
 }
 
-double fitness(void * individual)
+/*
+ * the fitness computation
+ * @param: individual
+ * @param: budget charged by all stages (initialized here once the alphas pass)
+ * @param: set to the stage at which the evaluation exited
+ * @ret: fitness
+*/
+static double evaluate(Parameters * p, ODEbudget * budget, int * stage)
 {
-   int i,j;
-   Parameters * p = (Parameters*)individual;
-
    //if (isBad(p)) return 0.0;
 
-   int allPos = 1.0;
    int N = (*p).numVars;
 
-   for (i=0; i < (*p).numVars; ++i)
+   double seconds = evalSeconds();
+   if (seconds < 0)
    {
-      if ((*p).alphas[i] < -MIN_EIG_DEV)
-      {
-          allPos = 0;
-          break;
-      }
+       (*stage) = EXIT_OUT_OF_TIME;
+       return (0.0);
    }
-   if (allPos) return (0.0);
 
-   double * ss0 = regularSteadyState(p,INIT_VALUE);
+   ODEbudgetInit(budget, EVAL_MAX_RHS_EVALS, EVAL_MAX_STEPS, seconds);
+
+   if (POLYNOMIAL && (*POLYNOMIAL).numVars == N && LAWS == 0)
+      return polynomialFitness(p,budget,stage);
+
+   if (NULLCLINE_GRID > 0 && N == 2 && LAWS == 0)
+      return nullclineFitness(p,budget,stage);
+
+   (*stage) = prescreen(p,budget);
+   if ((*stage) >= 0) return (0.0);
+
+   (*stage) = EXIT_BUDGET;
+   double * ss0 = _SS0;
+   ODEbudget * batchCost = _SS0_COST;
+   _SS0 = 0;
+   _SS0_COST = 0;
+   if (ss0)   //computed with the rest of the batch: charge its share
+       ODEbudgetCharge(budget, (*batchCost).rhsEvals, (*batchCost).steps);
+   else
+   {
+       if (batchCost) METRIC_INC(METRIC_ENSEMBLE_FALLBACKS);   //the ensemble integrator gave up on it
+       ss0 = regularSteadyState(p,INIT_VALUE,budget);
+   }
 
-   if (ss0 == 0) { return (0.0); }
+   if ((*budget).exhausted) return outOfBudget(ss0,0);
+   if (ss0 == 0)
+   {
+       (*stage) = EXIT_SS0_FAILED;
+       return (0.0);
+   }
    /*for (i=0; i < N; ++i)
    {
        if (ss0[i] < 0.0) //negative steady state
@@ -240,22 +632,28 @@ double fitness(void * individual)
        }
    }*/
 
-   for (i=0; i < (*p).numVars; ++i)  //tell nelder-mead to avoid this value
-   {
-       _U0[i] = ss0[i];
-   }
+   if (AUTO_SCALE) scaleTolerances(ss0);   //the later stages use tolerances that fit this system
 
    double fmin;
-   double * ss1 = findZeros(p,ss0,&fmin);
+   double * ss1 = findZeros(p,&ss0,1,&fmin,budget);
+
+   if ((*budget).exhausted) return outOfBudget(ss0,ss1);
 
    if (ss1 != 0)   //ok, we have a zero
    {
-       double * ss2 = unstableSteadyState(p,ss1);   //is it really a stable state
+       double * ss2 = unstableSteadyState(p,ss1,budget);   //is it really a stable state
+       if ((*budget).exhausted)
+       {
+           if (ss2) free(ss2);
+           return outOfBudget(ss0,ss1);
+       }
        if (ss2 == 0)   //(simu != findZero) so this is a stable state
        {
+           free(ss0);
            free(ss1);
            ss1 = 0;
            //setBad(p); //stay away from untra-sensitive points!
+           (*stage) = EXIT_STABLE_ZERO;
            return 0.0;
        }
        else
@@ -329,8 +727,8 @@ double fitness(void * individual)
        //free(yend);
        free (ss0);
        //free (y);
-       double score = 1.0e-5/(1.0e-5 + fmin);
-       return score;
+       (*stage) = EXIT_NO_ZERO;
+       return nearMiss(fmin);
     }
 
     /*for (i=0; i < N; ++i)
@@ -347,21 +745,563 @@ double fitness(void * individual)
     {
         free(ss0);
         free(ss1);
+        (*stage) = EXIT_TOO_CLOSE;
         return 0.0;
     }
 
-    if (STABLE_PT)
-       free(ss0);
-    else
-       STABLE_PT = ss0;
+    (*stage) = EXIT_BISTABLE;
 
-    if (UNSTABLE_PT)
-        free(ss1);
-    else
-        UNSTABLE_PT = ss1;
+    #pragma omp critical (bistable)
+    {
+       if (STABLE_PT || fidelityLevel() < NUM_FIDELITY-1)  //only keep full-accuracy states
+          free(ss0);
+       else
+          STABLE_PT = ss0;
+
+       if (UNSTABLE_PT || fidelityLevel() < NUM_FIDELITY-1)
+           free(ss1);
+       else
+           UNSTABLE_PT = ss1;
+    }
     return 1.0;
 }
 
+/*
+ * the fitness computation for a polynomial ode function: every real steady state comes from
+ * homotopySolve, so nothing is integrated, no pre-screen is needed and the result does not
+ * depend on initial values (see statesFitness)
+ * @param: individual
+ * @param: budget charged by the Jacobians
+ * @param: set to the stage at which the evaluation exited
+ * @ret: fitness
+*/
+static double polynomialFitness(Parameters * p, ODEbudget * budget, int * stage)
+{
+   int n;
+   double nearReal;
+   double * roots = homotopySolve(POLYNOMIAL, (void*)p, &n, &nearReal);
+   return statesFitness(p, roots, n, nearReal, budget, stage);
+}
+
+/*
+ * the fitness computation for a system of two variables: every steady state in the box of
+ * setBistableNullclines comes from nullclineRoots, one sweep of the ode function over a grid and
+ * a few Newton iterations, instead of integrations and a Newton search (see statesFitness).
+ * The sweep is charged to the budget as one ode function call per node
+ * @param: individual
+ * @param: budget charged by the sweep, the Newton iterations and the Jacobians
+ * @param: set to the stage at which the evaluation exited
+ * @ret: fitness
+*/
+static double nullclineFitness(Parameters * p, ODEbudget * budget, int * stage)
+{
+   int n;
+   double nearMiss, ones[2] = { 1.0, 1.0 };
+   Parameters q = (*p);   //the states do not depend on the alphas, unless one of them is 0
+   q.alphas = ones;
+
+   ODEbudgetCharge(budget, (long)(NULLCLINE_GRID + 1) * (NULLCLINE_GRID + 1), 0);
+   ODEsetBudget(budget);
+   double * roots = nullclineRoots(NULLCLINE_LOWER, NULLCLINE_UPPER, NULLCLINE_GRID, ODE_FNC, (void*)&q, &n, &nearMiss);
+   ODEsetBudget(0);
+   return statesFitness(p, roots, n, nearMiss, budget, stage);
+}
+
+/*
+ * the fitness of an individual from all of its real steady states. The states do not depend on
+ * the alphas, and their stability is that of the system with all alphas 1, as in findSecondStableState.
+ * Each non-negative state gets the largest real part of the eigenvalues of its Jacobian,
+ * relative to the norm of the Jacobian (-1 to 1, negative when the state is stable), plus 1 for a
+ * saddle (an odd number of positive real eigenvalues), which can only turn stable by meeting
+ * another state
+ * @param: individual
+ * @param: the states, N values each (freed here; may be null)
+ * @param: number of states
+ * @param: how far the system is from having one more state (the distance of the closest complex
+ *         pair from being real, or how close the nullclines come), or -1 if unknown
+ * @param: budget charged by the Jacobians
+ * @param: set to the stage at which the evaluation exited
+ * @ret: 1 for two stable states; for two or more states, 0.6 to 0.9 as the second most stable one
+ *       gets closer to being stable (0.5 to 0.6 if it is a saddle); otherwise the partial score of
+ *       findZeros, measured by the distance above
+*/
+static double statesFitness(Parameters * p, double * roots, int n, double nearReal, ODEbudget * budget, int * stage)
+{
+   int i, j, N = (*p).numVars, numReal = 0, unstable = -1;
+   int stable[2] = { -1, -1 };            //the two most stable states...
+   double growth[2] = { 3.0, 3.0 };       //...and their relative growth rates
+   double size, g;
+   double * wr = METRIC_MALLOC(3 * N * sizeof(double)), * wi = wr + N;
+
+   Parameters q = (*p);   //the stability is that of the system itself, without the alphas
+   q.alphas = wi + N;
+   for (i=0; i < N; ++i) q.alphas[i] = 1.0;
+
+   ODEsetBudget(budget);
+   for (j=0; j < n && !(*budget).exhausted; ++j)
+   {
+      double * x = roots + j*N;
+      for (i=0, size=0; i < N; ++i) size += fabs(x[i]);
+      for (i=0; i < N && x[i] >= -POLYNOMIAL_NEGATIVE * (1.0 + size); ++i) ;
+      if (i < N) continue;   //not a state of the system
+      ++numReal;
+
+      double * J = jacobian(N, x, ODE_FNC, (void*)&q);
+      g = 2.0;   //a state whose eigenvalues are unknown counts as unstable
+      if (J && matrixeigenvalues(N, J, wr, wi) >= 0)
+      {
+         double norm = 0;
+         int positive = 0;
+         for (i=0; i < N*N; ++i) norm += J[i]*J[i];
+         for (i=0, g=-HUGE_VAL; i < N; ++i)
+         {
+            if (wr[i] > g) g = wr[i];
+            if (wi[i] == 0 && wr[i] > 0) ++positive;
+         }
+         g = (norm > 0) ? g/sqrt(norm) : 0.0;
+         if (positive % 2) g += 1.0;   //a saddle can only turn stable by meeting another state
+      }
+      if (J) free(J);
+
+      if (g >= 0 && unstable < 0) unstable = j;
+      if (g < growth[0])
+      {
+         growth[1] = growth[0];
+         stable[1] = stable[0];
+         growth[0] = g;
+         stable[0] = j;
+      }
+      else
+      if (g < growth[1])
+      {
+         growth[1] = g;
+         stable[1] = j;
+      }
+   }
+   ODEsetBudget(0);
+   free(wr);
+
+   if ((*budget).exhausted)
+   {
+      (*stage) = EXIT_BUDGET;
+      return outOfBudget(roots,0);
+   }
+
+   if (numReal < 2 || growth[1] >= 0)
+   {
+      if (roots) free(roots);
+      (*stage) = EXIT_NO_ZERO;
+      if (numReal >= 2)
+         return (growth[1] <= 1.0) ? 0.6 + 0.3 * (1.0 - growth[1]) : 0.5 + 0.1 * (2.0 - growth[1]);
+      if (nearReal < 0) return 0.0;
+      return nearMiss(nearReal * nearReal);
+   }
+
+   if (distance(roots + stable[0]*N, roots + stable[1]*N, N) < MIN_ERROR)
+   {
+      free(roots);
+      (*stage) = EXIT_TOO_CLOSE;
+      return 0.0;
+   }
+
+   (*stage) = EXIT_BISTABLE;
+
+   #pragma omp critical (bistable)
+   {
+      if (!STABLE_PT && fidelityLevel() == NUM_FIDELITY-1)  //only keep full-accuracy states
+      {
+         STABLE_PT = METRIC_MALLOC(N * sizeof(double));
+         SECOND_PT = METRIC_MALLOC(N * sizeof(double));
+         for (i=0; i < N; ++i)
+         {
+            STABLE_PT[i] = roots[ stable[0]*N + i ];
+            SECOND_PT[i] = roots[ stable[1]*N + i ];
+         }
+         if (unstable >= 0 && !UNSTABLE_PT)
+         {
+            UNSTABLE_PT = METRIC_MALLOC(N * sizeof(double));
+            for (i=0; i < N; ++i) UNSTABLE_PT[i] = roots[ unstable*N + i ];
+         }
+      }
+   }
+   free(roots);
+   return 1.0;
+}
+
+/*
+ * an individual as a vector: the log of each parameter, then the alphas.
+ * This is the space searched by the CMA-ES and DE engines and by the local refinement,
+ * and the space in which the surrogate measures distances
+*/
+static void encode(Parameters * p, double * x)
+{
+   int i;
+   for (i=0; i < (*p).numParams; ++i)
+      x[i] = log(fabs((*p).params[i]) + 1.0e-10);
+   for (i=0; i < (*p).numVars; ++i)
+      x[ (*p).numParams + i ] = (*p).alphas[i];
+}
+
+/*set an individual from its vector (see encode); the alphas are normalized*/
+static void decodeInto(Parameters * p, double * x)
+{
+   int i;
+   for (i=0; i < (*p).numParams; ++i) (*p).params[i] = exp(x[i]);
+   for (i=0; i < (*p).numVars; ++i) (*p).alphas[i] = x[ (*p).numParams + i ];
+   normalize ((*p).alphas , (*p).numVars);
+}
+
+/*a new individual from its vector*/
+static Parameters * decode(double * x)
+{
+   Parameters * p = METRIC_MALLOC(sizeof(Parameters));
+   (*p).numVars = NUM_VARS;
+   (*p).numParams = NUM_PARAMS;
+   (*p).params = METRIC_MALLOC( NUM_PARAMS * sizeof(double) );
+   (*p).alphas = METRIC_MALLOC( NUM_VARS * sizeof(double) );
+   decodeInto(p, x);
+   return (p);
+}
+
+/*sort order[from .. n-1] by value, largest first*/
+static void sortByValue(int * order, double * value, int from, int n)
+{
+   int i, j, k;
+   for (i=from+1; i < n; ++i)
+   {
+      k = order[i];
+      for (j=i; j > from && value[ order[j-1] ] < value[k]; --j)
+         order[j] = order[j-1];
+      order[j] = k;
+   }
+}
+
+/*objective of the local refinement: minus the fitness, with the search kept inside the bounds*/
+static double refineObjective(int n, double * x)
+{
+   int i;
+   double * y = _REFINE_TRIAL;
+   for (i=0; i < n; ++i)
+   {
+      double lower = (i < NUM_PARAMS) ? REFINE_LOG_MIN : -1.0,
+             upper = (i < NUM_PARAMS) ? REFINE_LOG_MAX : 1.0;
+      y[i] = (x[i] < lower) ? lower : ((x[i] > upper) ? upper : x[i]);
+   }
+   decodeInto(_REFINE, y);
+   double f = fitness((void*)_REFINE);
+   if (f > _REFINE_BEST)
+   {
+      _REFINE_BEST = f;
+      for (i=0; i < n; ++i) _REFINE_X[i] = y[i];
+   }
+   return (-f);
+}
+
+/*
+ * move an individual across the fold nearest to its first steady state (all alphas 1, see foldFind)
+ * into the window where the two states born at the fold coexist with that one, and keep the move
+ * if it raises the fitness. When the fold lies on the far side of the individual's own parameter
+ * value (the usual case: the first state's branch ends there), the window lies between the two,
+ * and points at 1/2, 1/8 and 1/32 of the way back from the fold are tried, in log parameter
+ * @param: individual
+ * @param: its fitness
+ * @ret: the new fitness (never lower)
+*/
+static double foldRefine(Parameters * p, double f)
+{
+   int i, k, t, best = -1, dir = 0, N = (*p).numVars;
+   double fold = 0, gap = 0;
+   if (LAWS || INIT_VALUE == 0) return (f);
+
+   ODEbudget budget;
+   ODEbudgetInit(&budget, EVAL_MAX_RHS_EVALS, EVAL_MAX_STEPS, EVAL_MAX_SECONDS);
+   Parameters * q = (Parameters*)clone((void*)p);
+   for (i=0; i < N; ++i) (*q).alphas[i] = 1.0;
+   double * ss = regularSteadyState(q, INIT_VALUE, &budget);
+
+   ODEsetBudget(&budget);
+   for (k=0; ss && k < (*q).numParams; ++k)
+   {
+      if ((FOLD_PARAM >= 0 && k != FOLD_PARAM) || !((*q).params[k] > 0)) continue;
+      FoldPoint * point = foldFind(N, ss, &(*q).params[k], ODE_FNC, (void*)q, FOLD_ITERATIONS, sqrt(ZERO_MAX_ERROR));
+      if (point && (*point).direction != 0)
+      {
+         double g = log((*point).param / (*q).params[k]);
+         if (best < 0 || fabs(g) < fabs(gap))
+         {
+            best = k;
+            gap = g;
+            fold = log((*point).param);
+            dir = (*point).direction;
+         }
+      }
+      foldFree(point);
+   }
+   ODEsetBudget(0);
+   free(ss);
+   deleteIndividual((void*)q);
+   if (best < 0) return (f);
+
+   q = (Parameters*)clone((void*)p);
+   double width = (dir * gap < 0) ? fabs(gap) : REFINE_STEP;
+   for (t=0; t < FOLD_TRIALS && f < 1.0; ++t)
+   {
+      double x = fold + dir * width / (2.0 * pow(4.0, t));
+      if (x < REFINE_LOG_MIN || x > REFINE_LOG_MAX) continue;
+      (*q).params[best] = exp(x);
+      double g = fitness((void*)q);
+      if (g > f)
+      {
+         f = g;
+         (*p).params[best] = (*q).params[best];
+      }
+   }
+   deleteIndividual((void*)q);
+   return (f);
+}
+
+/*
+ * polish an individual with a few Nelder-Mead iterations and write the best point found back
+ * @param: individual
+ * @param: its fitness
+ * @ret: the new fitness (never lower)
+*/
+static double refine(Parameters * p, double f)
+{
+   if (FOLD_REFINE && (f = foldRefine(p, f)) >= 1.0) return (f);
+   int n = (*p).numParams + (*p).numVars;
+   double fopt;
+   double * x = METRIC_MALLOC(n * sizeof(double));
+   _REFINE_X = METRIC_MALLOC(n * sizeof(double));
+   _REFINE_TRIAL = METRIC_MALLOC(n * sizeof(double));
+   _REFINE = (Parameters*)clone((void*)p);
+   _REFINE_BEST = f;
+
+   encode(p, x);
+   if (AUTO_SCALE)   //the alphas are normalized: a step of REFINE_STEP would swamp the small ones
+   {
+      int i;
+      double * scale = METRIC_MALLOC(n * sizeof(double));
+      for (i=0; i < n; ++i)
+         scale[i] = (i < (*p).numParams) ? 1.0 : fmax(fabs(x[i]), 1.0/sqrt((double)(*p).numVars));
+      NelderMeadScales(scale);
+      NelderMeadSimplexMethod(n, &refineObjective, x, REFINE_STEP, &fopt, MEMETIC_ITERATIONS, 1.0e-12);
+      NelderMeadScales(0);
+      free(scale);
+   }
+   else
+      NelderMeadSimplexMethod(n, &refineObjective, x, REFINE_STEP, &fopt, MEMETIC_ITERATIONS, 1.0e-12);
+
+   METRIC_INC(METRIC_REFINEMENTS);
+   if (_REFINE_BEST > f)
+   {
+      METRIC_INC(METRIC_REFINEMENTS_IMPROVED);
+      decodeInto(p, _REFINE_X);
+      f = _REFINE_BEST;
+   }
+   deleteIndividual((void*)_REFINE);
+   free(_REFINE_X);
+   free(_REFINE_TRIAL);
+   free(x);
+   _REFINE = 0;
+   return (f);
+}
+
+/*memetic step: refine the best MEMETIC_TOP individuals that have a partial score, in parallel*/
+static void refineBest(Population pop, int n, double * f)
+{
+   int i, k, count = 0, improved = 0;
+   int * order = METRIC_MALLOC(n * sizeof(int));
+   for (i=0; i < n; ++i) order[i] = i;
+   sortByValue(order, f, 0, n);
+   while (count < MEMETIC_TOP && count < n && f[ order[count] ] > 0 && f[ order[count] ] < 1.0)
+      ++count;
+
+   #pragma omp parallel for schedule(dynamic) reduction(+:improved)
+   for (k=0; k < count; ++k)
+   {
+      double before = f[ order[k] ];
+      useFidelity(FIDELITY_LEVEL);   //foldRefine integrates before any fitness call
+      f[ order[k] ] = refine((Parameters*)pop[ order[k] ], before);
+      leaveFidelity();
+      if (f[ order[k] ] > before) ++improved;
+   }
+   MEMETIC_GEN_REFINED += count;
+   MEMETIC_GEN_IMPROVED += improved;
+   free(order);
+}
+
+/*
+ * first steady states of a batch (all alphas 1, as in regularSteadyState), computed together by
+ * the ensemble integrator with blocks of lanes in parallel. Individuals rejected by the alpha
+ * screen are left out. The budget of each lane starts when its block does. A system that does
+ * not settle within its budget (usually a stiff one) gets 0 and is left to regularSteadyState
+ * (counted as ensemble_fallbacks); that work is not charged to its evaluation
+ * @param: individuals
+ * @param: number of individuals
+ * @param: receives the steady state of each individual, or 0
+ * @param: receives the work done for each individual
+*/
+static void ensembleSteadyStates(Parameters ** ps, int n, double ** ss0, ODEbudget * cost)
+{
+   int i, k, m = 0, N = (*ps[0]).numVars, L = ODE_ENSEMBLE_LANES;
+   METRIC_TIMER_START(t0);
+   int * index = METRIC_MALLOC(n * sizeof(int));
+   void ** params = METRIC_MALLOC(n * sizeof(void*));
+   ODEbudget ** budgets = METRIC_MALLOC(n * sizeof(ODEbudget*));
+
+   for (i=0; i < n; ++i)
+   {
+      ss0[i] = 0;
+      ODEbudgetInit(&cost[i], 0, 0, 0);
+      if ((SCREEN_MASK & SCREEN_ALPHAS) && screenAlphas(ps[i])) continue;
+      Parameters * p = (Parameters*)clone((void*)ps[i]);
+      for (k=0; k < N; ++k) (*p).alphas[k] = 1.0;
+      index[m] = i;
+      params[m] = (void*)p;
+      budgets[m] = &cost[i];
+      ++m;
+   }
+
+   double * ss = METRIC_MALLOC((m * N + 1) * sizeof(double));
+   int * ok = METRIC_MALLOC((m + 1) * sizeof(int));
+   int blocks = (m + L - 1) / L;
+
+   #pragma omp parallel for schedule(dynamic)
+   for (k=0; k < blocks; ++k)
+   {
+      int l, first = k * L, M = (m - first < L) ? (m - first) : L;
+      for (l=0; l < M; ++l)   //the time limit counts from here
+         ODEbudgetInit(budgets[first + l], EVAL_MAX_RHS_EVALS, EVAL_MAX_STEPS, EVAL_MAX_SECONDS);
+      useFidelity(FIDELITY_LEVEL);   //the tolerances are per thread
+      ODEconservation(LAWS, INIT_VALUE);   //all alphas are 1
+      ensembleSteadyState(M, N, INIT_VALUE, ODE_FNC, params + first, budgets + first,
+                          SS_MIN_ERROR, SS0_MAX_TIME, SS_MIN_DT, ss + first * N, ok + first);
+      ODEconservation(0,0);
+      leaveFidelity();
+   }
+
+   for (k=0; k < m; ++k)
+   {
+      if (ok[k])
+      {
+         ss0[ index[k] ] = METRIC_MALLOC(N * sizeof(double));
+         for (i=0; i < N; ++i) ss0[ index[k] ][i] = ss[k * N + i];
+      }
+      deleteIndividual(params[k]);
+   }
+   free(ss);
+   free(ok);
+   free(index);
+   free(params);
+   free(budgets);
+   METRIC_TIMER_STOP(t0, TIMER_ENSEMBLE_SS);
+}
+
+/*fitness of a batch, evaluated in parallel when compiled with OpenMP*/
+static void parallelFitness(Parameters ** ps, int n, double * f)
+{
+   int k;
+   double ** ss0 = 0;
+   ODEbudget * cost = 0;
+   if (ENSEMBLE && n > 1)
+   {
+      ss0 = METRIC_MALLOC(n * sizeof(double*));
+      cost = METRIC_MALLOC(n * sizeof(ODEbudget));
+      ensembleSteadyStates(ps, n, ss0, cost);
+   }
+
+   #pragma omp parallel for schedule(dynamic)
+   for (k=0; k < n; ++k)
+   {
+      if (ss0)
+      {
+         _SS0 = ss0[k];
+         _SS0_COST = &cost[k];
+      }
+      f[k] = fitness((void*)ps[k]);
+   }
+
+   if (ss0) free(ss0);
+   if (cost) free(cost);
+}
+
+/*
+ * fitness of a GA generation. With the surrogate, rank by the surrogate estimate and fully
+ * evaluate only the top SURROGATE_FRACTION (the first individual, the elite, always gets a
+ * full evaluation); every full evaluation is added to the surrogate. The full evaluations
+ * run in parallel. Then the memetic step refines the best individuals
+*/
+static void fitnessBatch(Population pop, int n, double * f)
+{
+   int i, k;
+   Parameters * p = (Parameters*)pop[0];
+   int dim = (*p).numParams + (*p).numVars;
+   double * x = METRIC_MALLOC(dim * sizeof(double));
+   double * estimate = METRIC_MALLOC(n * sizeof(double));
+   int * order = METRIC_MALLOC(n * sizeof(int));
+   int surrogate = (SURROGATE_FRACTION < 1.0);
+
+   if (surrogate && SURROGATE == 0) SURROGATE = surrogateNew(dim, SURROGATE_CAPACITY);
+   int ready = (surrogate && (*SURROGATE).size >= SURROGATE_MIN_POINTS);
+
+   for (i=0; i < n; ++i)
+   {
+      order[i] = i;
+      estimate[i] = 0.0;
+      if (ready)
+      {
+         encode((Parameters*)pop[i], x);
+         estimate[i] = surrogatePredict(SURROGATE, x, SURROGATE_K);
+      }
+   }
+   if (ready) sortByValue(order, estimate, 1, n);   //best estimates first, keeping the elite in front
+
+   int full = n;
+   if (ready) full = (int)ceil(SURROGATE_FRACTION * n);
+   if (full < 1) full = 1;
+
+   Parameters ** batch = METRIC_MALLOC(full * sizeof(Parameters*));
+   double * fb = METRIC_MALLOC(full * sizeof(double));
+   for (k=0; k < full; ++k) batch[k] = (Parameters*)pop[ order[k] ];
+   parallelFitness(batch, full, fb);
+   for (k=0; k < full; ++k) f[ order[k] ] = fb[k];
+   free(batch);
+   free(fb);
+
+   double best = 0;
+   for (k=0; k < full; ++k)
+   {
+      i = order[k];
+      if (f[i] > best) best = f[i];
+      if (!surrogate) continue;
+      encode((Parameters*)pop[i], x);
+      surrogateAdd(SURROGATE, x, f[i]);
+      if (ready)
+      {
+         METRIC_INC(METRIC_SURROGATE_CHECKED);
+         METRIC_SUM_ADD(SUM_SURROGATE_ERROR, fabs(f[i] - estimate[i]));
+         ++SURROGATE_GEN_CHECKED;
+         SURROGATE_GEN_ERROR += fabs(f[i] - estimate[i]);
+      }
+   }
+   for (k=full; k < n; ++k)   //an estimate never outranks the best full evaluation
+   {
+      i = order[k];
+      f[i] = 0.0;
+      if (SURROGATE_INHERIT)
+         f[i] = (estimate[i] < best) ? estimate[i] : 0.99 * best;
+      METRIC_INC(METRIC_SURROGATE_SKIPPED);
+      ++SURROGATE_GEN_SKIPPED;
+   }
+
+   if (MEMETIC_TOP > 0) refineBest(pop, n, f);
+
+   free(x);
+   free(estimate);
+   free(order);
+}
+
 /*randomly change the values of a parameter array*/
 void * mutate(void * individual)
 {
@@ -424,7 +1364,7 @@ void * crossover(void * individual1, void * individual2)
 /*Allocate memory for a given number of parameter arrays*/
 Parameters ** initPopulation(int sz, int n, int p)
 {
-   Parameters ** pop = malloc(sz * sizeof(void*));
+   Parameters ** pop = METRIC_MALLOC(sz * sizeof(void*));
    int i;
    for (i=0; i < sz; ++i)
    {
@@ -433,22 +1373,51 @@ Parameters ** initPopulation(int sz, int n, int p)
    return pop;
 }
 
-/*Callback function that is called during each GA run*/
-int callbackf(int gen, void ** pop, int popsz)
+/*
+ * report a finished generation and move up the accuracy schedule (used by all engines)
+ * @param: generation
+ * @param: best fitness of the generation
+ * @ret: 1 = a bistable individual was found, 0 = continue
+*/
+static int endOfGeneration(int gen, double x)
 {
-   double x;
-   void * y = pop[0];
-   x = fitness(y);
-
    if (PRINT_STEPS)
    {
        printf("%i  %lf\n", gen, x);
        if (x == 1.0) printf("target reached.\n\n");
    }
+   if (PRINT_STEPS && SURROGATE_GEN_CHECKED > 0)
+       printf("   surrogate: %li evaluations saved, mean error %lf\n",
+              SURROGATE_GEN_SKIPPED, SURROGATE_GEN_ERROR / SURROGATE_GEN_CHECKED);
+   SURROGATE_GEN_CHECKED = SURROGATE_GEN_SKIPPED = 0;
+   SURROGATE_GEN_ERROR = 0;
+   if (PRINT_STEPS && MEMETIC_GEN_REFINED > 0)
+       printf("   refined %li individuals, %li improved\n", MEMETIC_GEN_REFINED, MEMETIC_GEN_IMPROVED);
+   MEMETIC_GEN_REFINED = MEMETIC_GEN_IMPROVED = 0;
+   metricsWrite(METRICS_FILE, gen, x);
    if (x == 1.0) 
    { 
        return (1); 
    }
+   int level = FIDELITY_LEVEL;
+   while (FIDELITY_LEVEL+1 < NUM_FIDELITY && x >= FIDELITY[FIDELITY_LEVEL+1].minFitness)
+       ++FIDELITY_LEVEL;
+   if (PRINT_STEPS && level != FIDELITY_LEVEL)
+       printf("   accuracy level %i\n", FIDELITY_LEVEL);
+   return (0);
+}
+
+/*Callback function that is called during each GA run*/
+int callbackf(int gen, void ** pop, int popsz)
+{
+   if (RUN_DEADLINE > 0 && ODEclock() > RUN_DEADLINE) return (0);  //GArun stops on its own time limit
+
+   double x;
+   void * y = pop[0];
+   x = fitness(y);
+
+   if (endOfGeneration(gen, x))
+       return (1);
 
    if (gen > 0 && (gen % 20) == 0)
    {
@@ -467,121 +1436,506 @@ int callbackf(int gen, void ** pop, int popsz)
    return (0);
 }
 
-static double** findTwoSteadyStates(Parameters * p0)
+/*fitness of a batch of engine candidates, evaluated in parallel when compiled with OpenMP*/
+static void evaluateBatch(int n, int dim, double * X, double * f)
 {
-   double * iv = unstableSteadyState(p0,INIT_VALUE);
+   int i;
+   Parameters ** batch = METRIC_MALLOC(n * sizeof(Parameters*));
+   for (i=0; i < n; ++i) batch[i] = decode(X + i * dim);
+   parallelFitness(batch, n, f);
+   for (i=0; i < n; ++i) deleteIndividual((void*)batch[i]);
+   free(batch);
+}
 
-   if (!iv) return 0;
+/*Callback function that is called after each generation of the CMA-ES and DE engines*/
+static int engineCallback(int gen, int dim, double * best, double x)
+{
+   if (RUN_DEADLINE > 0 && ODEclock() > RUN_DEADLINE) return (1);
+   return endOfGeneration(gen, x);
+}
 
-   Parameters * p = clone((void*)p0);
-   int i,j;
-   for (i=0; i < (*p).numVars; ++i) (*p).alphas[i] = 1.0;
+/*
+ * run the CMA-ES or DE engine with the same number of evaluations the GA would use
+ * @ret: best individual
+*/
+static Parameters * runEngine(int maxIter, int popSz)
+{
+   int i, dim = NUM_PARAMS + NUM_VARS;
+   int maxEvals = popSz + maxIter * (popSz/5);
+   double * lower = METRIC_MALLOC(dim * sizeof(double)),
+          * upper = METRIC_MALLOC(dim * sizeof(double)),
+          * best = METRIC_MALLOC(dim * sizeof(double));
 
-   double * iv2 = malloc( (*p).numVars * sizeof(double) ); //unstable point
-   for (i=0; i < (*p).numVars; ++i) iv2[i] = iv[i];
+   for (i=0; i < NUM_PARAMS; ++i)   //the range of randomNetwork, on a log scale
+   {
+      lower[i] = log(0.05);
+      upper[i] = log(10.0);
+   }
+   for (i=NUM_PARAMS; i < dim; ++i)
+   {
+      lower[i] = -1.0;
+      upper[i] = 1.0;
+   }
 
-   double * y = 0, * y0 = 0; //y0 and y are the two steady states (if they exist)
+   if (ENGINE == BISTABLE_ENGINE_DE)
+      DErun(dim, lower, upper, popSz/5, 0.5, 0.9, maxEvals, &evaluateBatch, &engineCallback, best);
+   else
+      CMAESrun(dim, lower, upper, 0, maxEvals, &evaluateBatch, &engineCallback, best);
 
-   for (i=0; i < 100; ++i)
-   {
-      for (j=0; j < (*p).numVars; ++j)
-           iv2[j] = iv[j] + 10.0*randnum - 5.0;  //random perturbation
+   Parameters * p = decode(best);
+   free(lower);
+   free(upper);
+   free(best);
+   return (p);
+}
 
-      //y = steadyState((*p).numVars,iv2, ODE_FNC, p,SS_MIN_ERROR,SS_MAX_TIME,SS_MIN_DT); //steady state
-      double fopt;
-      y = 0;
-      _DU = malloc( ((*p).numVars) * sizeof(double));
-      _PARAM = p;
-      for (j=0; j < (*p).numVars; ++j)
+/*
+ * 1 if a simulation started next to a zero returns to it, i.e. the zero is stable
+ * @param: individual
+ * @param: the zero
+ * @param: budget
+*/
+static int returnsTo(Parameters * p, double * y, ODEbudget * budget)
+{
+   int j, N = (*p).numVars;
+   double * iv = METRIC_MALLOC(N*sizeof(double));  //a small step away from the zero
+   for (j=0; j < N; ++j) iv[j] = y[j] + 1.0e-3*(1.0 + fabs(y[j]));
+   double * ss = unstableSteadyState(p,iv,budget);
+   int stable = (ss != 0 && distance(ss,y,N) <= MIN_ERROR);
+   if (ss) free(ss);
+   free(iv);
+   return stable;
+}
+
+/*
+ * the second stable state of the unmodified system (all alphas 1): a new zero that a simulation
+ * started next to it returns to. Newton runs from SECOND_STATE_STARTS random points around the
+ * saddle, in parallel when compiled with OpenMP, each deflating the two known zeros only. Each
+ * start draws from its own random stream, has its own budget and keeps its own result, and the
+ * stable zero of the first start that finds one is returned, so the result does not depend on the
+ * number of threads; starts after that one are skipped. The points are spread over 5 times the
+ * magnitude of each variable at the saddle (or its scale, see setBistableScales, if larger)
+ * @param: individual
+ * @param: stable state
+ * @param: unstable state
+ * @ret: the second stable state, or 0
+*/
+static double * findSecondStableState(Parameters * p0, double * stable, double * unstable)
+{
+   int i, k, N = (*p0).numVars, first = SECOND_STATE_STARTS;   //first start with a stable zero
+   double * known[2] = { stable, unstable };
+   double ** found = METRIC_CALLOC(SECOND_STATE_STARTS, sizeof(double*));   //stable zero of each start
+   unsigned long long seed = genrand64_int64();
+
+   Parameters * p = clone((void*)p0);
+   for (i=0; i < N; ++i) (*p).alphas[i] = 1.0;
+
+   #pragma omp parallel for schedule(dynamic)
+   for (k=0; k < SECOND_STATE_STARTS; ++k)
+   {
+      int j, skip;
+      #pragma omp critical (zeros)
+      skip = (k > first);   //an earlier start has the answer already
+      if (skip) continue;
+
+      useFidelity(NUM_FIDELITY-1);   //the tolerances are per thread
+      conserve(p);                   //all alphas are 1
+      unsigned long long stream = seed + (unsigned long long)k;
+      double fmin, * x = METRIC_MALLOC(N*sizeof(double));
+      for (j=0; j < N; ++j)
       {
-          _U0[j] = _U[j] = INIT_VALUE[j];
+         double size = fabs(unstable[j]);
+         if (NUM_SCALES == N && fabs(SCALES[j]) > size) size = fabs(SCALES[j]);
+         if (size == 0) size = 1.0;
+         x[j] = unstable[j] + size*(10.0*splitmixrand(&stream) - 5.0);  //random perturbation
       }
-      if (NelderMeadSimplexMethod((*p).numVars, &(FMIN), _U, 1.00, &fopt, 1000.0, 1.0e-10) == success)
+
+      ODEbudget budget;
+      ODEbudgetInit(&budget, EVAL_MAX_RHS_EVALS, EVAL_MAX_STEPS, EVAL_MAX_SECONDS);
+      ODEsetBudget(&budget);
+      int ok = deflatedNewton(N,x,ODE_FNC,(void*)p,known,2,ZERO_MAX_ERROR,ZERO_MAX_ITER,&fmin);
+      ODEsetBudget(0);
+
+      ok = ok && distance(x,stable,N) >= MIN_ERROR && distance(x,unstable,N) >= MIN_ERROR && returnsTo(p,x,&budget);
+      conserve(0);
+      leaveFidelity();
+      if (ok)
       {
-          if (fopt < 1.0e-5)
-              y = _DU;
-          else
-              free(_DU);
+         found[k] = x;
+         #pragma omp critical (zeros)
+         if (k < first) first = k;
       }
       else
-          free(_DU);
+         free(x);
+   }
+
+   double * y = (first < SECOND_STATE_STARTS) ? found[first] : 0;
+   for (k=0; k < SECOND_STATE_STARTS; ++k)
+      if (k != first) free(found[k]);
+   free(found);
+   deleteIndividual((void*)p);
+   return y;
+}
+
+/*
+ * steady state of the best individual of a run that was stopped early and, when the Newton
+ * search finds a second zero that a simulation started next to it leaves (all alphas 1), that
+ * unstable state. A zero that is stable or could not be checked within the budget is dropped
+*/
+static void bestSoFarStates(Parameters * p0, BistablePoint * ans)
+{
+   int i;
+   double fmin, seconds = evalSeconds();   //within the grace period of the run
+   if (seconds < 0) return;
+   ODEbudget budget;
+   ODEbudgetInit(&budget, EVAL_MAX_RHS_EVALS, EVAL_MAX_STEPS, seconds);
+
+   double * ss0 = regularSteadyState(p0,INIT_VALUE,&budget);
+   if (ss0 == 0) return;
+   (*ans).stable1 = ss0;
+
+   double * ss1 = findZeros(p0,&ss0,1,&fmin,&budget);   //0 unless Newton converged
+   if (ss1 == 0) return;
+
+   Parameters * p = clone((void*)p0);
+   for (i=0; i < (*p).numVars; ++i) (*p).alphas[i] = 1.0;
+   if (!returnsTo(p,ss1,&budget) && !budget.exhausted)
+      (*ans).unstable = ss1;
+   else
+      free(ss1);
+   deleteIndividual((void*)p);
+}
+
+void setBistableMetricsFile(const char * filename)
+{
+   if (METRICS_FILE) fclose(METRICS_FILE);
+   METRICS_FILE = 0;
+   if (filename) METRICS_FILE = fopen(filename, "w");
+}
+
+void setBistableFidelity(int n, FidelityLevel * levels)
+{
+   int i;
+   if (n < 1 || levels == 0) return;
+   if (n > MAX_FIDELITY_LEVELS) n = MAX_FIDELITY_LEVELS;
+   for (i=0; i < n; ++i) FIDELITY[i] = levels[i];
+   NUM_FIDELITY = n;
+   FIDELITY_DEFAULT = 0;
+}
+
+void setBistableMemetic(int top, int iterations)
+{
+   MEMETIC_TOP = (top > 0) ? top : 0;
+   if (iterations > 0) MEMETIC_ITERATIONS = iterations;
+}
+
+void setBistableFoldRefinement(int on, int param)
+{
+   FOLD_REFINE = (on != 0);
+   FOLD_PARAM = (param >= 0) ? param : -1;
+}
+
+void setBistableIntegrator(int method)
+{
+   INTEGRATOR = method;
+}
+
+void setBistableEnsemble(int on)
+{
+   ENSEMBLE = on;
+}
+
+void setBistableScales(int n, double * scales)
+{
+   int i;
+   if (SCALES) free(SCALES);
+   SCALES = 0;
+   NUM_SCALES = 0;
+   if (scales == 0 || n < 1) return;
+   SCALES = METRIC_MALLOC(n * sizeof(double));
+   for (i=0; i < n; ++i) SCALES[i] = scales[i];
+   NUM_SCALES = n;
+}
+
+void setBistableAutoScale(int on)
+{
+   AUTO_SCALE = on;
+}
+
+void setBistableStoichiometry(int n, int r, double * S)
+{
+   int i;
+   if (STOICHIOMETRY) free(STOICHIOMETRY);
+   STOICHIOMETRY = 0;
+   STOICHIOMETRY_VARS = NUM_REACTIONS = 0;
+   if (S == 0 || n < 1 || r < 0) return;
+   STOICHIOMETRY = METRIC_MALLOC((n * r + 1) * sizeof(double));
+   for (i=0; i < n*r; ++i) STOICHIOMETRY[i] = S[i];
+   STOICHIOMETRY_VARS = n;
+   NUM_REACTIONS = r;
+}
+
+void setBistableSparse(int n, int * rowptr, int * colind)
+{
+   int i;
+   if (SPARSE_ROWPTR) free(SPARSE_ROWPTR);
+   if (SPARSE_COLIND) free(SPARSE_COLIND);
+   SPARSE_ROWPTR = SPARSE_COLIND = 0;
+   SPARSE_VARS = (n > 0) ? n : 0;
+   if (SPARSE_VARS == 0 || rowptr == 0 || colind == 0) return;
+   SPARSE_ROWPTR = METRIC_MALLOC((n+1) * sizeof(int));
+   SPARSE_COLIND = METRIC_MALLOC((rowptr[n] + 1) * sizeof(int));
+   for (i=0; i <= n; ++i) SPARSE_ROWPTR[i] = rowptr[i];
+   for (i=0; i < rowptr[n]; ++i) SPARSE_COLIND[i] = colind[i];
+}
 
-      if (y)
+/*
+ * the Jacobian pattern of a run: the declared one, or the union of the patterns of a few random
+ * individuals at INIT_VALUE and at a random point near it
+*/
+static SparseMatrix * sparsityPattern(int n, int p)
+{
+   int i, k, j;
+   SparseMatrix * pattern = 0, * next;
+   if (SPARSE_VARS != n) return (0);
+   if (SPARSE_ROWPTR) return sparseNew(n, SPARSE_ROWPTR, SPARSE_COLIND);
+
+   double * x = METRIC_MALLOC(n * sizeof(double));
+   for (k=0; k < SPARSE_PROBES; ++k)
+   {
+      Parameters * q = randomNetwork(n,p);
+      for (j=0; j < 2; ++j)
       {
-          for (j=0; j < (*p).numVars; ++j)
-               if (y[j]==iv2[j])
-                   y[j] = 0.0;
-          if (y0)  //first steady state exists
-          {
-             double diff = 0;  //difference between second steady state
-             for (j=0; j < (*p).numVars; ++j)
-                  diff += (y[j] - y0[j])*(y[j] - y0[j]);
-
-             if (diff > MIN_ERROR) //significantly different
-             {
-                 deleteIndividual((void*)p);
-                 double ** ys = malloc(3 * sizeof(double*));
-                 ys[0] = iv;
-                 ys[1] = y0;
-                 ys[2] = y;
-                 free(iv2);
-                 return ys;  //found two different steady states
-             }
-             free(y);
-          }
-          else  //first steady state does not exist
-          {
-             y0 = y;
-          }
+         for (i=0; i < n; ++i)
+            x[i] = (j == 0) ? INIT_VALUE[i] : INIT_VALUE[i] * (0.5 + randnum) + 0.1 * randnum;
+         next = ODEsparsityProbe(n, x, ODE_FNC, (void*)q, pattern);
+         sparseFree(pattern);
+         pattern = next;
       }
+      deleteIndividual(q);
    }
-   free(iv);
-   free(iv2);
-   deleteIndividual((void*)p);
-   free(y);
-   free(y0);
-   return 0;
+   free(x);
+   return (pattern);
+}
+
+void setBistableDifferences(int differences)
+{
+   DIFFERENCES = differences;
+}
+
+void setBistableBatch(ODEbatchFunction batch)
+{
+   BATCH_FNC = batch;
+}
+
+void setBistableNetwork(int n, int r, double * reactants, double * products)
+{
+   int i;
+   if (NETWORK_REACTANTS) free(NETWORK_REACTANTS);
+   if (NETWORK_PRODUCTS) free(NETWORK_PRODUCTS);
+   NETWORK_REACTANTS = NETWORK_PRODUCTS = 0;
+   NETWORK_VARS = NETWORK_REACTIONS = 0;
+   if (reactants == 0 || products == 0 || n < 1 || r < 1) return;
+   NETWORK_REACTANTS = METRIC_MALLOC(n * r * sizeof(double));
+   NETWORK_PRODUCTS = METRIC_MALLOC(n * r * sizeof(double));
+   for (i=0; i < n*r; ++i)
+   {
+      NETWORK_REACTANTS[i] = reactants[i];
+      NETWORK_PRODUCTS[i] = products[i];
+   }
+   NETWORK_VARS = n;
+   NETWORK_REACTIONS = r;
+}
+
+void setBistablePolynomial(PolynomialSystem * sys)
+{
+   POLYNOMIAL = (sys && (*sys).numPaths <= HOMOTOPY_MAX_PATHS) ? sys : 0;
+}
+
+void setBistableNullclines(int grid, double * lower, double * upper)
+{
+   NULLCLINE_GRID = 0;
+   if (grid < 1 || lower == 0 || upper == 0 || !(upper[0] > lower[0]) || !(upper[1] > lower[1])) return;
+   NULLCLINE_GRID = grid;
+   NULLCLINE_LOWER[0] = lower[0];
+   NULLCLINE_LOWER[1] = lower[1];
+   NULLCLINE_UPPER[0] = upper[0];
+   NULLCLINE_UPPER[1] = upper[1];
+}
+
+void setBistableEngine(int engine)
+{
+   ENGINE = engine;
+}
+
+void setBistableSurrogate(double fraction, int inherit)
+{
+   if (fraction <= 0 || fraction > 1) fraction = 1.0;
+   SURROGATE_FRACTION = fraction;
+   SURROGATE_INHERIT = inherit;
+}
+
+void setBistableScreens(int screens)
+{
+   SCREEN_MASK = screens;
+}
+
+void setBistableEventLog(const char * filename)
+{
+   if (EVENT_LOG) fclose(EVENT_LOG);
+   EVENT_LOG = 0;
+   if (filename) EVENT_LOG = fopen(filename, "wb");
+   metricsEventLog(EVENT_LOG);
+}
+
+void setBistableTimeLimit(double seconds)
+{
+   RUN_MAX_SECONDS = seconds;
+}
+
+void setBistableBudget(long maxRHSEvals, long maxSteps, double seconds)
+{
+   EVAL_MAX_RHS_EVALS = maxRHSEvals;
+   EVAL_MAX_STEPS = maxSteps;
+   EVAL_MAX_SECONDS = seconds;
 }
 
 BistablePoint makeBistable(int n, int p,double* iv, int maxIter, int popSz, void (*odefnc)(double,double*,double*,void*))
 {
    //ODEflags(1);
-   _U0 = malloc( n * sizeof(double));
-   _U = malloc( n * sizeof(double));
    ODE_FNC = odefnc;
+   NUM_VARS = n;
+   NUM_PARAMS = p;
    int popsz1 = popSz/5;
    INIT_VALUE = iv;
-
-   Population pop = 
-      GArun((void**)initPopulation(popSz,n,p),popSz,popsz1,maxIter,&fitness,&crossover,&mutate, &callbackf);
-   Parameters * param = pop[0];
-   int i;
-   for (i=1; i < popsz1; ++i) deleteIndividual(pop[i]);
-   free(pop);
+   ODEgetTolerance(&CALLER_RELTOL, &CALLER_ABSTOL);
+   CALLER_METHOD = ODEgetMethod();
+   if (FIDELITY_DEFAULT)   //the final accuracy is the caller's
+   {
+      FIDELITY[NUM_FIDELITY-1].relTol = CALLER_RELTOL;
+      FIDELITY[NUM_FIDELITY-1].absTol = CALLER_ABSTOL;
+   }
 
    BistablePoint ans;
    ans.param = 0;
    ans.unstable = ans.stable1 = ans.stable2 = 0;
+   ans.fitness = 0;
+   ans.timedOut = ans.ruledOut = 0;
+   if (NETWORK_VARS == n)   //no search for a network whose structure rules out two steady states
+   {
+      ReactionNetwork * net = networkAnalyze(n, NETWORK_REACTIONS, NETWORK_REACTANTS, NETWORK_PRODUCTS);
+      if (PRINT_STEPS) networkPrint(stdout, net);
+      ans.ruledOut = (net && (*net).verdict != NETWORK_UNKNOWN);
+      networkFree(net);
+      if (ans.ruledOut) return ans;
+   }
 
-   if (fitness((void*)param) < 1)
+   conservationFree(LAWS);
+   LAWS = (STOICHIOMETRY_VARS == n) ? conservationLaws(n, NUM_REACTIONS, STOICHIOMETRY) : 0;
+   if (PRINT_STEPS && LAWS)
+      printf("%i conservation laws: integrating %i of %i variables\n", (*LAWS).numLaws, n - (*LAWS).numLaws, n);
+   ODEsparsity(0);
+   sparseFree(PATTERN);
+   PATTERN = sparsityPattern(n,p);
+   if (PRINT_STEPS && PATTERN)
+      printf("sparse Jacobian: %i of %i entries\n", (*PATTERN).nnz, n*n);
+
+   FIDELITY_LEVEL = 0;
+   metricsStageNames(EXIT_NAMES, EXIT_STAGES);
+   metricsReset();
+   GAsetTimeLimit(RUN_MAX_SECONDS);
+   surrogateFree(SURROGATE);
+   SURROGATE = 0;
+   SURROGATE_GEN_CHECKED = SURROGATE_GEN_SKIPPED = 0;
+   SURROGATE_GEN_ERROR = 0;
+   MEMETIC_GEN_REFINED = MEMETIC_GEN_IMPROVED = 0;
+   GAsetBatchFitness( (SURROGATE_FRACTION < 1.0 || MEMETIC_TOP > 0 || ENSEMBLE) ? &fitnessBatch : 0 );
+   RUN_DEADLINE = 0;
+   if (RUN_MAX_SECONDS > 0) RUN_DEADLINE = ODEclock() + RUN_MAX_SECONDS;
+
+   Parameters * param = 0;
+   int i, timedOut;
+   if (ENGINE == BISTABLE_ENGINE_GA)
    {
-       deleteIndividual(param);
+      Population pop = 
+         GArun((void**)initPopulation(popSz,n,p),popSz,popsz1,maxIter,&fitness,&crossover,&mutate, &callbackf);
+      param = pop[0];
+      for (i=1; i < popsz1; ++i) deleteIndividual(pop[i]);
+      free(pop);
+      timedOut = GAtimedOut();
+   }
+   else
+   {
+      param = runEngine(maxIter,popSz);
+      timedOut = (RUN_DEADLINE > 0 && ODEclock() > RUN_DEADLINE);
+   }
+   //what follows is limited by the per-evaluation budget and, after a time-out, by a short grace period
+   RUN_DEADLINE = timedOut ? ODEclock() + TIMEOUT_GRACE_SECONDS : 0;
+   GAsetBatchFitness(0);
+   surrogateFree(SURROGATE);
+   SURROGATE = 0;
+   FIDELITY_LEVEL = NUM_FIDELITY-1;
+   useFidelity(FIDELITY_LEVEL);
+   if (METRICS_FILE || EVENT_LOG) metricsFunnelTable(stdout);   //only when metrics were asked for
+
+   ans.timedOut = timedOut;
+   if (STABLE_PT) free(STABLE_PT);   //keep the states of param, not of the first bistable individual
+   if (UNSTABLE_PT) free(UNSTABLE_PT);
+   if (SECOND_PT) free(SECOND_PT);
+   STABLE_PT = UNSTABLE_PT = SECOND_PT = 0;
+   ans.fitness = fitness((void*)param);
+
+   if (ans.fitness < 1)
+   {
+       if (ans.timedOut)  //anytime result: the best individual so far
+       {
+           ans.param = param;
+           bestSoFarStates(param,&ans);
+       }
+       else
+           deleteIndividual(param);
+       RUN_DEADLINE = 0;
+       deleteBadParams();
+       restoreCaller();
        return ans;
    }
 
    ans.param = param;
    ans.unstable = ans.stable1 = ans.stable2 = 0;
 
-   //double ** ys = findTwoSteadyStates(param);
-   // if (ys)
    if (UNSTABLE_PT)
        ans.unstable = UNSTABLE_PT;
 
    if (STABLE_PT)
        ans.stable1 = STABLE_PT;
 
-   free(_U0);
-   free(_U);
+   if (SECOND_PT)
+       ans.stable2 = SECOND_PT;
+   else
+   if (STABLE_PT && UNSTABLE_PT && !timedOut)   //the search of many starts does not fit the grace period
+       ans.stable2 = findSecondStableState(param,STABLE_PT,UNSTABLE_PT);
+   STABLE_PT = UNSTABLE_PT = SECOND_PT = 0;   //owned by ans
+
+   RUN_DEADLINE = 0;
    deleteBadParams();
+   restoreCaller();
    return ans;
 }
+
+Branch * bistableBranch(BistablePoint * bis, void (*odefnc)(double,double*,double*,void*), int param, double factor, int maxPoints)
+{
+   int i;
+   if (bis == 0 || (*bis).param == 0 || (*bis).stable1 == 0 || odefnc == 0 || !(factor > 1.0)) return (0);
+   Parameters * p = (Parameters*)clone((void*)(*bis).param);
+   if (param < 0 || param >= (*p).numParams || !((*p).params[param] > 0))
+   {
+      deleteIndividual((void*)p);
+      return (0);
+   }
+   for (i=0; i < (*p).numVars; ++i) (*p).alphas[i] = 1.0;
+   double value = (*p).params[param];
+   Branch * branch = continuation((*p).numVars, (*bis).stable1, &(*p).params[param], odefnc, (void*)p,
+                                  value / factor, value * factor, maxPoints);
+   deleteIndividual((void*)p);
+   return (branch);
+}
@@ -5,6 +5,10 @@
 #include <stdio.h>
 #include <math.h>
 #include "cvodesim.h"
+#include "homotopy.h"
+#include "fold.h"
+#include "continuation.h"
+#include "nullcline.h"
 #include "mtrand.h"
 #include "ga.h"
 
@@ -25,10 +29,31 @@ typedef struct
    double * unstable;  //the unstable point
    double * stable1;  //first stable point
    double * stable2;  //second stable point
+   double fitness;    //fitness of param (1 = bistable)
+   int timedOut;      //1 if the run was stopped by its time limit (param is then the best so far)
+   int ruledOut;      //1 if the structure of the network rules out bistability (no search was run; see setBistableNetwork)
 } BistablePoint;
 
+/*integration accuracy for one stage of a run (see setBistableFidelity)*/
+typedef struct
+{
+   double relTol;      //CVODE relative tolerance
+   double absTol;      //CVODE absolute tolerance
+   double maxTime;     //longest simulation used to reach the first steady state
+   double minFitness;  //best fitness at which the run moves up to this level
+} FidelityLevel;
+
 #define randnum (mtrand() * 1.0)
 
+/*optimizers that makeBistable can use (see setBistableEngine)*/
+#define BISTABLE_ENGINE_GA     0   //genetic algorithm (ga.c)
+#define BISTABLE_ENGINE_CMAES  1   //CMA-ES with restarts (es.c)
+#define BISTABLE_ENGINE_DE     2   //differential evolution, DE/rand/1/bin (es.c)
+
+/*pre-screens that reject an individual before any integration (see setBistableScreens)*/
+#define SCREEN_ALPHAS       1   //all alphas non-negative
+#define SCREEN_FINITE       2   //ode function not finite at the initial values
+
 /*
  * Find the parameters that forces the system to have two or more steady states
  * @param: number of variables
@@ -41,6 +66,272 @@ typedef struct
  */
 BistablePoint makeBistable(int n, int p,double* iv, int maxiter, int popsz, void (*odefnc)(double,double*,double*,void*));
 
+/*
+ * The bifurcation diagram of a result of makeBistable in one parameter: the branch of steady
+ * states through its first stable state (all alphas 1), traced by continuation (see continuation.h)
+ * over [p/factor, p*factor]. The branch of a bistable result usually runs through the unstable
+ * state and the second stable state as well, with a fold on each side of the bistable range, so
+ * two CONTINUATION_FOLD rows confirm the hysteresis and give its width, for a few hundred
+ * Jacobians instead of a sweep of integrations
+ * @param: result of makeBistable
+ * @param: the ode function given to makeBistable
+ * @param: index of the parameter (its value must be positive)
+ * @param: the parameter ranges over its value divided and multiplied by this (more than 1)
+ * @param: maximum number of points each way
+ * @ret: the branch (free it with branchFree), or 0
+ */
+Branch * bistableBranch(BistablePoint * bis, void (*odefnc)(double,double*,double*,void*), int param, double factor, int maxPoints);
+
+/*
+ * Limit the cost of a single fitness evaluation. An evaluation that crosses any
+ * of the limits is stopped and scores 0. A limit of zero means no limit.
+ * The defaults are 200000 ode function calls, 20000 steps and no time limit. A time limit
+ * makes the scores depend on the machine and its load, so a run is then not repeatable
+ * with the same seed
+ * @param: maximum number of ode function calls
+ * @param: maximum number of internal CVODE steps
+ * @param: maximum wall-clock seconds (default 0)
+ */
+void setBistableBudget(long maxRHSEvals, long maxSteps, double seconds);
+
+/*
+ * Choose the pre-screens that run before any integration. Enabled screens run cheapest first
+ * @param: SCREEN_* flags (default SCREEN_ALPHAS | SCREEN_FINITE)
+ */
+void setBistableScreens(int screens);
+
+/*
+ * Set the accuracy schedule. A run starts at the first level and moves up a level once the
+ * best fitness of a generation reaches that level's minFitness; it never moves down.
+ * Any fitness of 1 found below the last level is evaluated again at the last level, and
+ * only that result counts. maxTime only shortens the search for the first steady state:
+ * the check that the second zero is not stable treats a simulation that does not settle
+ * as a rejection, so it always uses the full time. Cutting maxTime below the time the
+ * system needs to settle costs far more in missed steady states than it saves, so the
+ * default levels only change the tolerances:
+ *    relTol 1e-3, absTol 1e-4, maxTime 1000   from the start
+ *    relTol 1e-4, absTol 1e-5, maxTime 1000   once the best fitness reaches 0.25
+ *    the tolerances of the calling thread (see ODEtolerance; relTol 0 and absTol 1e-5 unless set),
+ *    maxTime 1000, once the best fitness reaches 0.45
+ * makeBistable gives the calling thread back its tolerances and integrator when it returns
+ * @param: number of levels (1 to 8)
+ * @param: levels, from lowest to highest accuracy
+ */
+void setBistableFidelity(int n, FidelityLevel * levels);
+
+/*
+ * Memetic step for the GA: after each generation is evaluated, the best individuals with
+ * a partial score are polished by a few Nelder-Mead iterations over the log parameters and
+ * the alphas (in parallel when compiled with OpenMP). The best point found replaces the
+ * individual. Each iteration costs one or two fitness evaluations, plus one per parameter
+ * and variable to set up the simplex. The partial score levels off near 0.5 once the Newton
+ * search gets close to a second zero, so refinement mostly moves individuals onto that plateau and
+ * makes the population less diverse; keep it light (one or two individuals, a few iterations)
+ * @param: number of individuals refined per generation (0 = off, the default)
+ * @param: Nelder-Mead iterations per individual (default 10)
+ */
+void setBistableMemetic(int top, int iterations);
+
+/*
+ * Fold refinement for the memetic step: before its Nelder-Mead iterations, each individual picked
+ * (see setBistableMemetic) is moved across the fold (saddle-node bifurcation) nearest to its first
+ * steady state, found by foldFind from that state with each parameter free in turn, into the
+ * window past the fold where a second pair of states exists. A near miss usually sits next to
+ * such a window, and the fold solver reaches it in a few dozen Newton steps where the search
+ * would need many evaluations. The move is kept when it raises the fitness, and an individual
+ * that becomes bistable skips the Nelder-Mead iterations. Each refinement costs up to
+ * 3 fitness evaluations plus the fold searches. Not used with conservation laws (see setBistableStoichiometry)
+ * @param: 1 = on, 0 = off (default)
+ * @param: index of the free parameter, or -1 to try each one and use the nearest fold (default)
+ */
+void setBistableFoldRefinement(int on, int param);
+
+/*
+ * Choose the optimizer used by makeBistable. CMA-ES and DE search the log of the parameters
+ * and the alphas directly, with the same number of fitness evaluations the GA would use
+ * (popsz + maxiter * popsz/5). Each of their generations is evaluated as one batch, in
+ * parallel when compiled with OpenMP (-fopenmp); the ode function must then be thread-safe.
+ * The surrogate (setBistableSurrogate) and the memetic step (setBistableMemetic) only apply to the GA
+ * @param: BISTABLE_ENGINE_GA (default), BISTABLE_ENGINE_CMAES or BISTABLE_ENGINE_DE
+ */
+void setBistableEngine(int engine);
+
+/*
+ * Choose the integrator of every simulation in a run (see ODEmethod in cvodesim.h). The
+ * setting is applied in each thread that evaluates individuals
+ * @param: ODE_CVODE (default), ODE_AUTO (Adams/BDF switching, counted as adams_steps and
+ *         method_switches in the metrics file) or ODE_ROSENBROCK (used for systems of up to ODE_SMALL_MAX variables)
+ */
+void setBistableIntegrator(int method);
+
+/*
+ * Compute the first steady state of every individual of a generation together, before the
+ * evaluations, with the ensemble integrator (ensembleSteadyState in cvodesim.h) instead of one
+ * CVODE run each. It pays off for small systems, where CVODE spends most of its time on overhead.
+ * The individuals are advanced in lanes of ODE_ENSEMBLE_LANES; compile with -O3 -march=native
+ * -fopenmp-simd (or -fopenmp) for the step arithmetic across the lanes to use vector instructions.
+ * The integrator is explicit: an individual that does not settle within the per-evaluation
+ * budget (see setBistableBudget), usually a stiff one, is integrated the usual way (see setBistableIntegrator).
+ * Applies to the GA and to the CMA-ES and DE engines
+ * @param: 1 = on, 0 = off (default)
+ */
+void setBistableEnsemble(int on);
+
+/*
+ * Give each variable its own absolute tolerance: the absTol of the accuracy level (see
+ * setBistableFidelity) times the variable's characteristic magnitude. Variables far below
+ * 1 are then resolved instead of lost in the tolerance, and those far above 1 stop forcing
+ * small steps. Scales below 1e-3 of the largest one are raised to that
+ * @param: number of variables (the scales are ignored for a system of another size)
+ * @param: magnitude of each variable, or 0 to use one tolerance for all (the default)
+ */
+void setBistableScales(int n, double * scales);
+
+/*
+ * Estimate the magnitudes for setBistableScales in every evaluation: the largest of the
+ * initial value, the first steady state and the given scale, if any. The first steady state
+ * is found with the tolerances in effect before it; the later stages use the scaled ones.
+ * The memetic step (setBistableMemetic) also sizes its initial simplex by the magnitude of each alpha
+ * @param: 1 = on, 0 = off (default)
+ */
+void setBistableAutoScale(int on);
+
+/*
+ * Give the stoichiometry of the network so that its conservation laws (weighted sums of the
+ * variables that no reaction changes) are found with an SVD and each one removes a variable:
+ * the first steady state, the search for zeros and the stability checks then work on the
+ * independent variables only, on the conservation class of the initial values, which also
+ * removes the zero eigenvalues the laws put in the Jacobian. The stability check is only
+ * reduced when all alphas are equal, since other alphas break the laws. The ode function must
+ * be S times the reaction rates (scaled by the alphas)
+ * @param: number of variables (the matrix is ignored for a system of another size)
+ * @param: number of reactions
+ * @param: stoichiometry matrix, variables x reactions, row by row, or 0 for none (the default)
+ */
+void setBistableStoichiometry(int n, int r, double * S);
+
+/*
+ * Use a sparse Jacobian for large networks, where each variable takes part in a few reactions:
+ * every BDF integration and every Newton search of a run then works with a sparse LU
+ * factorization instead of a dense one (see ODEsparsity in cvodesim.h), which costs time in
+ * proportion to the nonzeros instead of n^3. The pattern is the declared one or, if none is
+ * given, the union of the patterns found by perturbing each variable of a few random individuals
+ * at the initial values and near them. A probed pattern can miss an entry that vanishes at all of
+ * those points; that only slows the convergence of CVODE and Newton, but declare the pattern when
+ * it is known. Worthwhile from a few dozen variables on; the dense path is faster for small systems.
+ * Reduced systems (see setBistableStoichiometry) stay dense
+ * @param: number of variables (ignored for a system of another size), or 0 for dense (the default)
+ * @param: n+1 offsets of the rows of the pattern in colind (0 = probe the pattern)
+ * @param: column of each entry, row by row
+ */
+void setBistableSparse(int n, int * rowptr, int * colind);
+
+/*
+ * Choose the finite differences of the Jacobians used by the stability checks and the Newton search
+ * (see ODEdifferences in cvodesim.h). With a sparse pattern (setBistableSparse) a Jacobian costs
+ * one or two ode function calls per group of columns that share no row, instead of per variable
+ * @param: ODE_CENTRAL (default) or ODE_FORWARD (half the calls, less accurate)
+ */
+void setBistableDifferences(int differences);
+
+/*
+ * Give the batch form of the ode function passed to makeBistable (see ODEbatchFunction in
+ * cvodesim.h): the columns of the Jacobians and the lanes of the ensemble integrator
+ * (setBistableEnsemble) are then evaluated several points per call. The parameters of
+ * each point are a Parameters*, as for the ode function
+ * @param: batch function, or 0 for one point per call (the default)
+ */
+void setBistableBatch(ODEbatchFunction batch);
+
+/*
+ * Describe the ode as a mass-action reaction network, so that makeBistable first checks its
+ * structure (see crnt.h): when the deficiency zero or deficiency one theorem shows that it has
+ * at most one positive steady state in each stoichiometric class, for any rate constants, no
+ * search is run and makeBistable returns at once with ruledOut set and fitness 0. The alphas
+ * only scale the derivatives, so they do not change the steady states. The test only speaks
+ * for positive steady states of mass-action kinetics; networks it does not settle are searched
+ * as usual. The stoichiometry for setBistableStoichiometry is products - reactants
+ * @param: number of species (the network is ignored for a system of another size)
+ * @param: number of reactions
+ * @param: species consumed by each reaction (species x reactions, row by row), or 0 for none (the default)
+ * @param: species produced by each reaction (species x reactions, row by row)
+ */
+void setBistableNetwork(int n, int r, double * reactants, double * products);
+
+/*
+ * Give the ode function as a polynomial (see homotopy.h) so that each evaluation finds all of
+ * its real steady states by homotopy continuation instead of integrating from the initial
+ * values and searching with Newton: the fitness is then deterministic and its cost is bounded
+ * by the number of paths. A state is stable when every eigenvalue of the Jacobian of the system
+ * (all alphas 1) has a negative real part, and two non-negative stable states make the individual
+ * bistable; near misses are scored by how close a second state is to being stable. The alphas
+ * are dead genes on this path: the optimizer still varies them, but they play no part in the
+ * score, so the alphas of the result mean nothing. The pre-screens are skipped. The states must
+ * be isolated, so the polynomial is not used for a system with conservation laws (see
+ * setBistableNetwork). The structure is not copied
+ * @param: polynomial system with the coefficients of an individual (a Parameters*), or 0 for none
+ *         (the default); ignored for a system of another size, or with more than HOMOTOPY_MAX_PATHS paths
+ */
+void setBistablePolynomial(PolynomialSystem * sys);
+
+/*
+ * Find the steady states of a system of two variables from its nullclines (see nullclineRoots):
+ * each evaluation sweeps the ode function (all alphas 1) over a grid of the given box, batch by
+ * batch (see setBistableBatch), and polishes each crossing of the two nullclines by Newton
+ * iterations, instead of integrating from the initial values and searching with Newton. The
+ * states are then scored as for setBistablePolynomial, and a near miss by how close the nullclines
+ * come where they do not cross. States outside the box are not seen, and two states in one cell
+ * count as one. The pre-screens are skipped. Ignored for other sizes, for systems with conservation
+ * laws, and when a polynomial is given (setBistablePolynomial)
+ * @param: number of cells along each variable, or 0 for none (the default); each evaluation
+ *         costs (grid+1)^2 ode function calls, so 64 to 256 is the useful range
+ * @param: lower bounds of the two variables (a positive bound spaces the grid evenly in log)
+ * @param: upper bounds of the two variables
+ */
+void setBistableNullclines(int grid, double * lower, double * upper);
+
+/*
+ * Rank each generation with a k-nearest-neighbour surrogate of the fitness (trained on
+ * every full evaluation of the run) and fully evaluate only the most promising fraction.
+ * The surrogate is used once 200 individuals have been evaluated. The number of
+ * evaluations saved and the mean error of the checked estimates are printed each
+ * generation and written to the metrics file (surrogate_skipped, surrogate_error).
+ * Keeping the estimates preserves the diversity the GA needs; scoring the others 0
+ * narrows the population quickly and lowers the success rate. A fraction around 0.7 saves
+ * time without a visible loss, while lower fractions miss more bistable points
+ * @param: fraction of each generation that gets a full evaluation (1 = no surrogate, the default)
+ * @param: 1 = the other individuals keep the surrogate estimate, 0 = they score 0
+ */
+void setBistableSurrogate(double fraction, int inherit);
+
+/*
+ * Write one JSON line per generation with the counters and timers of the evaluation
+ * path (ode function calls, CVODE steps, Newton iterations, time per stage, ...).
+ * While this file or the event log (setBistableEventLog) is open, the table of exit stages
+ * is also printed at the end of each run
+ * @param: file name, or 0 to stop writing
+ */
+void setBistableMetricsFile(const char * filename);
+
+/*
+ * Write one binary record per fitness evaluation: the stage at which it exited
+ * (alphas, out_of_time, ss0_failed, no_zero, stable_zero, too_close, budget, bistable)
+ * and its cost. See MetricEvent in metrics.h for the layout.
+ * The same counts are in the "funnel" object of the metrics file.
+ * @param: file name, or 0 to stop writing
+ */
+void setBistableEventLog(const char * filename);
+
+/*
+ * Limit the wall-clock time of makeBistable. When the limit expires the GA stops after the
+ * current generation and makeBistable returns the best individual found so far, its
+ * steady state and its unstable state if one is found and checked, with timedOut set.
+ * That last step has a grace period of one second, and the search for the second stable
+ * state of a bistable result is skipped (stable2 is then 0 unless the run found it)
+ * @param: seconds (0 = no limit)
+ */
+void setBistableTimeLimit(double seconds);
+
 //double** getSteadyStates(Parameters * p, double * iv);
 
 #endif
@@ -0,0 +1,362 @@
+#include <complex.h>
+#include "homotopy.h"
+#include "metrics.h"
+
+typedef double complex Complex;
+
+/*a fixed generic constant for the gamma trick, so that the same individual always gets the same roots*/
+#define HOMOTOPY_GAMMA (0.6180339887 + 0.7861513778 * I)
+
+#define HOMOTOPY_FIRST_DT  0.01
+#define HOMOTOPY_MAX_DT    0.1
+#define HOMOTOPY_MIN_DT    1.0e-12
+#define HOMOTOPY_EXPAND    3         //successful steps before the step is doubled
+#define HOMOTOPY_CORRECTOR 3         //Newton iterations of the corrector
+#define HOMOTOPY_TOL       1.0e-6    //corrector tolerance (relative)
+#define HOMOTOPY_POLISH    20        //Newton iterations at t=1
+#define HOMOTOPY_SAME      1.0e-6    //real roots closer than this (relative) are the same root
+
+/*coefficients of the patch a.z = 1, also fixed and generic*/
+#define HOMOTOPY_PATCH(j) (cos(1.0 + 2.3 * (j)) + sin(0.7 + 1.9 * (j)) * I)
+
+/*work space of one path tracker, for n = numVars+1 projective coordinates*/
+typedef struct
+{
+   Complex * h;    //n: the homotopy
+   Complex * J;    //n x n: its Jacobian
+   Complex * ht;   //n: its derivative in t
+   Complex * pw;   //n x (maxDegree+1): powers of the coordinates
+   Complex * z1;   //n: predicted point
+   Complex * dz;   //n: tangent at the start of the step
+   Complex * a;    //n: the patch
+} Tracker;
+
+PolynomialSystem * polynomialNew(int N, int T, int * equation, int * exponents, void (*coefficients)(void*, double*))
+{
+   int i, k, d;
+   if (N < 1 || T < 1 || equation == 0 || exponents == 0 || coefficients == 0) return (0);
+
+   PolynomialSystem * sys = METRIC_MALLOC(sizeof(PolynomialSystem));
+   (*sys).numVars = N;
+   (*sys).numTerms = T;
+   (*sys).equation = METRIC_MALLOC(T * sizeof(int));
+   (*sys).exponents = METRIC_MALLOC(T * N * sizeof(int));
+   (*sys).degree = METRIC_CALLOC(N, sizeof(int));
+   (*sys).coefficients = coefficients;
+   (*sys).maxDegree = 0;
+
+   for (k=0; k < T; ++k)
+   {
+      (*sys).equation[k] = equation[k];
+      for (i=0, d=0; i < N; ++i)
+      {
+         (*sys).exponents[k*N + i] = exponents[k*N + i];
+         d += exponents[k*N + i];
+      }
+      if (equation[k] >= 0 && equation[k] < N && d > (*sys).degree[ equation[k] ])
+         (*sys).degree[ equation[k] ] = d;
+      if (d > (*sys).maxDegree) (*sys).maxDegree = d;
+   }
+
+   double paths = 1;
+   for (i=0; i < N; ++i)
+   {
+      if ((*sys).degree[i] < 1)   //a constant equation: no start system
+      {
+         polynomialFree(sys);
+         return (0);
+      }
+      paths *= (*sys).degree[i];
+   }
+   (*sys).numPaths = (paths > HOMOTOPY_MAX_PATHS) ? (HOMOTOPY_MAX_PATHS + 1) : (int)paths;
+   return (sys);
+}
+
+void polynomialFree(PolynomialSystem * sys)
+{
+   if (sys == 0) return;
+   free((*sys).equation);
+   free((*sys).exponents);
+   free((*sys).degree);
+   free(sys);
+}
+
+/*
+ * The homotopy in projective coordinates z = (z0, z1..zN), x = (z1..zN)/z0, so that the paths that go
+ * to infinity in x stay bounded: every term of f_i is raised to degree d_i with powers of z0,
+ * g_i = z_i^d_i - z0^d_i, and the last equation a.z = 1 (a generic patch) fixes the scale.
+ *    h(z,t) = (1-t) gamma g(z) + t f(z)
+ * with its Jacobian in z and its derivative in t
+ * in the h, J and ht of the tracker
+*/
+static void evaluateHomotopy(PolynomialSystem * sys, double * c, Complex * z, double t, Tracker * w)
+{
+   int i, j, l, k, e0, N = (*sys).numVars, n = N+1, D = (*sys).maxDegree + 1;
+   int * e;
+   Complex m, d, g, * h = (*w).h, * J = (*w).J, * ht = (*w).ht, * pw = (*w).pw, * a = (*w).a;
+
+   for (j=0; j < n; ++j)
+   {
+      pw[j*D] = 1.0;
+      for (k=1; k < D; ++k) pw[j*D + k] = pw[j*D + k-1] * z[j];
+   }
+   for (i=0; i < n; ++i) h[i] = 0;
+   for (i=0; i < n*n; ++i) J[i] = 0;
+
+   for (k=0; k < (*sys).numTerms; ++k)   //f and its Jacobian
+   {
+      i = (*sys).equation[k];
+      e = (*sys).exponents + k*N;
+      for (j=0, e0=(*sys).degree[i]; j < N; ++j) e0 -= e[j];   //power of z0
+      m = c[k] * pw[e0];
+      for (j=0; j < N; ++j) m *= pw[(j+1)*D + e[j]];
+      h[i] += m;
+      if (e0 > 0)
+      {
+         d = c[k] * e0 * pw[e0-1];
+         for (l=0; l < N; ++l) d *= pw[(l+1)*D + e[l]];
+         J[i*n] += d;
+      }
+      for (j=0; j < N; ++j)
+      {
+         if (e[j] == 0) continue;
+         d = c[k] * e[j] * pw[(j+1)*D + e[j]-1] * pw[e0];
+         for (l=0; l < N; ++l)
+            if (l != j) d *= pw[(l+1)*D + e[l]];
+         J[i*n + j+1] += d;
+      }
+   }
+
+   for (i=0; i < N; ++i)   //add the start system
+   {
+      k = (*sys).degree[i];
+      g = HOMOTOPY_GAMMA * (pw[(i+1)*D + k] - pw[k]);
+      ht[i] = h[i] - g;
+      h[i] = t * h[i] + (1.0 - t) * g;
+      for (j=0; j < n; ++j) J[i*n + j] *= t;
+      J[i*n + i+1] += (1.0 - t) * HOMOTOPY_GAMMA * (double)k * pw[(i+1)*D + k-1];
+      J[i*n] -= (1.0 - t) * HOMOTOPY_GAMMA * (double)k * pw[k-1];
+   }
+
+   h[N] = -1.0;   //the patch
+   for (j=0; j < n; ++j)
+   {
+      h[N] += a[j] * z[j];
+      J[N*n + j] = a[j];
+   }
+   ht[N] = 0;
+}
+
+/*size of a complex number for pivoting, cheaper than cabs*/
+#define CABS1(z) (fabs(creal(z)) + fabs(cimag(z)))
+
+/*solve A y = b by elimination with partial pivoting; A and b are overwritten, y is left in b. 0 if A is singular*/
+static int complexSolve(int n, Complex * A, Complex * b)
+{
+   int i, j, k, p;
+   Complex s;
+   for (k=0; k < n; ++k)
+   {
+      p = k;
+      for (i=k+1; i < n; ++i)
+         if (CABS1(A[i*n + k]) > CABS1(A[p*n + k])) p = i;
+      if (CABS1(A[p*n + k]) == 0.0) return (0);
+      if (p != k)
+      {
+         for (j=k; j < n; ++j)
+         {
+            s = A[k*n + j]; A[k*n + j] = A[p*n + j]; A[p*n + j] = s;
+         }
+         s = b[k]; b[k] = b[p]; b[p] = s;
+      }
+      for (i=k+1; i < n; ++i)
+      {
+         s = A[i*n + k] / A[k*n + k];
+         if (s == 0.0) continue;
+         for (j=k+1; j < n; ++j) A[i*n + j] -= s * A[k*n + j];
+         b[i] -= s * b[k];
+      }
+   }
+   for (i=n-1; i >= 0; --i)
+   {
+      s = b[i];
+      for (j=i+1; j < n; ++j) s -= A[i*n + j] * b[j];
+      b[i] = s / A[i*n + i];
+   }
+   return (1);
+}
+
+static double complexNorm(int n, Complex * x)
+{
+   int i;
+   double s = 0;
+   for (i=0; i < n; ++i) s += creal(x[i])*creal(x[i]) + cimag(x[i])*cimag(x[i]);
+   return sqrt(s);
+}
+
+/*Newton on h(.,t) from z; 1 if the step fell below tol (relative) within the given iterations*/
+static int correct(PolynomialSystem * sys, double * c, Complex * z, double t, int iterations, double tol, Tracker * w)
+{
+   int i, k, n = (*sys).numVars + 1;
+   Complex * h = (*w).h, * J = (*w).J;
+   for (k=0; k < iterations; ++k)
+   {
+      evaluateHomotopy(sys, c, z, t, w);
+      for (i=0; i < n; ++i) h[i] = -h[i];
+      if (!complexSolve(n, J, h)) return (0);
+      for (i=0; i < n; ++i) z[i] += h[i];
+      if (complexNorm(n, h) < tol * complexNorm(n, z)) return (1);
+   }
+   return (0);
+}
+
+/*1 if z is a point at infinity*/
+static int atInfinity(int n, Complex * z)
+{
+   return (cabs(z[0]) < HOMOTOPY_INFINITY * complexNorm(n, z));
+}
+
+/*
+ * follow one path from its start point z (t=0) to t=1
+ * @ret: 1 if it ended at a finite point (left in z), 0 if it went to infinity, -1 if it failed
+*/
+static int trackPath(PolynomialSystem * sys, double * c, Complex * z, Tracker * w)
+{
+   int i, steps = 0, successes = 0, n = (*sys).numVars + 1;
+   Complex * J = (*w).J, * ht = (*w).ht, * z1 = (*w).z1, * dz = (*w).dz;
+   double t = 0, dt = HOMOTOPY_FIRST_DT;
+
+   while (t < 1.0)
+   {
+      if (++steps > HOMOTOPY_MAX_STEPS) return (-1);
+      if (t + dt > 1.0) dt = 1.0 - t;
+
+      /*Heun predictor along the tangent dz/dt = -J^-1 dh/dt*/
+      evaluateHomotopy(sys, c, z, t, w);
+      for (i=0; i < n; ++i) ht[i] = -ht[i];
+      if (!complexSolve(n, J, ht)) return (atInfinity(n, z) ? 0 : -1);
+      for (i=0; i < n; ++i)
+      {
+         dz[i] = ht[i];
+         z1[i] = z[i] + dt * dz[i];
+      }
+      evaluateHomotopy(sys, c, z1, t + dt, w);
+      for (i=0; i < n; ++i) ht[i] = -ht[i];
+      if (complexSolve(n, J, ht))
+         for (i=0; i < n; ++i) z1[i] = z[i] + 0.5 * dt * (dz[i] + ht[i]);
+
+      if (correct(sys, c, z1, (t + dt < 1.0) ? t + dt : 1.0, HOMOTOPY_CORRECTOR, HOMOTOPY_TOL, w))
+      {
+         for (i=0; i < n; ++i) z[i] = z1[i];
+         t += dt;
+         if (1.0 - t < HOMOTOPY_MIN_DT) t = 1.0;
+         if (++successes == HOMOTOPY_EXPAND)   //grow the step after a few good ones
+         {
+            successes = 0;
+            dt *= 2.0;
+            if (dt > HOMOTOPY_MAX_DT) dt = HOMOTOPY_MAX_DT;
+         }
+      }
+      else
+      {
+         successes = 0;
+         dt *= 0.5;
+         if (dt < HOMOTOPY_MIN_DT) return (atInfinity(n, z) ? 0 : -1);
+      }
+   }
+   correct(sys, c, z, 1.0, HOMOTOPY_POLISH, 1.0e-14, w);   //polish on f itself
+   return (atInfinity(n, z) ? 0 : 1);
+}
+
+double * homotopySolve(PolynomialSystem * sys, void * params, int * numRoots, double * nearReal)
+{
+   int i, j, k, P, N;
+   (*numRoots) = 0;
+   if (nearReal) (*nearReal) = -1.0;
+   if (sys == 0) return (0);
+   N = (*sys).numVars;
+   P = (*sys).numPaths;
+   if (P > HOMOTOPY_MAX_PATHS)
+   {
+      (*numRoots) = -1;
+      return (0);
+   }
+
+   double * c = METRIC_MALLOC((*sys).numTerms * sizeof(double));
+   (*(*sys).coefficients)(params, c);
+
+   Complex * ends = METRIC_MALLOC(P * (N+1) * sizeof(Complex));
+   int * status = METRIC_MALLOC(P * sizeof(int));
+   int n1 = N+1;
+
+   #pragma omp parallel private(i,j,k)
+   {
+      Tracker w;
+      w.h = METRIC_MALLOC((5*n1 + n1*n1 + n1 * ((*sys).maxDegree + 1)) * sizeof(Complex));
+      w.ht = w.h + n1;
+      w.z1 = w.ht + n1;
+      w.dz = w.z1 + n1;
+      w.a = w.dz + n1;
+      w.J = w.a + n1;
+      w.pw = w.J + n1*n1;
+      for (i=0; i < n1; ++i) w.a[i] = HOMOTOPY_PATCH(i);
+
+      #pragma omp for schedule(dynamic)
+      for (k=0; k < P; ++k)
+      {
+         Complex * z = ends + k*n1, s = w.a[0];
+         int r = k;
+         z[0] = 1.0;
+         for (i=0; i < N; ++i)   //the start point: one root of unity for each variable, on the patch
+         {
+            j = r % (*sys).degree[i];
+            r /= (*sys).degree[i];
+            z[i+1] = cexp(2.0 * M_PI * I * (double)j / (double)(*sys).degree[i]);
+            s += w.a[i+1] * z[i+1];
+         }
+         for (i=0; i < n1; ++i) z[i] /= s;
+         status[k] = trackPath(sys, c, z, &w);
+         METRIC_INC(METRIC_HOMOTOPY_PATHS);
+         if (status[k] < 0) METRIC_INC(METRIC_HOMOTOPY_FAILURES);
+      }
+      free(w.h);
+   }
+
+   /*the distinct real end points*/
+   double * roots = METRIC_MALLOC(P * N * sizeof(double));
+   int n = 0;
+   for (k=0; k < P; ++k)
+   {
+      if (status[k] < 1) continue;
+      Complex * x = ends + k*n1 + 1;
+      for (i=0; i < N; ++i) x[i] /= x[-1];
+      double size = complexNorm(N, x), im = 0;
+      for (i=0; i < N; ++i) im += cimag(x[i]) * cimag(x[i]);
+      im = sqrt(im);
+      if (im > HOMOTOPY_REAL * (1.0 + size))
+      {
+         if (nearReal && ((*nearReal) < 0 || im < (*nearReal))) (*nearReal) = im;
+         continue;
+      }
+      for (j=0; j < n; ++j)
+      {
+         double d = 0;
+         for (i=0; i < N; ++i) d += (roots[j*N + i] - creal(x[i])) * (roots[j*N + i] - creal(x[i]));
+         if (sqrt(d) < HOMOTOPY_SAME * (1.0 + size)) break;
+      }
+      if (j < n) continue;
+      for (i=0; i < N; ++i) roots[n*N + i] = creal(x[i]);
+      ++n;
+   }
+
+   free(c);
+   free(ends);
+   free(status);
+   (*numRoots) = n;
+   if (n == 0)
+   {
+      free(roots);
+      return (0);
+   }
+   return (roots);
+}
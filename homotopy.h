@@ -0,0 +1,66 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#ifndef GA_HOMOTOPY_FILE
+#define GA_HOMOTOPY_FILE
+
+/*limits of the path tracker (see homotopySolve)*/
+#define HOMOTOPY_MAX_PATHS  100000   //largest total degree that is tracked
+#define HOMOTOPY_MAX_STEPS  5000     //predictor-corrector steps per path
+#define HOMOTOPY_INFINITY   1.0e-5   //a path whose homogenizing coordinate ends below this (relative) goes to infinity
+#define HOMOTOPY_REAL       1.0e-7   //imaginary part (relative) below which a root is real
+
+/*
+ * A polynomial ode function, one sum of terms per variable:
+ *    f_i(x) = sum over the terms k of equation i of  c_k * x_0^e_k0 * x_1^e_k1 * ...
+ * The exponents are fixed; the coefficients are computed from the parameters of each
+ * individual (mass-action rate constants times the alphas, for instance), so one structure
+ * serves a whole run
+*/
+typedef struct
+{
+   int numVars;
+   int numTerms;
+   int * equation;      //variable whose derivative each term belongs to
+   int * exponents;     //numTerms x numVars
+   int * degree;        //total degree of each equation
+   int maxDegree;
+   int numPaths;        //product of the degrees (Bezout number)
+   void (*coefficients)(void * params, double * c);  //fills the numTerms coefficients
+} PolynomialSystem;
+
+/*
+ * describe a polynomial system (the arrays are copied)
+ * @param: number of variables
+ * @param: number of terms
+ * @param: equation of each term
+ * @param: exponents of each term, numTerms x numVars, row by row
+ * @param: function that computes the coefficients of the terms from the parameters
+ * @ret: the structure, or 0 if an equation has no term of degree one or more
+*/
+PolynomialSystem * polynomialNew(int N, int T, int * equation, int * exponents, void (*coefficients)(void*, double*));
+
+/*
+ * free the structure
+ * @param: structure (may be null)
+*/
+void polynomialFree(PolynomialSystem *);
+
+/*
+ * All the isolated real roots of the system, by homotopy continuation from the total-degree start
+ * system g_i = x_i^d_i - 1 (gamma trick). Every one of the numPaths paths is tracked from t=0 to t=1
+ * with a Heun predictor, a Newton corrector and an adaptive step (in parallel when compiled with
+ * OpenMP), and the end points are polished by Newton on the system itself. The paths are tracked in
+ * projective coordinates, so the ones that go to infinity (there are numPaths minus the number of
+ * finite roots) stay bounded and end at a point whose homogenizing coordinate is below
+ * HOMOTOPY_INFINITY. The work is bounded by numPaths x HOMOTOPY_MAX_STEPS
+ * @param: polynomial system
+ * @param: parameters passed to its coefficients function
+ * @param: set to the number of distinct real roots, or -1 if numPaths exceeds HOMOTOPY_MAX_PATHS
+ * @param: if not null, set to the smallest imaginary part (norm) of the complex roots, or -1 if all roots are real
+ * @ret: the real roots, numRoots x numVars (0 if there are none)
+*/
+double * homotopySolve(PolynomialSystem *, void * params, int * numRoots, double * nearReal);
+
+#endif
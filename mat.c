@@ -403,6 +403,504 @@ dbl	a[], ainv[], eps;
 #endif
 }
 
+/*
+	determinant of matrix
+	(Gaussian elimination with partial pivoting on a copy)
+	input:	A = (n,n) matrix
+	return value: det(A), 0 if A is singular
+*/
+
+extern dbl matrixdeterminant(n, a)
+int	n;
+dbl	a[];
+{
+	int	i, j, imax;
+	dbl	max, det, *b;
+	
+	b = allc(dbl, n*n);
+	matrixcopy(n, n, b, a);
+	det = 1;
+	
+	for (j=0; j<n; j++) {
+		matrixsearchcolumnmaxabs(n,n,b,j,j,n,&imax,&max);
+		if (max == 0) {
+			det = 0;
+			break;
+		}
+		if (j != imax) {
+			matrixrowexchange(n, n, b, j, imax);
+			det = -det;
+		}
+		det *= b[j*n+j];
+		for (i=j+1; i<n; i++) {
+			matrixrowadd(n, n, b, i, -b[i*n+j]/b[j*n+j], j);
+		}
+	}
+	free(b);
+	return(det);
+}
+
+/*
+	solve a linear system
+	(Gaussian elimination with partial pivoting on a copy)
+	input:	A = (n,n) matrix
+		b = (n) right-hand side
+	output:	x = (n) solution of A x = b (may be the same array as b)
+	return value: success, or failure if A is singular
+*/
+
+extern status matrixsolve(n, a, b, x)
+int	n;
+dbl	a[], b[], x[];
+{
+	int	i, j, k, imax;
+	dbl	max, sum, l, *lu, *y;
+	
+	lu = allc(dbl, n*n);
+	y = allc(dbl, n);
+	matrixcopy(n, n, lu, a);
+	vectorcopy(n, y, b);
+	
+	for (j=0; j<n; j++) {
+		matrixsearchcolumnmaxabs(n,n,lu,j,j,n,&imax,&max);
+		if (max == 0) {
+			free(lu);
+			free(y);
+			return(failure);
+		}
+		if (j != imax) {
+			matrixrowexchange(n, n, lu, j, imax);
+			sum = y[j]; y[j] = y[imax]; y[imax] = sum;
+		}
+		for (i=j+1; i<n; i++) {
+			l = lu[i*n+j]/lu[j*n+j];
+			for (k=j+1; k<n; k++) lu[i*n+k] -= l*lu[j*n+k];
+			y[i] -= l*y[j];
+		}
+	}
+	
+	for (i=n-1; i>=0; i--) {
+		sum = y[i];
+		for (j=i+1; j<n; j++) sum -= lu[i*n+j]*x[j];
+		x[i] = sum/lu[i*n+i];
+	}
+	free(lu);
+	free(y);
+	return(success);
+}
+
+/*
+	LU factorization, to solve several systems with the same matrix
+	(Gaussian elimination with partial pivoting, in place)
+	input:	A = (n,n) matrix
+	output:	A = L (unit lower, below the diagonal) and U
+		pivot = (n) row exchanged with each row
+	return value: success, or failure if A is singular
+*/
+
+extern status matrixlu(n, a, pivot)
+int	n;
+dbl	a[];
+int	pivot[];
+{
+	int	i, j, k, imax;
+	dbl	max, l;
+	
+	for (j=0; j<n; j++) {
+		matrixsearchcolumnmaxabs(n,n,a,j,j,n,&imax,&max);
+		pivot[j] = imax;
+		if (max == 0) return(failure);
+		if (j != imax) matrixrowexchange(n, n, a, j, imax);
+		for (i=j+1; i<n; i++) {
+			l = (a[i*n+j] /= a[j*n+j]);
+			for (k=j+1; k<n; k++) a[i*n+k] -= l*a[j*n+k];
+		}
+	}
+	return(success);
+}
+
+/*
+	solve a linear system with the factors of matrixlu
+	input:	LU, pivot = output of matrixlu
+		b = (n) right-hand side
+	output:	b = (n) solution
+*/
+
+extern void matrixlusolve(n, lu, pivot, b)
+int	n;
+dbl	lu[], b[];
+int	pivot[];
+{
+	int	i, j;
+	dbl	sum;
+	
+	for (i=0; i<n; i++) {
+		sum = b[pivot[i]]; b[pivot[i]] = b[i]; b[i] = sum;
+		for (j=0; j<i; j++) b[i] -= lu[i*n+j]*b[j];
+	}
+	for (i=n-1; i>=0; i--) {
+		for (j=i+1; j<n; j++) b[i] -= lu[i*n+j]*b[j];
+		b[i] /= lu[i*n+i];
+	}
+}
+
+/*
+	eigenvalues and eigenvectors of a symmetric matrix
+	(cyclic Jacobi rotations on a copy)
+	input:	A = (n,n) symmetric matrix
+	output:	d = (n) eigenvalues
+		V = (n,n) eigenvectors, one per column (A = V diag(d) V^T)
+	return value: number of sweeps, -1 if it did not converge
+*/
+
+extern int matrixsymmetriceigen(n, a, d, v)
+int	n;
+dbl	a[], d[], v[];
+{
+	int	i, j, k, sweep;
+	dbl	off, theta, t, c, s, tau, aij, *b;
+	
+	b = allc(dbl, n*n);
+	matrixcopy(n, n, b, a);
+	matrixunit(n, v);
+	
+	for (sweep=0; sweep<100; sweep++) {
+		off = 0;
+		for (i=0; i<n; i++)
+			for (j=i+1; j<n; j++)
+				off += b[i*n+j]*b[i*n+j];
+		if (off < 1.0e-30) break;
+		
+		for (i=0; i<n; i++) {
+			for (j=i+1; j<n; j++) {
+				aij = b[i*n+j];
+				if (aij == 0) continue;
+				theta = (b[j*n+j] - b[i*n+i]) / (2*aij);
+				t = (theta >= 0 ? 1 : -1) / (fabs(theta) + sqrt(theta*theta + 1));
+				c = 1 / sqrt(t*t + 1);
+				s = t*c;
+				tau = s / (1 + c);
+				
+				b[i*n+i] -= t*aij;
+				b[j*n+j] += t*aij;
+				b[i*n+j] = b[j*n+i] = 0;
+				for (k=0; k<n; k++) {
+					if (k != i && k != j) {
+						dbl	bki = b[k*n+i], bkj = b[k*n+j];
+						b[k*n+i] = b[i*n+k] = bki - s*(bkj + tau*bki);
+						b[k*n+j] = b[j*n+k] = bkj + s*(bki - tau*bkj);
+					}
+					dbl	vki = v[k*n+i], vkj = v[k*n+j];
+					v[k*n+i] = vki - s*(vkj + tau*vki);
+					v[k*n+j] = vkj + s*(vki - tau*vkj);
+				}
+			}
+		}
+	}
+	
+	for (i=0; i<n; i++) {
+		d[i] = b[i*n+i];
+	}
+	free(b);
+	if (sweep >= 100) return(-1);
+	return(sweep);
+}
+
+/*
+	eigenvalues of a general matrix
+	(reduction of a copy to upper Hessenberg form by elimination,
+	 then the shifted double-step QR iteration of Francis)
+	input:	A = (n,n) matrix
+	output:	wr = (n) real parts of the eigenvalues
+		wi = (n) imaginary parts (complex pairs are adjacent,
+		     positive imaginary part first)
+	return value: number of QR iterations, -1 if it did not converge
+*/
+
+#define	H(i,j)	h[(i)*n+(j)]
+
+extern int matrixeigenvalues(n, a, wr, wi)
+int	n;
+dbl	a[], wr[], wi[];
+{
+	int	i, j, k, l, m, nn, its, total, last;
+	dbl	*h, norm, shift, p, q, r, s, t, u, v, w, x, y, z;
+	
+	h = allc(dbl, n*n);
+	matrixcopy(n, n, h, a);
+	
+	/* Hessenberg form: eliminate below the subdiagonal, pivoting on the largest entry */
+	for (m=1; m<n-1; m++) {
+		x = 0;
+		i = m;
+		for (j=m; j<n; j++) {
+			if (fabs(H(j,m-1)) > fabs(x)) {
+				x = H(j,m-1);
+				i = j;
+			}
+		}
+		if (i != m) {
+			for (j=m-1; j<n; j++) {
+				t = H(i,j); H(i,j) = H(m,j); H(m,j) = t;
+			}
+			for (j=0; j<n; j++) {
+				t = H(j,i); H(j,i) = H(j,m); H(j,m) = t;
+			}
+		}
+		if (x != 0) {
+			for (i=m+1; i<n; i++) {
+				y = H(i,m-1);
+				if (y == 0) continue;
+				y /= x;
+				H(i,m-1) = 0;
+				for (j=m; j<n; j++) H(i,j) -= y*H(m,j);
+				for (j=0; j<n; j++) H(j,m) += y*H(j,i);
+			}
+		}
+	}
+	
+	norm = 0;
+	for (i=0; i<n; i++)
+		for (j=(i > 0 ? i-1 : 0); j<n; j++)
+			norm += fabs(H(i,j));
+	
+	/* QR iteration on the active block l..nn, deflating one or two eigenvalues at a time */
+	nn = n-1;
+	shift = 0;
+	total = 0;
+	while (nn >= 0) {
+		its = 0;
+		do {
+			for (l=nn; l>=1; l--) {	/* small subdiagonal entry: the block splits */
+				s = fabs(H(l-1,l-1)) + fabs(H(l,l));
+				if (s == 0) s = norm;
+				if (fabs(H(l,l-1)) + s == s) {
+					H(l,l-1) = 0;
+					break;
+				}
+			}
+			x = H(nn,nn);
+			if (l == nn) {	/* one real eigenvalue */
+				wr[nn] = x + shift;
+				wi[nn] = 0;
+				nn--;
+			} else {
+				y = H(nn-1,nn-1);
+				w = H(nn,nn-1)*H(nn-1,nn);
+				if (l == nn-1) {	/* a 2x2 block: two real or a complex pair */
+					p = 0.5*(y - x);
+					q = p*p + w;
+					z = sqrt(fabs(q));
+					x += shift;
+					if (q >= 0) {
+						z = p + (p >= 0 ? z : -z);
+						wr[nn-1] = wr[nn] = x + z;
+						if (z != 0) wr[nn] = x - w/z;
+						wi[nn-1] = wi[nn] = 0;
+					} else {
+						wr[nn-1] = wr[nn] = x + p;
+						wi[nn-1] = z;
+						wi[nn] = -z;
+					}
+					nn -= 2;
+				} else {
+					if (its == 60) {
+						free(h);
+						return(-1);
+					}
+					if (its > 0 && its % 10 == 0) {	/* exceptional shift */
+						shift += x;
+						for (i=0; i<=nn; i++) H(i,i) -= x;
+						s = fabs(H(nn,nn-1)) + fabs(H(nn-1,nn-2));
+						y = x = 0.75*s;
+						w = -0.4375*s*s;
+					}
+					its++;
+					total++;
+					/* look for two consecutive small subdiagonal entries */
+					for (m=nn-2; m>=l; m--) {
+						z = H(m,m);
+						r = x - z;
+						s = y - z;
+						p = (r*s - w)/H(m+1,m) + H(m,m+1);
+						q = H(m+1,m+1) - z - r - s;
+						r = H(m+2,m+1);
+						s = fabs(p) + fabs(q) + fabs(r);
+						p /= s;
+						q /= s;
+						r /= s;
+						if (m == l) break;
+						u = fabs(H(m,m-1))*(fabs(q) + fabs(r));
+						v = fabs(p)*(fabs(H(m-1,m-1)) + fabs(z) + fabs(H(m+1,m+1)));
+						if (u + v == v) break;
+					}
+					for (i=m+2; i<=nn; i++) {
+						H(i,i-2) = 0;
+						if (i != m+2) H(i,i-3) = 0;
+					}
+					/* double QR step on rows l..nn and columns m..nn */
+					for (k=m; k<=nn-1; k++) {
+						if (k != m) {
+							p = H(k,k-1);
+							q = H(k+1,k-1);
+							r = (k != nn-1) ? H(k+2,k-1) : 0;
+							x = fabs(p) + fabs(q) + fabs(r);
+							if (x != 0) {
+								p /= x;
+								q /= x;
+								r /= x;
+							}
+						}
+						s = sqrt(p*p + q*q + r*r);
+						if (p < 0) s = -s;
+						if (s == 0) continue;
+						if (k == m) {
+							if (l != m) H(k,k-1) = -H(k,k-1);
+						} else
+							H(k,k-1) = -s*x;
+						p += s;
+						x = p/s;
+						y = q/s;
+						z = r/s;
+						q /= p;
+						r /= p;
+						for (j=k; j<=nn; j++) {
+							p = H(k,j) + q*H(k+1,j);
+							if (k != nn-1) {
+								p += r*H(k+2,j);
+								H(k+2,j) -= p*z;
+							}
+							H(k+1,j) -= p*y;
+							H(k,j) -= p*x;
+						}
+						last = (nn < k+3) ? nn : k+3;
+						for (i=l; i<=last; i++) {
+							p = x*H(i,k) + y*H(i,k+1);
+							if (k != nn-1) {
+								p += z*H(i,k+2);
+								H(i,k+2) -= p*r;
+							}
+							H(i,k+1) -= p*q;
+							H(i,k) -= p;
+						}
+					}
+				}
+			}
+		} while (l < nn-1);
+	}
+	free(h);
+	return(total);
+}
+
+#undef	H
+
+/*
+	singular value decomposition A = U S V^T
+	(one-sided Jacobi rotations of the columns, in place)
+	input:	A = (m,n) matrix
+		eps = relative size below which a singular value
+		      counts as zero
+	output:	A = (m,n) matrix U S: column j is the j-th singular
+		    value times the j-th left singular vector, so the
+		    singular values are the norms of the columns
+		V = (n,n) right singular vectors, one per column
+		order = (n) column indices by decreasing singular value
+	return value: rank (singular values above eps times the largest)
+*/
+
+extern int svd(m, n, a, v, order, eps)
+int	m, n;
+dbl	a[], v[];
+int	order[];
+dbl	eps;
+{
+	int	i, j, k, sweep, rotated, rank;
+	dbl	alpha, beta, gamma, zeta, t, c, s, *sv;
+	
+	matrixunit(n, v);
+	for (sweep=0; sweep<100; sweep++) {
+		rotated = 0;
+		for (i=0; i<n-1; i++) {
+			for (j=i+1; j<n; j++) {
+				alpha = beta = gamma = 0;
+				for (k=0; k<m; k++) {
+					alpha += a[k*n+i]*a[k*n+i];
+					beta  += a[k*n+j]*a[k*n+j];
+					gamma += a[k*n+i]*a[k*n+j];
+				}
+				if (gamma == 0 || fabs(gamma) <= 1.0e-15*sqrt(alpha*beta)) continue;
+				rotated = 1;
+				zeta = (beta - alpha) / (2*gamma);
+				t = (zeta >= 0 ? 1 : -1) / (fabs(zeta) + sqrt(1 + zeta*zeta));
+				c = 1 / sqrt(1 + t*t);
+				s = c*t;
+				for (k=0; k<m; k++) {
+					dbl	aki = a[k*n+i], akj = a[k*n+j];
+					a[k*n+i] = c*aki - s*akj;
+					a[k*n+j] = s*aki + c*akj;
+				}
+				for (k=0; k<n; k++) {
+					dbl	vki = v[k*n+i], vkj = v[k*n+j];
+					v[k*n+i] = c*vki - s*vkj;
+					v[k*n+j] = s*vki + c*vkj;
+				}
+			}
+		}
+		if (!rotated) break;
+	}
+	
+	sv = allc(dbl, n);
+	for (j=0; j<n; j++) {
+		sv[j] = 0;
+		for (k=0; k<m; k++) sv[j] += a[k*n+j]*a[k*n+j];
+		sv[j] = sqrt(sv[j]);
+		for (i=j; i>0 && sv[order[i-1]] < sv[j]; i--) order[i] = order[i-1];
+		order[i] = j;
+	}
+	rank = 0;
+	while (rank < n && sv[order[rank]] > 0 && sv[order[rank]] > eps*sv[order[0]]) rank++;
+	free(sv);
+	return(rank);
+}
+
+/*
+	null space of a matrix
+	(singular value decomposition of a copy)
+	input:	A = (m,n) matrix
+		eps = relative size below which a singular value
+		      counts as zero
+	output:	N = (n,n) matrix: its first *pdim rows are an
+		    orthonormal basis of {x : A x = 0}
+		*pdim = dimension of the null space
+	return value: rank of A
+*/
+
+extern int nullspace(m, n, a, ns, pdim, eps)
+int	m, n;
+dbl	a[], ns[];
+int	*pdim;
+dbl	eps;
+{
+	int	i, k, rank, *order;
+	dbl	*b, *v;
+	
+	b = allc(dbl, m*n);
+	v = allc(dbl, n*n);
+	order = allc(int, n);
+	matrixcopy(m, n, b, a);
+	rank = svd(m, n, b, v, order, eps);
+	*pdim = n - rank;
+	for (i=0; i<n-rank; i++) {
+		for (k=0; k<n; k++) {
+			ns[i*n+k] = v[k*n+order[rank+i]];
+		}
+	}
+	free(b);
+	free(v);
+	free(order);
+	return(rank);
+}
+
 /*	Print & Scan		*/
 
 static char	*format = " %lf ";
@@ -0,0 +1,200 @@
+#include <stdlib.h>
+#include "metrics.h"
+
+THREAD_LOCAL MetricsBlock * METRICS_LOCAL = 0;
+
+/*all registered blocks; blocks are never freed so they can be summed after their thread is gone*/
+static MetricsBlock * BLOCKS = 0;
+
+/*totals at the time of the previous record and of the last reset*/
+static MetricsBlock LAST, START;
+static double LAST_TIME = 0;
+
+static const char * STAGE_NAMES[METRIC_STAGES];
+static int NUM_STAGES = 0;
+
+static FILE * EVENT_LOG = 0;
+
+#if GA_METRICS
+static const char * COUNTER_NAMES[METRIC_COUNTERS] =
+{
+   "evaluations", "rhs_evals", "cvode_runs", "cvode_steps", "cvode_setups",
+   "adams_steps", "method_switches", "ensemble_steps", "ensemble_fallbacks", "rosenbrock_steps",
+   "nm_iterations", "newton_iterations", "jacobians", "allocations", "budget_exhausted",
+   "reverifications", "false_positives", "surrogate_checked", "surrogate_skipped",
+   "refinements", "refinements_improved", "homotopy_paths", "homotopy_failures",
+   "folds", "fold_failures"
+};
+
+static const char * SUM_NAMES[METRIC_SUMS] =
+{
+   "surrogate_error"
+};
+
+static const char * TIMER_NAMES[METRIC_TIMERS] =
+{
+   "fitness", "regular_ss", "ensemble_ss", "find_zeros", "unstable_ss"
+};
+#endif
+
+MetricsBlock * metricsRegister(void)
+{
+   MetricsBlock * b = calloc(1, sizeof(MetricsBlock));
+   do
+      (*b).next = BLOCKS;
+   while (!__sync_bool_compare_and_swap(&BLOCKS, (*b).next, b));
+   METRICS_LOCAL = b;
+   return b;
+}
+
+void metricsStage(int stage, long rhsEvals, long steps, double seconds)
+{
+   MetricsBlock * b = METRICS_BLOCK;
+   if (stage < 0 || stage >= METRIC_STAGES) return;
+
+   ++(*b).stages[stage].count;
+   (*b).stages[stage].rhsEvals += rhsEvals;
+   (*b).stages[stage].steps += steps;
+   (*b).stages[stage].seconds += seconds;
+
+   if (EVENT_LOG == NULL) return;
+
+   if ((*b).numEvents >= (*b).maxEvents)
+   {
+      (*b).maxEvents = 2 * (*b).maxEvents + 256;
+      (*b).events = realloc((*b).events, (*b).maxEvents * sizeof(MetricEvent));
+   }
+   MetricEvent * e = &((*b).events[ (*b).numEvents++ ]);
+   (*e).gen = 0;
+   (*e).stage = stage;
+   (*e).rhsEvals = rhsEvals;
+   (*e).steps = steps;
+   (*e).seconds = seconds;
+}
+
+void metricsStageNames(const char ** names, int n)
+{
+   int i;
+   if (n > METRIC_STAGES) n = METRIC_STAGES;
+   for (i=0; i < n; ++i) STAGE_NAMES[i] = names[i];
+   NUM_STAGES = n;
+}
+
+void metricsEventLog(FILE * out)
+{
+   EVENT_LOG = out;
+}
+
+/*sum of all threads*/
+static void metricsTotal(MetricsBlock * total)
+{
+   int i;
+   MetricsBlock * b;
+   for (i=0; i < METRIC_COUNTERS; ++i) (*total).counters[i] = 0;
+   for (i=0; i < METRIC_SUMS; ++i) (*total).sums[i] = 0;
+   for (i=0; i < METRIC_TIMERS; ++i)
+   {
+      (*total).calls[i] = 0;
+      (*total).seconds[i] = 0;
+   }
+   for (i=0; i < METRIC_STAGES; ++i)
+   {
+      (*total).stages[i].count = (*total).stages[i].rhsEvals = (*total).stages[i].steps = 0;
+      (*total).stages[i].seconds = 0;
+   }
+   for (b = BLOCKS; b != NULL; b = (*b).next)
+   {
+      for (i=0; i < METRIC_COUNTERS; ++i) (*total).counters[i] += (*b).counters[i];
+      for (i=0; i < METRIC_SUMS; ++i) (*total).sums[i] += (*b).sums[i];
+      for (i=0; i < METRIC_TIMERS; ++i)
+      {
+         (*total).calls[i] += (*b).calls[i];
+         (*total).seconds[i] += (*b).seconds[i];
+      }
+      for (i=0; i < METRIC_STAGES; ++i)
+      {
+         (*total).stages[i].count += (*b).stages[i].count;
+         (*total).stages[i].rhsEvals += (*b).stages[i].rhsEvals;
+         (*total).stages[i].steps += (*b).stages[i].steps;
+         (*total).stages[i].seconds += (*b).stages[i].seconds;
+      }
+   }
+}
+
+/*write the buffered events of all threads to the event log*/
+static void metricsFlushEvents(int gen)
+{
+   int i;
+   MetricsBlock * b;
+   for (b = BLOCKS; b != NULL; b = (*b).next)
+   {
+      if (EVENT_LOG && (*b).numEvents > 0)
+      {
+         for (i=0; i < (*b).numEvents; ++i) (*b).events[i].gen = gen;
+         fwrite((*b).events, sizeof(MetricEvent), (*b).numEvents, EVENT_LOG);
+      }
+      (*b).numEvents = 0;
+   }
+   if (EVENT_LOG) fflush(EVENT_LOG);
+}
+
+void metricsReset(void)
+{
+   metricsFlushEvents(-1);
+   metricsTotal(&LAST);
+   START = LAST;
+   LAST_TIME = ODEclock();
+}
+
+void metricsFunnelTable(FILE * out)
+{
+   int i;
+   MetricsBlock total;
+   if (out == NULL || NUM_STAGES == 0) return;
+
+   metricsTotal(&total);
+   fprintf(out, "%-16s %10s %14s %12s %12s\n", "exit stage", "count", "rhs evals", "steps", "seconds");
+   for (i=0; i < NUM_STAGES; ++i)
+      fprintf(out, "%-16s %10ld %14ld %12ld %12.4f\n", STAGE_NAMES[i],
+              total.stages[i].count - START.stages[i].count,
+              total.stages[i].rhsEvals - START.stages[i].rhsEvals,
+              total.stages[i].steps - START.stages[i].steps,
+              total.stages[i].seconds - START.stages[i].seconds);
+}
+
+void metricsWrite(FILE * out, int gen, double best)
+{
+#if GA_METRICS
+   int i;
+   MetricsBlock total;
+   double now = ODEclock();
+
+   metricsFlushEvents(gen);
+   if (out == NULL) return;
+   if (LAST_TIME == 0) LAST_TIME = now;
+
+   metricsTotal(&total);
+
+   fprintf(out, "{\"gen\":%i,\"best\":%.10g,\"seconds\":%.6f", gen, best, now - LAST_TIME);
+   for (i=0; i < METRIC_COUNTERS; ++i)
+      fprintf(out, ",\"%s\":%ld", COUNTER_NAMES[i], total.counters[i] - LAST.counters[i]);
+   for (i=0; i < METRIC_SUMS; ++i)
+      fprintf(out, ",\"%s\":%.6g", SUM_NAMES[i], total.sums[i] - LAST.sums[i]);
+   for (i=0; i < METRIC_TIMERS; ++i)
+      fprintf(out, ",\"%s\":{\"calls\":%ld,\"seconds\":%.6f}", TIMER_NAMES[i],
+              total.calls[i] - LAST.calls[i], total.seconds[i] - LAST.seconds[i]);
+   fprintf(out, ",\"funnel\":{");
+   for (i=0; i < NUM_STAGES; ++i)
+      fprintf(out, "%s\"%s\":{\"count\":%ld,\"rhs_evals\":%ld,\"steps\":%ld,\"seconds\":%.6f}",
+              (i > 0) ? "," : "", STAGE_NAMES[i],
+              total.stages[i].count - LAST.stages[i].count,
+              total.stages[i].rhsEvals - LAST.stages[i].rhsEvals,
+              total.stages[i].steps - LAST.stages[i].steps,
+              total.stages[i].seconds - LAST.stages[i].seconds);
+   fprintf(out, "}}\n");
+   fflush(out);
+
+   LAST = total;
+   LAST_TIME = now;
+#endif
+}
@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef GA_METRICS_FILE
+#define GA_METRICS_FILE
+
+/*
+ * Counters and timers for the hot paths. Each thread updates its own block without
+ * locking; the blocks are only summed when a record is written.
+ * Compile with -DGA_METRICS=0 to remove every counter and timer from the code.
+*/
+#ifndef GA_METRICS
+#define GA_METRICS 1
+#endif
+
+#ifndef THREAD_LOCAL
+#define THREAD_LOCAL __thread
+#endif
+
+typedef enum
+{
+   METRIC_EVALUATIONS,       //fitness evaluations
+   METRIC_RHS_EVALS,         //ode function calls
+   METRIC_CVODE_RUNS,        //integrations started
+   METRIC_CVODE_STEPS,       //internal CVODE steps
+   METRIC_CVODE_SETUPS,      //CVODE linear solver setups
+   METRIC_ADAMS_STEPS,       //CVODE steps taken with Adams-Moulton (ODE_AUTO)
+   METRIC_METHOD_SWITCHES,   //changes between Adams and BDF (ODE_AUTO)
+   METRIC_ENSEMBLE_STEPS,    //accepted steps of the ensemble integrator, summed over its lanes
+   METRIC_ENSEMBLE_FALLBACKS, //first steady states the ensemble integrator left to CVODE
+   METRIC_ROSENBROCK_STEPS,  //accepted steps of the built-in Rosenbrock method
+   METRIC_NM_ITERATIONS,     //Nelder-Mead iterations
+   METRIC_NEWTON_ITERATIONS, //deflated Newton iterations
+   METRIC_JACOBIANS,         //jacobian() calls
+   METRIC_ALLOCATIONS,       //heap allocations on the evaluation path (see METRIC_MALLOC)
+   METRIC_BUDGET_EXHAUSTED,  //evaluations stopped by their budget
+   METRIC_REVERIFICATIONS,   //fitness 1 results checked again at full accuracy
+   METRIC_FALSE_POSITIVES,   //fitness 1 results that did not survive that check
+   METRIC_SURROGATE_CHECKED, //surrogate estimates compared with a full evaluation
+   METRIC_SURROGATE_SKIPPED, //individuals given the surrogate estimate instead of a full evaluation
+   METRIC_REFINEMENTS,       //local refinements of GA individuals (memetic step)
+   METRIC_REFINEMENTS_IMPROVED, //refinements that raised the fitness
+   METRIC_HOMOTOPY_PATHS,    //homotopy paths tracked
+   METRIC_HOMOTOPY_FAILURES, //homotopy paths that neither reached t=1 nor went to infinity
+   METRIC_FOLDS,             //folds located (see foldFind)
+   METRIC_FOLD_FAILURES,     //fold searches that found none
+   METRIC_COUNTERS           //number of counters
+} MetricCounter;
+
+typedef enum
+{
+   TIMER_FITNESS,            //whole fitness evaluation
+   TIMER_REGULAR_SS,         //regularSteadyState
+   TIMER_ENSEMBLE_SS,        //first steady states of a batch with the ensemble integrator
+   TIMER_FIND_ZEROS,         //findZeros
+   TIMER_UNSTABLE_SS,        //unstableSteadyState
+   METRIC_TIMERS             //number of timers
+} MetricTimer;
+
+typedef enum
+{
+   SUM_SURROGATE_ERROR,      //absolute error of the checked surrogate estimates
+   METRIC_SUMS               //number of sums
+} MetricSum;
+
+/*maximum number of stages an evaluation can exit at (see metricsStageNames)*/
+#define METRIC_STAGES 16
+
+/*evaluations that exited at one stage and what they cost*/
+typedef struct
+{
+   long count;
+   long rhsEvals;
+   long steps;
+   double seconds;
+} MetricStage;
+
+/*
+ * One record of the binary event log: one per evaluation, written in native byte order.
+ * gen is the generation of the record written by the next metricsWrite
+*/
+typedef struct
+{
+   int gen;
+   int stage;
+   long long rhsEvals;
+   long long steps;
+   double seconds;
+} MetricEvent;
+
+/*per-thread storage*/
+typedef struct MetricsBlock
+{
+   long counters[METRIC_COUNTERS];
+   long calls[METRIC_TIMERS];
+   double seconds[METRIC_TIMERS];
+   double sums[METRIC_SUMS];
+   MetricStage stages[METRIC_STAGES];
+   MetricEvent * events;      //events not yet written to the log
+   int numEvents, maxEvents;
+   struct MetricsBlock * next;
+} MetricsBlock;
+
+extern THREAD_LOCAL MetricsBlock * METRICS_LOCAL;
+
+/*
+ * allocate and register the block of the calling thread (done once per thread)
+ * @ret: the block
+*/
+MetricsBlock * metricsRegister(void);
+
+/*the clock of the timers (cvodesim.h)*/
+double ODEclock(void);
+
+#define METRICS_BLOCK (METRICS_LOCAL ? METRICS_LOCAL : metricsRegister())
+
+#if GA_METRICS
+#define METRIC_ADD(c,n) ((*METRICS_BLOCK).counters[c] += (n))
+#define METRIC_INC(c) METRIC_ADD(c,1)
+#define METRIC_SUM_ADD(s,x) ((*METRICS_BLOCK).sums[s] += (x))
+#define METRIC_TIMER_START(t0) double t0 = ODEclock()
+#define METRIC_TIMER_STOP(t0,timer) ( (*METRICS_BLOCK).seconds[timer] += ODEclock() - (t0), ++(*METRICS_BLOCK).calls[timer] )
+#define METRIC_STAGE(stage,rhsEvals,steps,t0) metricsStage(stage, rhsEvals, steps, ODEclock() - (t0))
+#else
+#define METRIC_ADD(c,n) ((void)0)
+#define METRIC_INC(c) ((void)0)
+#define METRIC_SUM_ADD(s,x) ((void)0)
+#define METRIC_TIMER_START(t0) ((void)0)
+#define METRIC_TIMER_STOP(t0,timer) ((void)0)
+#define METRIC_STAGE(stage,rhsEvals,steps,t0) ((void)0)
+#endif
+
+/*allocations of the evaluation path, each counted as METRIC_ALLOCATIONS where it is made*/
+#define METRIC_MALLOC(size) (METRIC_INC(METRIC_ALLOCATIONS), malloc(size))
+#define METRIC_CALLOC(n,size) (METRIC_INC(METRIC_ALLOCATIONS), calloc(n,size))
+#define METRIC_REALLOC(p,size) (METRIC_INC(METRIC_ALLOCATIONS), realloc(p,size))
+
+/*
+ * record the stage at which an evaluation exited and its cost (use METRIC_STAGE)
+ * @param: stage (0 to METRIC_STAGES-1)
+ * @param: ode function calls
+ * @param: CVODE steps
+ * @param: seconds
+*/
+void metricsStage(int, long, long, double);
+
+/*
+ * name the stages, in order; unnamed stages are left out of the records
+ * @param: array of names
+ * @param: number of names
+*/
+void metricsStageNames(const char **, int);
+
+/*
+ * write every recorded evaluation as a MetricEvent to this file
+ * @param: binary file opened for writing, or 0 to stop logging
+*/
+void metricsEventLog(FILE *);
+
+/*
+ * print the stage table (count and cost of each exit stage) accumulated since the last metricsReset
+ * @param: output file
+*/
+void metricsFunnelTable(FILE *);
+
+/*
+ * Write one JSON record with everything counted since the previous record
+ * (all threads summed, including the stage funnel), flush the event log and
+ * start a new interval. No record is written when metrics are compiled out or the file is null
+ * @param: output file
+ * @param: generation
+ * @param: best fitness of the generation
+*/
+void metricsWrite(FILE *, int, double);
+
+/*
+ * start a new interval without writing a record
+*/
+void metricsReset(void);
+
+#endif
@@ -108,3 +108,18 @@ double mtrand(void)
 {
     return (genrand64_int64() >> 11) * (1.0/9007199254740992.0);
 }
+
+/* splitmix64 (Steele, Lea and Flood 2014): advance the state by the golden gamma and mix it */
+unsigned long long splitmix64(unsigned long long * state)
+{
+    unsigned long long z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* generates a random number on [0,1)-real-interval from a splitmix64 stream */
+double splitmixrand(unsigned long long * state)
+{
+    return (splitmix64(state) >> 11) * (1.0/9007199254740992.0);
+}
@@ -42,4 +42,12 @@ void initMTrand(void);
 
 double mtrand(void);
 
+/* splitmix64: a small generator whose state is kept by the caller, */
+/* so that each thread or task can draw from its own stream */
+/* the state may be any value, e.g. a seed from genrand64_int64() plus a stream number */
+unsigned long long splitmix64(unsigned long long * state);
+
+/* generates a random number on [0,1)-real-interval from a splitmix64 stream */
+double splitmixrand(unsigned long long * state);
+
 #endif
@@ -11,83 +11,110 @@
 #include <math.h>
 #include <values.h>
 #include "opt.h"
+#include "metrics.h"
 
 #define	Debug		0
 #define	Static		static
 
 #define SKIPTIME	100	/* print interval for debugging */
 
-static int	nvar;
-static dbl	(*objective)();
-
-static dbl	**simp, *fvalue;
-static int	ih, is, il;
-static dbl	*xcentroid;
-static dbl	fmean, fvar;
+/*
+	the state of one search; each call has its own, so a search can
+	run inside the objective function of another (or in another thread)
+*/
+typedef struct {
+	int	nvar;
+	dbl	(*objective)();
+	
+	dbl	**simp, *fvalue;
+	int	ih, is, il;
+	dbl	*xcentroid;
+	dbl	fmean, fvar;
+	
+	dbl	*xreflect,  *xcontract, *xexpand;
+	dbl	freflect, fcontract, fexpand;
+} simplex;
 
-static dbl	*xreflect,  *xcontract, *xexpand;
-static dbl	freflect, fcontract, fexpand;
 static dbl	al = 1, bt = 0.5, gm = 2;
 
-static void fprint_simplex(FILE *fd)
+static THREAD_LOCAL int	(*interrupt)() = 0;	/* stops the search when it returns nonzero */
+static THREAD_LOCAL dbl	*scales = 0;		/* length of the initial simplex along each axis, relative */
+
+static void fprint_simplex(FILE *fd, simplex *s)
 {
 	int	i;
 	
-	for (i=0; i<=nvar; i++) {
-		vectorfprint(fd, nvar, simp[i]);
+	for (i=0; i<=s->nvar; i++) {
+		vectorfprint(fd, s->nvar, s->simp[i]);
 	}
 }
 
-static void fprint_points(FILE *fd)
+static void fprint_points(FILE *fd, simplex *s)
 {
 	fprintf(fd, "----- xh xs and xl -----\n");
-	vectorfprint(fd, nvar, simp[ih]);
-	vectorfprint(fd, nvar, simp[is]);
-	vectorfprint(fd, nvar, simp[il]);
+	vectorfprint(fd, s->nvar, s->simp[s->ih]);
+	vectorfprint(fd, s->nvar, s->simp[s->is]);
+	vectorfprint(fd, s->nvar, s->simp[s->il]);
 	fprintf(fd, "----- xcentroid -----\n");
-	vectorfprint(fd, nvar, xcentroid);
+	vectorfprint(fd, s->nvar, s->xcentroid);
 }
 
-static void fprint_generated_points(FILE *fd)
+static void fprint_generated_points(FILE *fd, simplex *s)
 {
 	fprintf(fd, "----- xreflect xcontract xexpand -----\n");
-	vectorfprint(fd, nvar, xreflect);
-	vectorfprint(fd, nvar, xcontract);
-	vectorfprint(fd, nvar, xexpand);
+	vectorfprint(fd, s->nvar, s->xreflect);
+	vectorfprint(fd, s->nvar, s->xcontract);
+	vectorfprint(fd, s->nvar, s->xexpand);
 	fprintf(fd, "freflect %lf	fcontract %lf	fexpand %lf\n",
-		freflect, fcontract, fexpand);
+		s->freflect, s->fcontract, s->fexpand);
 }
 
-static void initialize()
+static void initialize(simplex *s)
 {
-	int	i;
+	int	i, nvar = s->nvar;
 	
-	simp = alloc(dbl *, nvar+1);
+	s->simp = alloc(dbl *, nvar+1);
 	for (i=0; i<=nvar; i++) {
-		simp[i] = alloc(dbl, nvar);
+		s->simp[i] = alloc(dbl, nvar);
 	}
-	fvalue = alloc(dbl, nvar+1);
+	s->fvalue = alloc(dbl, nvar+1);
 	
-	xcentroid = alloc(dbl, nvar);
+	s->xcentroid = alloc(dbl, nvar);
 	
-	xreflect  = alloc(dbl, nvar);
-	xcontract = alloc(dbl, nvar);
-	xexpand   = alloc(dbl, nvar);
+	s->xreflect  = alloc(dbl, nvar);
+	s->xcontract = alloc(dbl, nvar);
+	s->xexpand   = alloc(dbl, nvar);
+	s->ih = s->is = s->il = 0;
 }
 
-static void initial_simplex(dbl *xinit, dbl length)
+static void finalize(simplex *s)
 {
-	int	i, j;
+	int	i;
+	
+	for (i=0; i<=s->nvar; i++) {
+		free(s->simp[i]);
+	}
+	free(s->simp);
+	free(s->fvalue);
+	free(s->xcentroid);
+	free(s->xreflect);
+	free(s->xcontract);
+	free(s->xexpand);
+}
+
+static void initial_simplex(simplex *s, dbl *xinit, dbl length, dbl *scale)
+{
+	int	i, j, nvar = s->nvar;
 	dbl	a, d1, d2, *v;
 	
 	a = nvar + 1;
 	d1 = (sqrt(a) + nvar - 1)/sqrt(2.00)/nvar;
 	d2 = (sqrt(a) - 1)/sqrt(2.00)/nvar;
 	
-	v = simp[0];
+	v = s->simp[0];
 	for (j=0; j<nvar; j++) v[j] = 0.00;
 	for (i=1; i<=nvar; i++) {
-		v = simp[i];
+		v = s->simp[i];
 		for (j=0; j<nvar; j++) {
 			v[j] = d2;
 		}
@@ -95,101 +122,131 @@ static void initial_simplex(dbl *xinit, dbl length)
 	}
 	
 	for (i=0; i<=nvar; i++) {
-		v = simp[i];
+		v = s->simp[i];
 		scalarvector(nvar, v, length, v);
+		if (scale) {
+			for (j=0; j<nvar; j++) v[j] *= scale[j];
+		}
 		vectoradd(nvar, v, xinit, v);
 	}
 }
 
-static void search_simplex()
+static void search_simplex(simplex *s)
 {
 	int	i;
+	dbl	*fvalue = s->fvalue;
 	
 	if (fvalue[0] > fvalue[1]) {
-		ih = 0;
-		is = il = 1;
+		s->ih = 0;
+		s->is = s->il = 1;
 	} else {
-		ih = 1;
-		is = il = 0;
+		s->ih = 1;
+		s->is = s->il = 0;
 	}
-	/* fprintf(stderr, "%d %d %d\n", ih, is, il); */
+	/* fprintf(stderr, "%d %d %d\n", s->ih, s->is, s->il); */
 	
-	for (i=2; i<=nvar; i++) {
-		if (fvalue[i] > fvalue[ih]) {
-			is = ih;
-			ih = i;
-		} else if (fvalue[i] > fvalue[is]) {
-			is = i;
-		} else if (fvalue[i] < fvalue[il]) {
-			il = i;
+	for (i=2; i<=s->nvar; i++) {
+		if (fvalue[i] > fvalue[s->ih]) {
+			s->is = s->ih;
+			s->ih = i;
+		} else if (fvalue[i] > fvalue[s->is]) {
+			s->is = i;
+		} else if (fvalue[i] < fvalue[s->il]) {
+			s->il = i;
 		}
-		/* fprintf(stderr, "%d %d %d\n", ih, is, il); */
+		/* fprintf(stderr, "%d %d %d\n", s->ih, s->is, s->il); */
 	}
 }
 
-static void compute_xcentroid()
+static void compute_xcentroid(simplex *s)
 {
-	int	i, j;
+	int	i, j, nvar = s->nvar;
 	dbl	*x;
 	
-	for (j=0; j<nvar; j++) xcentroid[j] = 0.00;
+	for (j=0; j<nvar; j++) s->xcentroid[j] = 0.00;
 	for (i=0; i<=nvar; i++) {
-		if (i == ih) continue;
-		x = simp[i];
-		for (j=0; j<nvar; j++) xcentroid[j] += x[j];
+		if (i == s->ih) continue;
+		x = s->simp[i];
+		for (j=0; j<nvar; j++) s->xcentroid[j] += x[j];
 	}
-	for (j=0; j<nvar; j++) xcentroid[j] /= nvar;
+	for (j=0; j<nvar; j++) s->xcentroid[j] /= nvar;
 }
 
-static void compute_fmean_fvar()
+static void compute_fmean_fvar(simplex *s)
 {
-	int	i;
+	int	i, nvar = s->nvar;
 	dbl	d;
 	
-	fmean = 0.00;
-	for (i=0; i<=nvar; i++) fmean += fvalue[i];
-	fmean /= (nvar+1);
+	s->fmean = 0.00;
+	for (i=0; i<=nvar; i++) s->fmean += s->fvalue[i];
+	s->fmean /= (nvar+1);
 	
-	fvar = 0.00;
+	s->fvar = 0.00;
 	for (i=0; i<=nvar; i++) {
-		d = fvalue[i] - fmean;
-		fvar += d*d;
+		d = s->fvalue[i] - s->fmean;
+		s->fvar += d*d;
 	}
-	fvar /= (nvar+1);
+	s->fvar /= (nvar+1);
 }
 
-static void reflection()
+static void reflection(simplex *s)
 {
 	int	j;
 	dbl	*xh;
 	
-	xh = simp[ih];
-	for (j=0; j<nvar; j++) {
-		xreflect[j] = (1+al)*xcentroid[j] - al*xh[j];
+	xh = s->simp[s->ih];
+	for (j=0; j<s->nvar; j++) {
+		s->xreflect[j] = (1+al)*s->xcentroid[j] - al*xh[j];
 	}
-	freflect = (*objective)(nvar, xreflect);
+	s->freflect = (*s->objective)(s->nvar, s->xreflect);
 }
 
-static void contraction()
+static void contraction(simplex *s)
 {
 	int	j;
 	dbl	*xh;
 	
-	xh = simp[ih];
-	for (j=0; j<nvar; j++) {
-		xcontract[j] = (1-bt)*xcentroid[j] + bt*xh[j];
+	xh = s->simp[s->ih];
+	for (j=0; j<s->nvar; j++) {
+		s->xcontract[j] = (1-bt)*s->xcentroid[j] + bt*xh[j];
 	}
-	fcontract = (*objective)(nvar, xcontract);
+	s->fcontract = (*s->objective)(s->nvar, s->xcontract);
 }
 
-static void expansion()
+static void expansion(simplex *s)
 {
 	int	j;
 	
-	for (j=0; j<nvar; j++) {
-		xexpand[j] = gm*xreflect[j] + (1-gm)*xcentroid[j];
+	for (j=0; j<s->nvar; j++) {
+		s->xexpand[j] = gm*s->xreflect[j] + (1-gm)*s->xcentroid[j];
 	}
-	fexpand = (*objective)(nvar, xexpand);
+	s->fexpand = (*s->objective)(s->nvar, s->xexpand);
+}
+
+/*
+	set a function that is checked once per iteration;
+	the search stops with failure when it returns nonzero
+	(0 removes the check; the setting is per thread and
+	is read when a search starts)
+*/
+extern void NelderMeadInterrupt(f)
+int	(*f)();
+{
+	interrupt = f;
+}
+
+/*
+	scale the initial simplex along each axis: its edge along
+	axis j is length * scale[j], so variables of different
+	magnitudes start with steps of the same relative size
+	(0 = the same length for all; the array is read when a
+	search starts and must hold one value per variable;
+	the setting is per thread)
+*/
+extern void NelderMeadScales(scale)
+dbl	*scale;
+{
+	scales = scale;
 }
 
 /*
@@ -220,75 +277,85 @@ dbl	eps;
 {
 	status	stat = failure;
 	int	count, i;
+	int	(*stop)() = interrupt;	/* the objective may change it for its own searches */
+	simplex	state, *s = &state;
+	dbl	*fvalue, **simp;
 	
-	nvar = n;
-	objective = f;
+	s->nvar = n;
+	s->objective = f;
 	
-	initialize();
-	initial_simplex(xinit, length);
-	/* fprint_simplex(stderr); */
-	for (i=0; i<=nvar; i++) {
-		fvalue[i] = (*objective)(nvar, simp[i]);
+	initialize(s);
+	fvalue = s->fvalue;
+	simp = s->simp;
+	initial_simplex(s, xinit, length, scales);
+	/* fprint_simplex(stderr, s); */
+	for (i=0; i<=n; i++) {
+		fvalue[i] = (*f)(n, simp[i]);
 	}
-	/* vectorfprint(stderr, nvar+1, fvalue); */
+	/* vectorfprint(stderr, n+1, fvalue); */
 	
 	for (count=0; count<timeout; count++) {
-		search_simplex();
-		compute_xcentroid();
-		/* fprint_points(stderr); */
+		search_simplex(s);
+		compute_xcentroid(s);
+		/* fprint_points(stderr, s); */
 		
-		compute_fmean_fvar();
-		/* fprintf(stderr, "fvar = %40.35f\n", fvar); */
-		if (fvar <= eps) {
+		compute_fmean_fvar(s);
+		/* fprintf(stderr, "fvar = %40.35f\n", s->fvar); */
+		if (s->fvar <= eps) {
 			stat = success;
 			break;
 		}
 #if Debug
 		if (count % SKIPTIME == 0) {
-			fprintf(stderr, "k = %d   f = %lg\n", count, fvalue[il]);
-			/* vectorfprint(stderr, nvar, xinit); */
+			fprintf(stderr, "k = %d   f = %lg\n", count, fvalue[s->il]);
+			/* vectorfprint(stderr, n, xinit); */
 		}
 #endif
-		reflection();
-		if (freflect <= fvalue[is]) {
-			if (freflect >= fvalue[il]) {
-				vectorcopy(nvar, simp[ih], xreflect);
-				fvalue[ih] = freflect;
+		if (stop && (*stop)()) {
+			break;
+		}
+		reflection(s);
+		if (s->freflect <= fvalue[s->is]) {
+			if (s->freflect >= fvalue[s->il]) {
+				vectorcopy(n, simp[s->ih], s->xreflect);
+				fvalue[s->ih] = s->freflect;
 			} else {
-				expansion();
-				if (fexpand < fvalue[il]) {
-					vectorcopy(nvar, simp[ih], xexpand);
-					fvalue[ih] = fexpand;
+				expansion(s);
+				if (s->fexpand < fvalue[s->il]) {
+					vectorcopy(n, simp[s->ih], s->xexpand);
+					fvalue[s->ih] = s->fexpand;
 				} else {
-					vectorcopy(nvar, simp[ih], xreflect);
-					fvalue[ih] = freflect;
+					vectorcopy(n, simp[s->ih], s->xreflect);
+					fvalue[s->ih] = s->freflect;
 				}
 			}
 		} else {
-			if (freflect < fvalue[ih]) {
-				vectorcopy(nvar, simp[ih], xreflect);
-				fvalue[ih] = freflect;
+			if (s->freflect < fvalue[s->ih]) {
+				vectorcopy(n, simp[s->ih], s->xreflect);
+				fvalue[s->ih] = s->freflect;
 			}
-			contraction();
-			if (fcontract < fvalue[ih]) {
-				vectorcopy(nvar, simp[ih], xcontract);
-				fvalue[ih] = fcontract;
+			contraction(s);
+			if (s->fcontract < fvalue[s->ih]) {
+				vectorcopy(n, simp[s->ih], s->xcontract);
+				fvalue[s->ih] = s->fcontract;
 			} else {
-				for (i=0; i<=nvar; i++) {
-					if (i == il) continue;
-					vectoradd(nvar, simp[i], simp[i], simp[il]);
-					scalarvector(nvar, simp[i], 0.50, simp[i]);
-					fvalue[i] = (*objective)(nvar, simp[i]);
+				for (i=0; i<=n; i++) {
+					if (i == s->il) continue;
+					vectoradd(n, simp[i], simp[i], simp[s->il]);
+					scalarvector(n, simp[i], 0.50, simp[i]);
+					fvalue[i] = (*f)(n, simp[i]);
 				}
 			}
 		}
 #if Debug
-		/* fprintf(stderr, "%d : min = %lf\n", count, fvalue[il]); */
+		/* fprintf(stderr, "%d : min = %lf\n", count, fvalue[s->il]); */
 #endif
 	}
 	
-	vectorcopy(nvar, xinit, simp[il]);
-	*fopt = fvalue[il];
+	METRIC_ADD(METRIC_NM_ITERATIONS, count);
+	vectorcopy(n, xinit, simp[s->il]);
+	*fopt = fvalue[s->il];
+	finalize(s);
 	
 	return stat;
 }
@@ -0,0 +1,167 @@
+#include <string.h>
+#include "nullcline.h"
+#include "cvodesim.h"
+#include "metrics.h"
+
+#define NULLCLINE_TOL         1.0e-10   //sum of squares of the ode function accepted as a steady state
+#define NULLCLINE_ITER        20        //Newton iterations from each cell
+#define NULLCLINE_POLISH_TOL  1.0e-16   //sum of squares reached by the steps that confirm a state
+#define NULLCLINE_POLISH_ITER 10
+#define NULLCLINE_MARGIN      1.0e-9    //relative distance outside the box at which a state still counts
+#define NULLCLINE_SAME        1.0e-6    //relative distance below which two states are the same
+
+static double gridValue(double lo, double hi, int k, int M)
+{
+   double t = (double)k / (double)M;
+   return ((lo > 0 && hi > 0) ? lo * pow(hi / lo, t) : lo + t * (hi - lo));
+}
+
+/*the ode function at the nodes of one row*/
+static void evaluateRow(int M, double * xs, double y, void (*odefnc)(double,double*,double*,void*), void * params,
+                        double * F0, double * F1)
+{
+   int c, k, K;
+   double T[ODE_BATCH_SIZE], X[2*ODE_BATCH_SIZE], DX[2*ODE_BATCH_SIZE];
+   void * P[ODE_BATCH_SIZE];
+
+   for (c=0; c <= M; c += K)
+   {
+      K = (M + 1 - c < ODE_BATCH_SIZE) ? (M + 1 - c) : ODE_BATCH_SIZE;
+      for (k=0; k < K; ++k)
+      {
+         T[k] = 0.0;
+         P[k] = params;
+         X[k] = xs[c+k];
+         X[K+k] = y;
+      }
+      ODEevaluateBatch(2, K, T, X, DX, odefnc, P);
+      for (k=0; k < K; ++k)
+      {
+         F0[c+k] = DX[k];
+         F1[c+k] = DX[K+k];
+      }
+   }
+   METRIC_ADD(METRIC_RHS_EVALS, M + 1);
+}
+
+/*1 if a state found already lies in the cell (its Newton iterations would find it again)*/
+static int cellKnown(double * roots, int n, double * xs, double * ys, int c, int j)
+{
+   int k;
+   for (k=0; k < n; ++k)
+      if (roots[2*k] >= xs[c] && roots[2*k] <= xs[c+1] && roots[2*k+1] >= ys[j] && roots[2*k+1] <= ys[j+1])
+         return (1);
+   return (0);
+}
+
+double * nullclineRoots(double * lower, double * upper, int grid, void (*odefnc)(double,double*,double*,void*), void * params,
+                        int * n, double * nearMiss)
+{
+   int c, j, k, r, M = grid, numCells = 0, maxCells = 16, numRoots = 0, maxRoots = 4;
+   (*n) = 0;
+   if (nearMiss) (*nearMiss) = -1.0;
+   if (lower == 0 || upper == 0 || odefnc == 0 || M < 1 || !(upper[0] > lower[0]) || !(upper[1] > lower[1]))
+      return (0);
+
+   double * xs = METRIC_MALLOC((M+1)*sizeof(double)), * ys = METRIC_MALLOC((M+1)*sizeof(double));
+   double * F = METRIC_MALLOC(6*(M+1)*sizeof(double));   //three rows of du[0] and du[1]
+   char * crossed = METRIC_CALLOC(2*M, sizeof(char));     //the last two rows of cells: crossed by both nullclines
+   int * cells = METRIC_MALLOC(2*maxCells*sizeof(int));
+   double best = HUGE_VAL;
+   for (k=0; k <= M; ++k)
+   {
+      xs[k] = gridValue(lower[0], upper[0], k, M);
+      ys[k] = gridValue(lower[1], upper[1], k, M);
+   }
+
+   for (r=0; r <= M; ++r)
+   {
+      double * A0 = F + 2*((r+2)%3)*(M+1), * A1 = A0 + (M+1),   //row r-1
+             * B0 = F + 2*(r%3)*(M+1), * B1 = B0 + (M+1);       //row r
+      evaluateRow(M, xs, ys[r], odefnc, params, B0, B1);
+      if (r == 0) continue;
+
+      //cells between rows r-1 and r
+      char * cr = crossed + ((r-1)%2)*M;
+      #pragma omp simd
+      for (c=0; c < M; ++c)
+      {
+         double lo0 = fmin(fmin(A0[c], A0[c+1]), fmin(B0[c], B0[c+1])),
+                hi0 = fmax(fmax(A0[c], A0[c+1]), fmax(B0[c], B0[c+1])),
+                lo1 = fmin(fmin(A1[c], A1[c+1]), fmin(B1[c], B1[c+1])),
+                hi1 = fmax(fmax(A1[c], A1[c+1]), fmax(B1[c], B1[c+1]));
+         cr[c] = (lo0 <= 0 && hi0 >= 0 && lo1 <= 0 && hi1 >= 0);
+      }
+      for (c=0; c < M; ++c)
+         if (cr[c])
+         {
+            if (numCells >= maxCells)
+            {
+               maxCells *= 2;
+               cells = METRIC_REALLOC(cells, 2*maxCells*sizeof(int));
+            }
+            cells[2*numCells] = c;
+            cells[2*numCells+1] = r-1;
+            ++numCells;
+         }
+
+      //local minima of |f| along row r-1 whose four cells no nullcline crossing goes through
+      if (r < 2 || !nearMiss) continue;
+      double * Z0 = F + 2*((r+1)%3)*(M+1), * Z1 = Z0 + (M+1);   //row r-2
+      char * cz = crossed + (r%2)*M;                             //cells between rows r-2 and r-1
+      #pragma omp simd reduction(min:best)
+      for (c=1; c < M; ++c)
+      {
+         double s = A0[c]*A0[c] + A1[c]*A1[c];
+         int minimum = s <= A0[c-1]*A0[c-1] + A1[c-1]*A1[c-1] && s <= A0[c+1]*A0[c+1] + A1[c+1]*A1[c+1] &&
+                       s <= B0[c]*B0[c] + B1[c]*B1[c] && s <= Z0[c]*Z0[c] + Z1[c]*Z1[c] &&
+                       !cr[c-1] && !cr[c] && !cz[c-1] && !cz[c];
+         if (minimum && s < best) best = s;
+      }
+   }
+   if (nearMiss && best < HUGE_VAL) (*nearMiss) = sqrt(best);
+
+   //Newton iterations from the cells crossed by both nullclines
+   double * roots = METRIC_MALLOC(2*maxRoots*sizeof(double));
+   for (k=0; k < numCells; ++k)
+   {
+      c = cells[2*k];
+      j = cells[2*k+1];
+      if (cellKnown(roots, numRoots, xs, ys, c, j)) continue;
+
+      double x[2] = { 0.5 * (xs[c] + xs[c+1]), 0.5 * (ys[j] + ys[j+1]) };
+      if (!deflatedNewton(2, x, odefnc, params, 0, 0, NULLCLINE_TOL, NULLCLINE_ITER, 0) ||
+          !deflatedNewton(2, x, odefnc, params, 0, 0, NULLCLINE_POLISH_TOL, NULLCLINE_POLISH_ITER, 0))
+         continue;
+      for (r=0; r < 2; ++r)
+         if (x[r] < lower[r] - NULLCLINE_MARGIN * (1.0 + fabs(lower[r])) || x[r] > upper[r] + NULLCLINE_MARGIN * (1.0 + fabs(upper[r])))
+            break;
+      if (r < 2) continue;   //a state outside the box
+      for (r=0; r < numRoots; ++r)
+         if (fabs(x[0] - roots[2*r]) <= NULLCLINE_SAME * (1.0 + fabs(x[0])) && fabs(x[1] - roots[2*r+1]) <= NULLCLINE_SAME * (1.0 + fabs(x[1])))
+            break;
+      if (r < numRoots) continue;   //found already, from another cell
+
+      if (numRoots >= maxRoots)
+      {
+         maxRoots *= 2;
+         roots = METRIC_REALLOC(roots, 2*maxRoots*sizeof(double));
+      }
+      roots[2*numRoots] = x[0];
+      roots[2*numRoots+1] = x[1];
+      ++numRoots;
+   }
+
+   free(xs);
+   free(ys);
+   free(F);
+   free(crossed);
+   free(cells);
+   if (numRoots == 0)
+   {
+      free(roots);
+      roots = 0;
+   }
+   (*n) = numRoots;
+   return (roots);
+}
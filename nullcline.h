@@ -0,0 +1,32 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#ifndef GA_NULLCLINE_FILE
+#define GA_NULLCLINE_FILE
+
+/*
+ * All steady states of a system of two variables inside a box: the crossings of its two nullclines.
+ * The ode function is evaluated on a grid of (grid+1) x (grid+1) nodes, a row at a time and
+ * ODE_BATCH_SIZE nodes per call (see ODEevaluateBatch, which goes through the batch form of the
+ * ode function when one is set), and the corners of each cell are compared in vector loops:
+ * a cell where both du[0] and du[1] change sign is crossed by both nullclines, and Newton
+ * iterations from its centre (see deflatedNewton) locate the state there. Only three rows of the
+ * grid are kept. Every state more than a cell away from the others is found, so the count is
+ * exact once the grid is finer than the distance between the states (each grid line is spaced
+ * evenly in log when its lower bound is positive, which resolves small states better).
+ * The Newton iterations are charged to the budget (see ODEsetBudget); the grid is not
+ * @param: lower bounds of the two variables
+ * @param: upper bounds of the two variables
+ * @param: number of cells along each variable
+ * @param: ode function pointer
+ * @param: additional parameters needed for ode function
+ * @param: receives the number of states
+ * @param: receives how close the nullclines come elsewhere: the smallest norm of the ode function
+ *         at a local minimum of it on the grid away from the crossings, or -1 if there is none (may be null)
+ * @ret: the states, two values each, or 0 if there are none
+*/
+double * nullclineRoots(double * lower, double * upper, int grid, void (*odefnc)(double,double*,double*,void*), void * params,
+                        int * n, double * nearMiss);
+
+#endif
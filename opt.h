@@ -30,6 +30,12 @@ extern void	matrixrowaddtwo(int, int, int, dbl *, dbl *, int, dbl, int);
 extern void	matrixsearchcolumnmaxabs(int, int, dbl *, int, int, int,
 					 int *, dbl *);
 extern void	matrixinverse(int, dbl *, dbl *, dbl);
+extern dbl	matrixdeterminant(int, dbl *);
+extern status	matrixsolve(int, dbl *, dbl *, dbl *);
+extern status	matrixlu(int, dbl *, int *);
+extern void	matrixlusolve(int, dbl *, int *, dbl *);
+extern int	matrixsymmetriceigen(int, dbl *, dbl *, dbl *);
+extern int	matrixeigenvalues(int, dbl *, dbl *, dbl *);
 
 extern void	vectorfprint(FILE *, int, dbl *);
 extern void	vectorfscan(FILE *, int, dbl *);
@@ -63,6 +69,8 @@ extern status	TwoPhasemethod(int, int, dbl *, dbl *, dbl *, dbl *, dbl,
 extern status	QuasiNewtonMethod(int, dbl(), dbl *(), dbl *, dbl *, int, dbl);
 extern status	NelderMeadSimplexMethod(int, dbl(), dbl *, dbl, dbl *,
 					int, dbl);
+extern void	NelderMeadInterrupt(int ());
+extern void	NelderMeadScales(dbl *);
 extern status	MultiplierMethod(int, dbl (), dbl *(),
 				 int, dbl *(), dbl **(),
 				 int, dbl *(), dbl **(),
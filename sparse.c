@@ -0,0 +1,271 @@
+#include "sparse.h"
+#include "metrics.h"
+
+SparseMatrix * sparseNew(int n, int * rowptr, int * colind)
+{
+   int i, j, p, nnz = 0;
+   int * mark = METRIC_MALLOC(n * sizeof(int));
+   SparseMatrix * A = METRIC_MALLOC(sizeof(SparseMatrix));
+   (*A).n = n;
+   (*A).rowptr = METRIC_MALLOC((n+1) * sizeof(int));
+   (*A).colind = METRIC_MALLOC((rowptr[n] + n + 1) * sizeof(int));
+   for (j=0; j < n; ++j) mark[j] = -1;
+
+   /*each row: the diagonal and the listed columns, without duplicates, in order*/
+   for (i=0; i < n; ++i)
+   {
+      int start = nnz;
+      (*A).rowptr[i] = nnz;
+      mark[i] = i;
+      (*A).colind[nnz++] = i;
+      for (p = rowptr[i]; p < rowptr[i+1]; ++p)
+      {
+         j = colind[p];
+         if (j < 0 || j >= n || mark[j] == i) continue;
+         mark[j] = i;
+         (*A).colind[nnz++] = j;
+      }
+      for (p = start+1; p < nnz; ++p)   //insertion sort: rows are short
+      {
+         int c = (*A).colind[p], q;
+         for (q = p; q > start && (*A).colind[q-1] > c; --q) (*A).colind[q] = (*A).colind[q-1];
+         (*A).colind[q] = c;
+      }
+   }
+   (*A).rowptr[n] = nnz;
+   (*A).nnz = nnz;
+   (*A).values = METRIC_CALLOC(nnz + 1, sizeof(double));
+   (*A).rowind = METRIC_MALLOC((nnz + 1) * sizeof(int));
+   for (i=0; i < n; ++i)
+      for (p = (*A).rowptr[i]; p < (*A).rowptr[i+1]; ++p)
+         (*A).rowind[p] = i;
+
+   /*entries of each column*/
+   (*A).colptr = METRIC_CALLOC(n+1, sizeof(int));
+   (*A).colpos = METRIC_MALLOC((nnz + 1) * sizeof(int));
+   for (p=0; p < nnz; ++p) ++(*A).colptr[ (*A).colind[p] + 1 ];
+   for (j=0; j < n; ++j) (*A).colptr[j+1] += (*A).colptr[j];
+   for (j=0; j < n; ++j) mark[j] = (*A).colptr[j];
+   for (p=0; p < nnz; ++p) (*A).colpos[ mark[ (*A).colind[p] ]++ ] = p;
+
+   free(mark);
+   return (A);
+}
+
+SparseMatrix * sparseClone(SparseMatrix * A)
+{
+   int p;
+   SparseMatrix * B = sparseNew((*A).n, (*A).rowptr, (*A).colind);
+   for (p=0; p < (*A).nnz; ++p) (*B).values[p] = (*A).values[p];
+   return (B);
+}
+
+void sparseFree(SparseMatrix * A)
+{
+   if (A == NULL) return;
+   free((*A).rowptr);
+   free((*A).colind);
+   free((*A).rowind);
+   free((*A).values);
+   free((*A).colptr);
+   free((*A).colpos);
+   free(A);
+}
+
+void sparseMultiply(SparseMatrix * A, double * x, double * y)
+{
+   int i, p;
+   for (i=0; i < (*A).n; ++i)
+   {
+      y[i] = 0;
+      for (p = (*A).rowptr[i]; p < (*A).rowptr[i+1]; ++p)
+         y[i] += (*A).values[p] * x[ (*A).colind[p] ];
+   }
+}
+
+int sparseColor(SparseMatrix * A, int * color)
+{
+   int i, j, k, p, q, n = (*A).n, colors = 0;
+   int * order = METRIC_MALLOC(n * sizeof(int)), * forbidden = METRIC_MALLOC((n+1) * sizeof(int));
+   for (j=0; j < n; ++j) color[j] = -1;
+   for (j=0; j <= n; ++j) forbidden[j] = -1;
+
+   /*dense columns first: they constrain the most*/
+   for (j=0; j < n; ++j)
+   {
+      int len = (*A).colptr[j+1] - (*A).colptr[j];
+      for (k=j; k > 0 && (*A).colptr[order[k-1]+1] - (*A).colptr[order[k-1]] < len; --k) order[k] = order[k-1];
+      order[k] = j;
+   }
+
+   for (k=0; k < n; ++k)
+   {
+      j = order[k];
+      for (q = (*A).colptr[j]; q < (*A).colptr[j+1]; ++q)   //colors of the columns that share a row with j
+      {
+         i = (*A).rowind[ (*A).colpos[q] ];
+         for (p = (*A).rowptr[i]; p < (*A).rowptr[i+1]; ++p)
+            if (color[ (*A).colind[p] ] >= 0) forbidden[ color[ (*A).colind[p] ] ] = j;
+      }
+      for (i=0; forbidden[i] == j; ++i) ;
+      color[j] = i;
+      if (i >= colors) colors = i+1;
+   }
+   free(order);
+   free(forbidden);
+   return (colors);
+}
+
+SparseLU * sparseLUNew(int n)
+{
+   SparseLU * lu = METRIC_MALLOC(sizeof(SparseLU));
+   (*lu).n = n;
+   (*lu).Lcap = (*lu).Ucap = 4*n + 16;
+   (*lu).Lp = METRIC_MALLOC((n+1) * sizeof(int));
+   (*lu).Up = METRIC_MALLOC((n+1) * sizeof(int));
+   (*lu).Li = METRIC_MALLOC((*lu).Lcap * sizeof(int));
+   (*lu).Ui = METRIC_MALLOC((*lu).Ucap * sizeof(int));
+   (*lu).Lx = METRIC_MALLOC((*lu).Lcap * sizeof(double));
+   (*lu).Ux = METRIC_MALLOC((*lu).Ucap * sizeof(double));
+   (*lu).w = METRIC_MALLOC(n * sizeof(double));
+   (*lu).mark = METRIC_MALLOC(n * sizeof(int));
+   (*lu).heap = METRIC_MALLOC(n * sizeof(int));
+   (*lu).upper = METRIC_MALLOC(n * sizeof(int));
+   return (lu);
+}
+
+void sparseLUFree(SparseLU * lu)
+{
+   if (lu == NULL) return;
+   free((*lu).Lp);
+   free((*lu).Up);
+   free((*lu).Li);
+   free((*lu).Ui);
+   free((*lu).Lx);
+   free((*lu).Ux);
+   free((*lu).w);
+   free((*lu).mark);
+   free((*lu).heap);
+   free((*lu).upper);
+   free(lu);
+}
+
+/*min-heap of column indices*/
+static void heapPush(int * heap, int * size, int k)
+{
+   int i = (*size)++;
+   while (i > 0 && heap[(i-1)/2] > k)
+   {
+      heap[i] = heap[(i-1)/2];
+      i = (i-1)/2;
+   }
+   heap[i] = k;
+}
+
+static int heapPop(int * heap, int * size)
+{
+   int top = heap[0], last = heap[--(*size)], i = 0, c;
+   while ((c = 2*i + 1) < (*size))
+   {
+      if (c+1 < (*size) && heap[c+1] < heap[c]) ++c;
+      if (heap[c] >= last) break;
+      heap[i] = heap[c];
+      i = c;
+   }
+   heap[i] = last;
+   return (top);
+}
+
+int sparseLUFactor(SparseLU * lu, SparseMatrix * A)
+{
+   int i, j, k, p, q, n = (*lu).n, nl = 0, nu = 0;
+   double * w = (*lu).w;
+   int * mark = (*lu).mark, * heap = (*lu).heap, * upper = (*lu).upper;
+   if ((*A).n != n) return (0);
+   for (j=0; j < n; ++j) mark[j] = -1;
+   (*lu).Lp[0] = (*lu).Up[0] = 0;
+
+   for (i=0; i < n; ++i)
+   {
+      int nh = 0, nup = 0;
+      double big = 0;
+
+      /*scatter row i of A*/
+      for (p = (*A).rowptr[i]; p < (*A).rowptr[i+1]; ++p)
+      {
+         j = (*A).colind[p];
+         w[j] = (*A).values[p];
+         if (fabs(w[j]) > big) big = fabs(w[j]);
+         mark[j] = i;
+         if (j < i) heapPush(heap, &nh, j);
+         else if (j > i) upper[nup++] = j;
+      }
+      if (mark[i] != i)
+      {
+         mark[i] = i;
+         w[i] = 0;
+      }
+
+      /*eliminate the columns left of the diagonal in increasing order; fill-in joins the row*/
+      while (nh > 0)
+      {
+         k = heapPop(heap, &nh);
+         double l = w[k] / (*lu).Ux[ (*lu).Up[k] ];
+         if (l == 0) continue;
+         if (nl >= (*lu).Lcap)
+         {
+            (*lu).Lcap *= 2;
+            (*lu).Li = METRIC_REALLOC((*lu).Li, (*lu).Lcap * sizeof(int));
+            (*lu).Lx = METRIC_REALLOC((*lu).Lx, (*lu).Lcap * sizeof(double));
+         }
+         (*lu).Li[nl] = k;
+         (*lu).Lx[nl++] = l;
+         for (q = (*lu).Up[k] + 1; q < (*lu).Up[k+1]; ++q)
+         {
+            j = (*lu).Ui[q];
+            if (mark[j] != i)
+            {
+               mark[j] = i;
+               w[j] = 0;
+               if (j < i) heapPush(heap, &nh, j);
+               else upper[nup++] = j;
+            }
+            w[j] -= l * (*lu).Ux[q];
+         }
+      }
+
+      /*row i of U*/
+      if (!(fabs(w[i]) > 1.0e-12 * big)) return (0);   //also when the row is not finite
+      if (nu + nup + 1 > (*lu).Ucap)
+      {
+         while (nu + nup + 1 > (*lu).Ucap) (*lu).Ucap *= 2;
+         (*lu).Ui = METRIC_REALLOC((*lu).Ui, (*lu).Ucap * sizeof(int));
+         (*lu).Ux = METRIC_REALLOC((*lu).Ux, (*lu).Ucap * sizeof(double));
+      }
+      (*lu).Ui[nu] = i;
+      (*lu).Ux[nu++] = w[i];
+      for (p=0; p < nup; ++p)
+      {
+         (*lu).Ui[nu] = upper[p];
+         (*lu).Ux[nu++] = w[ upper[p] ];
+      }
+      (*lu).Lp[i+1] = nl;
+      (*lu).Up[i+1] = nu;
+   }
+   return (1);
+}
+
+void sparseLUSolve(SparseLU * lu, double * b)
+{
+   int i, p, n = (*lu).n;
+   for (i=0; i < n; ++i)
+      for (p = (*lu).Lp[i]; p < (*lu).Lp[i+1]; ++p)
+         b[i] -= (*lu).Lx[p] * b[ (*lu).Li[p] ];
+   for (i=n-1; i >= 0; --i)
+   {
+      double s = b[i];
+      for (p = (*lu).Up[i] + 1; p < (*lu).Up[i+1]; ++p)
+         s -= (*lu).Ux[p] * b[ (*lu).Ui[p] ];
+      b[i] = s / (*lu).Ux[ (*lu).Up[i] ];
+   }
+}
@@ -0,0 +1,115 @@
+#include <stdlib.h>
+#include <math.h>
+
+#ifndef GA_SPARSE_FILE
+#define GA_SPARSE_FILE
+
+/*
+ * square sparse matrix in compressed sparse row (CSR) form. The columns of a row are in
+ * increasing order and the diagonal is always stored, so the pattern of a Jacobian J is also
+ * the pattern of I - gamma J. colptr/colpos list the entries of each column, for building
+ * the matrix one column at a time, and rowind is the row of each entry
+*/
+typedef struct
+{
+   int n;          //rows and columns
+   int nnz;        //stored entries
+   int * rowptr;   //n+1 offsets of the rows in colind and values
+   int * colind;   //column of each entry
+   int * rowind;   //row of each entry
+   double * values;
+   int * colptr;   //n+1 offsets of the columns in colpos
+   int * colpos;   //the entries of each column, as positions in colind and values
+} SparseMatrix;
+
+/*
+ * a matrix with the given pattern (plus the diagonal) and all values 0
+ * @param: number of rows and columns
+ * @param: n+1 row offsets
+ * @param: column of each entry (any order, duplicates allowed)
+ * @ret: new matrix
+*/
+SparseMatrix * sparseNew(int n, int * rowptr, int * colind);
+
+/*
+ * a matrix with the pattern of another one and its own values
+ * @param: matrix
+ * @ret: new matrix (values copied)
+*/
+SparseMatrix * sparseClone(SparseMatrix *);
+
+/*
+ * free a matrix
+ * @param: matrix (may be null)
+*/
+void sparseFree(SparseMatrix *);
+
+/*
+ * y = A x
+ * @param: matrix
+ * @param: vector x
+ * @param: receives A x
+*/
+void sparseMultiply(SparseMatrix *, double * x, double * y);
+
+/*
+ * Color the columns so that no two columns of a color have an entry in the same row
+ * (greedy, in order of decreasing column count). The columns of a color can then be
+ * perturbed together: one function evaluation gives all of their finite differences
+ * (Curtis, Powell and Reid 1974)
+ * @param: matrix
+ * @param: receives the color of each column (0 to colors-1)
+ * @ret: number of colors
+*/
+int sparseColor(SparseMatrix *, int * color);
+
+/*
+ * LU factors of a sparse matrix: L unit lower triangular and U upper triangular,
+ * both stored by rows (the diagonal of U first in each of its rows)
+*/
+typedef struct
+{
+   int n;
+   int * Lp, * Li;     //rows of L without the diagonal
+   double * Lx;
+   int * Up, * Ui;     //rows of U, diagonal first
+   double * Ux;
+   int Lcap, Ucap;     //allocated entries of L and U
+   double * w;         //dense work row
+   int * mark;         //row that last touched each column
+   int * heap;         //columns left of the diagonal still to be eliminated (min-heap)
+   int * upper;        //columns right of the diagonal in the current row
+} SparseLU;
+
+/*
+ * allocate the factors of an n x n matrix; they grow when a factorization needs more room
+ * @param: number of rows and columns
+ * @ret: new factors
+*/
+SparseLU * sparseLUNew(int n);
+
+/*
+ * free the factors
+ * @param: factors (may be null)
+*/
+void sparseLUFree(SparseLU *);
+
+/*
+ * Factor a matrix by rows (Gaussian elimination in natural order without pivoting). The work
+ * is proportional to the nonzeros of L and U (including fill-in), not to n^2 or n^3. Without
+ * pivoting a zero or tiny pivot stops the factorization; for I - gamma J and for Jacobians
+ * of reaction networks (every species decays or is consumed) the diagonal is rarely small
+ * @param: factors
+ * @param: matrix
+ * @ret: 1 on success, 0 if a pivot is below 1e-12 times the largest entry of its row
+*/
+int sparseLUFactor(SparseLU *, SparseMatrix *);
+
+/*
+ * solve A x = b with the factors of A
+ * @param: factors
+ * @param: b on input, x on output
+*/
+void sparseLUSolve(SparseLU *, double *);
+
+#endif
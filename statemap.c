@@ -0,0 +1,411 @@
+#include <string.h>
+#include "statemap.h"
+#include "cvodesim.h"
+#include "opt.h"
+
+#define STATEMAP_TOL         1.0e-10   //sum of squares of the ode function accepted as a steady state
+#define STATEMAP_ITER        30        //Newton iterations from each seed
+#define STATEMAP_POLISH_TOL  1.0e-16   //sum of squares reached by the steps that confirm a zero
+#define STATEMAP_POLISH_ITER 10
+#define STATEMAP_NEGATIVE    1.0e-8    //a variable below -STATEMAP_NEGATIVE makes a zero not a state
+#define STATEMAP_SAME        1.0e-6    //relative distance below which two zeros are the same
+
+/*one cell to solve and the cells whose states seed it*/
+typedef struct
+{
+   int cell;
+   int corners[4];
+} Task;
+
+/*a rectangle of cells, corners included*/
+typedef struct
+{
+   int x0, x1, y0, y1;
+} Block;
+
+/*one scan*/
+typedef struct
+{
+   int N;
+   Parameters * p;                                 //the other parameters, all alphas 1
+   void (*odefnc)(double,double*,double*,void*);
+   StateMap * map;
+   double * xs, * ys;                              //values of the parameters along each axis
+   double ** states;                               //nx*ny: the states of each solved cell (or 0)
+   unsigned char * numStates;                      //nx*ny: how many
+   char * done;                                    //nx*ny: 1 = solved
+} Scan;
+
+static double axisValue(double lo, double hi, int logScale, int i, int n)
+{
+   double t = (double)i / (double)(n - 1);
+   return (logScale ? lo * pow(hi / lo, t) : lo + t * (hi - lo));
+}
+
+static int sameZero(int N, double * a, double * b)
+{
+   int i;
+   for (i=0; i < N; ++i)
+      if (fabs(a[i] - b[i]) > STATEMAP_SAME * (1.0 + fabs(a[i]))) return (0);
+   return (1);
+}
+
+/*
+ * more Newton steps on a zero: it is found to about the square root of STATEMAP_TOL, too coarse to
+ * tell it from the same zero found from another seed, and where the variables are small f can be
+ * below STATEMAP_TOL away from any zero. A zero goes on to STATEMAP_POLISH_TOL in a few steps
+*/
+static int polish(Scan * S, double * x, Parameters * q)
+{
+   return (deflatedNewton((*S).N, x, (*S).odefnc, (void*)q, 0, 0, STATEMAP_POLISH_TOL, STATEMAP_POLISH_ITER, 0));
+}
+
+/*add x to the zeros unless it is there already; returns 1 if it was added*/
+static int addZero(int N, double * x, double * zeros, int * numZeros)
+{
+   int k;
+   for (k=0; k < *numZeros; ++k)
+      if (sameZero(N, x, zeros + k*N)) return (0);
+   if (*numZeros >= 2*STATEMAP_MAX_STATES) return (0);
+   memcpy(zeros + (*numZeros)*N, x, N*sizeof(double));
+   ++(*numZeros);
+   return (1);
+}
+
+/*
+ * solve one cell: Newton iterations from each seed, then, if the number of zeros found is not the
+ * one expected (a seed converged to the zero of another one, or the cell is across a fold from
+ * the seeds and only one of the two new zeros was found) or discover is on, deflated Newton
+ * iterations from more points, as findZeros does. Keeps the non-negative zeros as the states of the cell
+ * @param: scan
+ * @param: cell index
+ * @param: initial points
+ * @param: number of initial points
+ * @param: number of zeros expected (the most states of the cells the seeds come from)
+ * @param: 1 = look for zeros away from the seeds too
+*/
+static void solveCell(Scan * S, int cell, double ** seeds, int numSeeds, int expected, int discover)
+{
+   int i, j, k, numZeros = 0, count = 0, stable = 0, N = (*S).N;
+   StateMap * map = (*S).map;
+   double * zeros = malloc(2*STATEMAP_MAX_STATES*N*sizeof(double)), * x = malloc(N*sizeof(double));
+   double * known[2*STATEMAP_MAX_STATES], * wr = malloc(N*sizeof(double)), * wi = malloc(N*sizeof(double));
+   Parameters * q = (Parameters*)clone((void*)(*S).p);
+
+   (*q).params[(*map).paramX] = (*S).xs[cell % (*map).nx];
+   (*q).params[(*map).paramY] = (*S).ys[cell / (*map).nx];
+
+   for (k=0; k < numSeeds; ++k)
+   {
+      memcpy(x, seeds[k], N*sizeof(double));
+      if (deflatedNewton(N, x, (*S).odefnc, (void*)q, 0, 0, STATEMAP_TOL, STATEMAP_ITER, 0) && polish(S, x, q))
+         addZero(N, x, zeros, &numZeros);
+   }
+
+   //deflated iterations from the seeds, from the midpoints of the zeros found from them (a saddle
+   //often lies between two nodes) and, with discover, from points 10 units away from the first zero
+   int numPairs = numZeros * (numZeros - 1) / 2, numStarts = numSeeds + numPairs + ((discover && numZeros > 0) ? N : 0);
+   int a = 0, b = 1;
+   if (discover || numZeros != expected)
+      for (j=0; j < numStarts && numZeros < 2*STATEMAP_MAX_STATES; ++j)
+      {
+         if (j < numSeeds)
+            memcpy(x, seeds[j], N*sizeof(double));
+         else if (j < numSeeds + numPairs)
+         {
+            for (i=0; i < N; ++i) x[i] = 0.5 * (zeros[a*N + i] + zeros[b*N + i]);
+            if (++a == b) { a = 0; ++b; }
+         }
+         else
+         {
+            memcpy(x, zeros, N*sizeof(double));
+            x[j - numSeeds - numPairs] += 10.0;
+         }
+         for (k=0; k < numZeros; ++k) known[k] = zeros + k*N;
+         if (deflatedNewton(N, x, (*S).odefnc, (void*)q, known, numZeros, STATEMAP_TOL, STATEMAP_ITER, 0) &&
+             polish(S, x, q) && addZero(N, x, zeros, &numZeros) && j < numSeeds)
+            --j;   //the same seed again, with one more zero deflated
+      }
+
+   //keep the non-negative zeros, and count the stable ones
+   for (k=0; k < numZeros; ++k)
+   {
+      double * z = zeros + k*N;
+      for (i=0; i < N && z[i] > -STATEMAP_NEGATIVE; ++i) ;
+      if (i < N || count >= STATEMAP_MAX_STATES) continue;
+      if (count < k) memcpy(zeros + count*N, z, N*sizeof(double));
+      ++count;
+
+      double * J = jacobian(N, zeros + (count-1)*N, (*S).odefnc, (void*)q);
+      if (J && matrixeigenvalues(N, J, wr, wi) >= 0)
+      {
+         for (i=0; i < N && wr[i] < 0; ++i) ;
+         if (i == N) ++stable;
+      }
+      free(J);
+   }
+
+   free((*S).states[cell]);   //solved again (the seeds are no longer needed)
+   (*S).states[cell] = 0;
+   if (count > 0)
+   {
+      (*S).states[cell] = realloc(zeros, count*N*sizeof(double));
+      zeros = 0;
+   }
+   (*S).numStates[cell] = (unsigned char)count;
+   (*map).cells[cell] = (unsigned char)(((count > 15) ? 15 : count) | (((stable > 7) ? 7 : stable) << 4));
+   (*S).done[cell] = 1;
+
+   deleteIndividual((void*)q);
+   free(zeros);
+   free(x);
+   free(wr);
+   free(wi);
+}
+
+/*solve a cell from the states of the given cells (all solved)*/
+static void solveFrom(Scan * S, int cell, int * from, int numFrom, double ** extra, int numExtra, int discover)
+{
+   int j, k, numSeeds = 0, expected = 0, N = (*S).N;
+   double ** seeds = malloc((numFrom*STATEMAP_MAX_STATES + numExtra)*sizeof(double*));
+   for (j=0; j < numFrom; ++j)
+   {
+      for (k=0; k < (*S).numStates[ from[j] ]; ++k)
+         seeds[numSeeds++] = (*S).states[ from[j] ] + k*N;
+      if ((*S).numStates[ from[j] ] > expected) expected = (*S).numStates[ from[j] ];
+   }
+   for (k=0; k < numExtra; ++k)
+      seeds[numSeeds++] = extra[k];
+   solveCell(S, cell, seeds, numSeeds, expected, discover);
+   free(seeds);
+}
+
+/*1 if the four corners of the block have the same count and stability*/
+static int uniform(Scan * S, Block * b)
+{
+   int nx = (*(*S).map).nx;
+   unsigned char * c = (*(*S).map).cells, c0 = c[ (*b).y0*nx + (*b).x0 ];
+   return (c[ (*b).y0*nx + (*b).x1 ] == c0 && c[ (*b).y1*nx + (*b).x0 ] == c0 && c[ (*b).y1*nx + (*b).x1 ] == c0);
+}
+
+/*coarse grid indices along an axis of n cells*/
+static int * coarseAxis(int n, int * m)
+{
+   int k;
+   *m = (n - 1 < STATEMAP_COARSE) ? (n - 1) : STATEMAP_COARSE;
+   int * g = malloc((*m + 1)*sizeof(int));
+   for (k=0; k <= *m; ++k) g[k] = (int)(((long)k * (n - 1)) / *m);
+   return (g);
+}
+
+StateMap * stateMap(Parameters * p, void (*odefnc)(double,double*,double*,void*), double ** seeds, int numSeeds,
+                    int paramX, double xmin, double xmax, int nx,
+                    int paramY, double ymin, double ymax, int ny, int refine)
+{
+   int i, j, k, cx, cy;
+   if (p == 0 || odefnc == 0 || seeds == 0 || numSeeds < 1 || nx < 2 || ny < 2 || paramX == paramY ||
+       paramX < 0 || paramX >= (*p).numParams || paramY < 0 || paramY >= (*p).numParams)
+      return (0);
+
+   StateMap * map = malloc(sizeof(StateMap));
+   (*map).nx = nx;
+   (*map).ny = ny;
+   (*map).paramX = paramX;
+   (*map).paramY = paramY;
+   (*map).xmin = xmin;
+   (*map).xmax = xmax;
+   (*map).ymin = ymin;
+   (*map).ymax = ymax;
+   (*map).logX = (xmin > 0 && xmax > 0);
+   (*map).logY = (ymin > 0 && ymax > 0);
+   (*map).cells = calloc(nx*ny, sizeof(unsigned char));
+   (*map).solved = 0;
+
+   Scan S;
+   S.N = (*p).numVars;
+   S.p = (Parameters*)clone((void*)p);
+   for (i=0; i < S.N; ++i) (*S.p).alphas[i] = 1.0;
+   S.odefnc = odefnc;
+   S.map = map;
+   S.xs = malloc(nx*sizeof(double));
+   S.ys = malloc(ny*sizeof(double));
+   for (i=0; i < nx; ++i) S.xs[i] = axisValue(xmin, xmax, (*map).logX, i, nx);
+   for (j=0; j < ny; ++j) S.ys[j] = axisValue(ymin, ymax, (*map).logY, j, ny);
+   S.states = calloc(nx*ny, sizeof(double*));
+   S.numStates = calloc(nx*ny, sizeof(unsigned char));
+   S.done = calloc(nx*ny, sizeof(char));
+
+   //coarse grid: a row per thread, each cell from the seeds and the cell before it
+   int * gx = coarseAxis(nx, &cx), * gy = coarseAxis(ny, &cy);
+   #pragma omp parallel for schedule(dynamic) private(i)
+   for (j=0; j <= cy; ++j)
+      for (i=0; i <= cx; ++i)
+      {
+         int before = gy[j]*nx + gx[i-(i>0)];
+         solveFrom(&S, gy[j]*nx + gx[i], &before, (i > 0), seeds, numSeeds, 1);
+      }
+
+   //spread the states over the coarse grid: each cell again from its own states and those of its
+   //four neighbours, the two colours of a checkerboard in turn (a cell reads only the other
+   //colour), until no cell gains a state
+   int sweep, colour, changed = 1;
+   for (sweep=0; changed && sweep < cx + cy; ++sweep)
+      for (changed=0, colour=0; colour < 2; ++colour)
+      {
+         #pragma omp parallel for schedule(dynamic) private(i) reduction(+:changed)
+         for (j=0; j <= cy; ++j)
+            for (i=(j + colour) % 2; i <= cx; i += 2)
+            {
+               int cell = gy[j]*nx + gx[i], from[5], numFrom = 0, before = S.numStates[cell];
+               from[numFrom++] = cell;
+               if (i > 0) from[numFrom++] = gy[j]*nx + gx[i-1];
+               if (i < cx) from[numFrom++] = gy[j]*nx + gx[i+1];
+               if (j > 0) from[numFrom++] = gy[j-1]*nx + gx[i];
+               if (j < cy) from[numFrom++] = gy[j+1]*nx + gx[i];
+               solveFrom(&S, cell, from, numFrom, 0, 0, 0);
+               if (S.numStates[cell] != before) ++changed;
+            }
+      }
+
+   int numBlocks = cx*cy, numUniform = 0;
+   Block * blocks = malloc(numBlocks*sizeof(Block)), * uniformBlocks = malloc(numBlocks*sizeof(Block));
+   for (j=0; j < cy; ++j)
+      for (i=0; i < cx; ++i)
+      {
+         Block b = { gx[i], gx[i+1], gy[j], gy[j+1] };
+         blocks[j*cx + i] = b;
+      }
+   free(gx);
+   free(gy);
+
+   //split the blocks in four until they are one cell wide: the midpoints of the ones with
+   //different corners are solved from the corners, in parallel
+   int maxUniform = numBlocks;
+   while (numBlocks > 0)
+   {
+      int numTasks = 0, numChildren = 0;
+      Task * tasks = malloc(5*numBlocks*sizeof(Task));
+      Block * children = malloc(4*numBlocks*sizeof(Block));
+
+      for (k=0; k < numBlocks; ++k)
+      {
+         Block b = blocks[k];
+         if (b.x1 - b.x0 <= 1 && b.y1 - b.y0 <= 1) continue;
+         if (refine && uniform(&S, &b))
+         {
+            if (numUniform >= maxUniform)
+            {
+               maxUniform *= 2;
+               uniformBlocks = realloc(uniformBlocks, maxUniform*sizeof(Block));
+            }
+            uniformBlocks[numUniform++] = b;
+            continue;
+         }
+
+         int xm = (b.x0 + b.x1) / 2, ym = (b.y0 + b.y1) / 2;
+         int mids[5][2] = { {xm,b.y0}, {xm,b.y1}, {b.x0,ym}, {b.x1,ym}, {xm,ym} };
+         for (i=0; i < 5; ++i)
+         {
+            int cell = mids[i][1]*nx + mids[i][0];
+            if (S.done[cell]) continue;
+            S.done[cell] = 2;   //queued
+            tasks[numTasks].cell = cell;
+            tasks[numTasks].corners[0] = b.y0*nx + b.x0;
+            tasks[numTasks].corners[1] = b.y0*nx + b.x1;
+            tasks[numTasks].corners[2] = b.y1*nx + b.x0;
+            tasks[numTasks].corners[3] = b.y1*nx + b.x1;
+            ++numTasks;
+         }
+
+         //split only the sides that are more than one cell long
+         int xs[3] = { b.x0, xm, b.x1 }, ys[3] = { b.y0, ym, b.y1 };
+         int sx = (b.x1 - b.x0 > 1) ? 2 : 1, sy = (b.y1 - b.y0 > 1) ? 2 : 1;
+         if (sx == 1) xs[1] = b.x1;
+         if (sy == 1) ys[1] = b.y1;
+         for (j=0; j < sy; ++j)
+            for (i=0; i < sx; ++i)
+            {
+               Block c = { xs[i], xs[i+1], ys[j], ys[j+1] };
+               children[numChildren++] = c;
+            }
+      }
+
+      #pragma omp parallel for schedule(dynamic)
+      for (k=0; k < numTasks; ++k)
+         solveFrom(&S, tasks[k].cell, tasks[k].corners, 4, 0, 0, 0);
+
+      free(tasks);
+      free(blocks);
+      blocks = children;
+      numBlocks = numChildren;
+   }
+   free(blocks);
+
+   //fill in the uniform blocks from their corners
+   for (k=0; k < numUniform; ++k)
+   {
+      Block b = uniformBlocks[k];
+      unsigned char c = (*map).cells[ b.y0*nx + b.x0 ] | 128;
+      for (j=b.y0; j <= b.y1; ++j)
+         for (i=b.x0; i <= b.x1; ++i)
+            if (!S.done[j*nx + i]) (*map).cells[j*nx + i] = c;
+   }
+   free(uniformBlocks);
+
+   for (k=0; k < nx*ny; ++k)
+   {
+      if (S.done[k]) ++(*map).solved;
+      free(S.states[k]);
+   }
+   free(S.states);
+   free(S.numStates);
+   free(S.done);
+   free(S.xs);
+   free(S.ys);
+   deleteIndividual((void*)S.p);
+   return (map);
+}
+
+StateMap * bistableMap(BistablePoint * bis, void (*odefnc)(double,double*,double*,void*), int paramX, int paramY, double factor, int n)
+{
+   int numSeeds = 0;
+   double * seeds[3];
+   if (bis == 0 || (*bis).param == 0 || !(factor > 1.0)) return (0);
+   Parameters * p = (*bis).param;
+   if (paramX < 0 || paramX >= (*p).numParams || paramY < 0 || paramY >= (*p).numParams ||
+       !((*p).params[paramX] > 0) || !((*p).params[paramY] > 0))
+      return (0);
+
+   if ((*bis).stable1) seeds[numSeeds++] = (*bis).stable1;
+   if ((*bis).unstable) seeds[numSeeds++] = (*bis).unstable;
+   if ((*bis).stable2) seeds[numSeeds++] = (*bis).stable2;
+
+   double x = (*p).params[paramX], y = (*p).params[paramY];
+   return (stateMap(p, odefnc, seeds, numSeeds,
+                    paramX, x / factor, x * factor, n,
+                    paramY, y / factor, y * factor, n, 1));
+}
+
+int stateMapWrite(StateMap * map, const char * filename)
+{
+   if (map == 0 || filename == 0) return (1);
+   FILE * file = fopen(filename, "wb");
+   if (file == 0) return (1);
+
+   int header[6] = { (*map).nx, (*map).ny, (*map).paramX, (*map).paramY, (*map).logX, (*map).logY };
+   double ranges[4] = { (*map).xmin, (*map).xmax, (*map).ymin, (*map).ymax };
+   size_t cells = (size_t)(*map).nx * (*map).ny;
+   int ok = fwrite("SSMAP001", 1, 8, file) == 8 &&
+            fwrite(header, sizeof(int), 6, file) == 6 &&
+            fwrite(ranges, sizeof(double), 4, file) == 4 &&
+            fwrite((*map).cells, 1, cells, file) == cells;
+   if (fclose(file) != 0) ok = 0;
+   return (ok ? 0 : 1);
+}
+
+void stateMapFree(StateMap * map)
+{
+   if (map == 0) return;
+   free((*map).cells);
+   free(map);
+}
@@ -0,0 +1,94 @@
+#include "ga_bistable.h"
+
+#ifndef GA_STATEMAP_FILE
+#define GA_STATEMAP_FILE
+
+/*
+ * Each cell of a map is one byte:
+ *    bits 0-3   number of non-negative steady states (at most 15)
+ *    bits 4-6   how many of them are stable (at most 7)
+ *    bit 7      1 = filled in from the corners of its block by the refinement instead of solved
+*/
+#define STATEMAP_COUNT(c)     ((c) & 15)
+#define STATEMAP_STABLE(c)    (((c) >> 4) & 7)
+#define STATEMAP_INFERRED(c)  (((c) >> 7) & 1)
+
+#define STATEMAP_MAX_STATES   8     //states kept per cell (and used as seeds by its neighbours)
+#define STATEMAP_COARSE       32    //blocks per side of the coarse grid solved first
+
+/*steady states over a grid of two parameters*/
+typedef struct
+{
+   int nx, ny;              //cells along each parameter
+   int paramX, paramY;      //indices of the two parameters
+   double xmin, xmax;       //range of paramX
+   double ymin, ymax;       //range of paramY
+   int logX, logY;          //1 = the values are spaced evenly in log (both ends positive)
+   unsigned char * cells;   //nx * ny, row by row (cell (i,j) is cells[j*nx + i], paramX = value i)
+   long solved;             //cells solved (the others were filled in)
+} StateMap;
+
+/*
+ * Count the steady states over a grid of two parameters, all others fixed (all alphas 1).
+ * A coarse grid (STATEMAP_COARSE blocks per side) is solved first, a row per thread, each cell
+ * by Newton iterations from the given seeds and from the states of the cell before it, then by
+ * deflated Newton iterations (see deflatedNewton) to look for more; the states found are then
+ * spread over the coarse grid, each cell solved again from its neighbours until none gains a state.
+ * Each block of the grid is then split in four: a block whose four corners have the same count
+ * and stability is filled in from them (when refine is on), and the others get their
+ * midpoints solved, in parallel when compiled with OpenMP, by Newton iterations from the states
+ * of the corners (the boundaries of the regions move little from one cell to the next), with
+ * deflated iterations only where the count differs from the corners'. The work is then in
+ * proportion to the length of the boundaries instead of the area (a 512 x 512 map of a small
+ * model takes well under a second), but a region smaller than a coarse block that touches none
+ * of its corners can be missed.
+ * The system must have no conservation laws (the states must be isolated); the ode function
+ * must be thread-safe
+ * @param: individual with the other parameters (copied)
+ * @param: ode function pointer
+ * @param: initial points for the coarse grid (steady states near the individual, for instance)
+ * @param: number of initial points
+ * @param: index of the first parameter
+ * @param: its lowest value
+ * @param: its highest value
+ * @param: number of cells along it
+ * @param: index of the second parameter
+ * @param: its lowest value
+ * @param: its highest value
+ * @param: number of cells along it
+ * @param: 1 = fill in the blocks with uniform corners, 0 = solve every cell
+ * @ret: the map, or 0
+*/
+StateMap * stateMap(Parameters * p, void (*odefnc)(double,double*,double*,void*), double ** seeds, int numSeeds,
+                    int paramX, double xmin, double xmax, int nx,
+                    int paramY, double ymin, double ymax, int ny, int refine);
+
+/*
+ * The map around a result of makeBistable: n x n cells over each parameter divided and
+ * multiplied by factor, seeded with its steady states, with refinement
+ * @param: result of makeBistable
+ * @param: the ode function given to makeBistable
+ * @param: index of the first parameter
+ * @param: index of the second parameter
+ * @param: the parameters range over their values divided and multiplied by this (more than 1)
+ * @param: number of cells along each parameter
+ * @ret: the map, or 0
+*/
+StateMap * bistableMap(BistablePoint * bis, void (*odefnc)(double,double*,double*,void*), int paramX, int paramY, double factor, int n);
+
+/*
+ * Write a map as a binary file: the 8 characters "SSMAP001", then nx, ny, paramX, paramY,
+ * logX, logY (int), xmin, xmax, ymin, ymax (double) and the nx * ny cells (one byte each, row by row)
+ * @param: map
+ * @param: file name
+ * @ret: 0, or 1 if the file could not be written
+*/
+int stateMapWrite(StateMap *, const char * filename);
+
+/*
+ * free the structure
+ * @param: map (may be null)
+*/
+void stateMapFree(StateMap *);
+
+#endif
@@ -0,0 +1,94 @@
+#include "surrogate.h"
+
+/*largest number of neighbours used by surrogatePredict*/
+#define SURROGATE_MAX_K 32
+
+Surrogate * surrogateNew(int dim, int capacity)
+{
+   Surrogate * s = malloc(sizeof(Surrogate));
+   (*s).dim = dim;
+   (*s).capacity = capacity;
+   (*s).x = malloc(capacity * dim * sizeof(double));
+   (*s).y = malloc(capacity * sizeof(double));
+   (*s).lower = malloc(dim * sizeof(double));
+   (*s).upper = malloc(dim * sizeof(double));
+   surrogateClear(s);
+   return (s);
+}
+
+void surrogateFree(Surrogate * s)
+{
+   if (s == NULL) return;
+   free((*s).x);
+   free((*s).y);
+   free((*s).lower);
+   free((*s).upper);
+   free(s);
+}
+
+void surrogateClear(Surrogate * s)
+{
+   (*s).size = (*s).next = 0;
+}
+
+void surrogateAdd(Surrogate * s, double * x, double y)
+{
+   int i, d = (*s).dim;
+   double * row = (*s).x + (*s).next * d;
+
+   for (i=0; i < d; ++i)
+   {
+      row[i] = x[i];
+      if ((*s).size == 0 || x[i] < (*s).lower[i]) (*s).lower[i] = x[i];
+      if ((*s).size == 0 || x[i] > (*s).upper[i]) (*s).upper[i] = x[i];
+   }
+   (*s).y[ (*s).next ] = y;
+
+   (*s).next = ((*s).next + 1) % (*s).capacity;
+   if ((*s).size < (*s).capacity) ++(*s).size;
+}
+
+double surrogatePredict(Surrogate * s, double * x, int k)
+{
+   int i, j, m = 0, d = (*s).dim;
+   double best[SURROGATE_MAX_K] = { 0 };   //squared distances of the neighbours, sorted
+   int index[SURROGATE_MAX_K];
+
+   if ((*s).size == 0) return (0.0);
+   if (k > SURROGATE_MAX_K) k = SURROGATE_MAX_K;
+   if (k > (*s).size) k = (*s).size;
+   if (k < 1) k = 1;
+
+   for (i=0; i < (*s).size; ++i)
+   {
+      double * row = (*s).x + i * d;
+      double dist = 0;
+      for (j=0; j < d; ++j)
+      {
+         double range = (*s).upper[j] - (*s).lower[j];
+         double diff = row[j] - x[j];
+         if (range > 0) diff /= range;
+         dist += diff * diff;
+      }
+      if (m == k && dist >= best[m-1]) continue;
+      if (m < k) ++m;
+      for (j=m-1; j > 0 && best[j-1] > dist; --j)   //insertion into the sorted list
+      {
+         best[j] = best[j-1];
+         index[j] = index[j-1];
+      }
+      best[j] = dist;
+      index[j] = i;
+   }
+
+   if (best[0] == 0) return ((*s).y[ index[0] ]);   //seen before
+
+   double sum = 0, weights = 0;
+   for (i=0; i < m; ++i)
+   {
+      double w = 1.0 / best[i];
+      sum += w * (*s).y[ index[i] ];
+      weights += w;
+   }
+   return (sum / weights);
+}
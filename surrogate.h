@@ -0,0 +1,61 @@
+#include <stdlib.h>
+#include <math.h>
+
+#ifndef GA_SURROGATE_FILE
+#define GA_SURROGATE_FILE
+
+/*
+ * k-nearest-neighbour regressor trained online. It keeps the most recent points in a
+ * ring buffer and predicts the inverse-distance weighted mean of the k closest ones.
+ * Each coordinate is scaled by the range seen so far, so no coordinate dominates the distance
+*/
+typedef struct
+{
+   int dim;          //number of coordinates of a point
+   int capacity;     //maximum number of stored points
+   int size;         //number of stored points
+   int next;         //slot of the next point (the oldest one once the buffer is full)
+   double * x;       //points (capacity x dim)
+   double * y;       //values
+   double * lower;   //smallest value of each coordinate seen so far
+   double * upper;   //largest value of each coordinate seen so far
+} Surrogate;
+
+/*
+ * allocate an empty surrogate
+ * @param: number of coordinates
+ * @param: maximum number of stored points
+ * @ret: the surrogate
+*/
+Surrogate * surrogateNew(int dim, int capacity);
+
+/*
+ * free a surrogate
+ * @param: surrogate (may be null)
+*/
+void surrogateFree(Surrogate *);
+
+/*
+ * forget all points
+ * @param: surrogate
+*/
+void surrogateClear(Surrogate *);
+
+/*
+ * add a training point (replaces the oldest one when full)
+ * @param: surrogate
+ * @param: point (dim values)
+ * @param: value at the point
+*/
+void surrogateAdd(Surrogate *, double * x, double y);
+
+/*
+ * predict the value at a point
+ * @param: surrogate
+ * @param: point (dim values)
+ * @param: number of neighbours
+ * @ret: weighted mean of the neighbours (0 if there are no points)
+*/
+double surrogatePredict(Surrogate *, double * x, int k);
+
+#endif
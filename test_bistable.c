@@ -6,7 +6,7 @@ gcc -o cvode/*.*
 ar *.o -o libcvode.a
 
 Run this code:
-gcc cvodesim.c mat.c neldermead.c ga.c mtrand.c ga_bistable.c test_bistable.c -I./ -L./ -lcvode
+gcc -O3 -march=native -fopenmp cvodesim.c conservation.c sparse.c crnt.c homotopy.c fold.c continuation.c statemap.c nullcline.c mat.c neldermead.c ga.c es.c mtrand.c metrics.c surrogate.c ga_bistable.c test_bistable.c -I./ -L./ -lcvode -lm
 ./a.out
 
 
@@ -45,6 +45,8 @@ int main()
    Parameters * p = bis.param;
 
    if (!p) return 0;
+   if (bis.timedOut)
+      printf("\ntime limit reached, best fitness so far: %lf\n", bis.fitness);
    if (bis.unstable)
    {
       printf("\nunstable steady state:   ");